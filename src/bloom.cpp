@@ -21,6 +21,7 @@
 
 #include "primitives/transaction.h"
 #include "hash.h"
+#include "memusage.h"
 #include "script/script.h"
 #include "script/standard.h"
 #include "random.h"
@@ -285,3 +286,83 @@ void CRollingBloomFilter::reset()
     b2.reset(nNewTweak);
     nInsertions = 0;
 }
+
+CScalableBloomFilter::CScalableBloomFilter(unsigned int nInitialElementsIn, double nFPRateIn) :
+    nInitialElements(std::max(nInitialElementsIn, 1u)), nFPRate(nFPRateIn)
+{
+    clear();
+}
+
+void CScalableBloomFilter::AddLayer(unsigned int nElements, double nLayerFPRate)
+{
+    // Capped so that bit positions can be computed from 32-bit hashes.
+    uint64_t nBits = std::min((uint64_t)(-1 / LN2SQUARED * nElements * log(nLayerFPRate)), (uint64_t)std::numeric_limits<uint32_t>::max());
+    nBits = std::max(nBits, (uint64_t)64);
+    Layer layer;
+    layer.vData.resize((nBits + 63) / 64);
+    layer.nBits = nBits;
+    layer.nHashFuncs = std::max(1, std::min((int)((double)nBits / nElements * LN2), (int)MAX_HASH_FUNCS));
+    layer.nElements = nElements;
+    layer.nInsertions = 0;
+    vLayers.push_back(std::move(layer));
+}
+
+void CScalableBloomFilter::insert(const uint256& hash)
+{
+    if (contains(hash))
+        return;
+    if (vLayers.back().nInsertions >= vLayers.back().nElements) {
+        AddLayer(std::min((uint64_t)vLayers.back().nElements * 2, (uint64_t)std::numeric_limits<unsigned int>::max()),
+                 nFPRate / ((uint64_t)1 << std::min(vLayers.size(), (size_t)32)));
+    }
+
+    Layer& layer = vLayers.back();
+    uint64_t h = SipHashUint256(k0, k1, hash);
+    uint32_t h1 = h, h2 = h >> 32;
+    for (unsigned int i = 0; i < layer.nHashFuncs; i++) {
+        uint32_t nIndex = ((uint64_t)(uint32_t)(h1 + i * h2) * layer.nBits) >> 32;
+        layer.vData[nIndex >> 6] |= (uint64_t)1 << (nIndex & 63);
+    }
+    layer.nInsertions++;
+}
+
+bool CScalableBloomFilter::contains(const uint256& hash) const
+{
+    uint64_t h = SipHashUint256(k0, k1, hash);
+    uint32_t h1 = h, h2 = h >> 32;
+    for (const Layer& layer : vLayers) {
+        unsigned int i = 0;
+        for (; i < layer.nHashFuncs; i++) {
+            uint32_t nIndex = ((uint64_t)(uint32_t)(h1 + i * h2) * layer.nBits) >> 32;
+            if (!(layer.vData[nIndex >> 6] & ((uint64_t)1 << (nIndex & 63))))
+                break;
+        }
+        if (i == layer.nHashFuncs)
+            return true;
+    }
+    return false;
+}
+
+void CScalableBloomFilter::clear()
+{
+    k0 = GetRand(std::numeric_limits<uint64_t>::max());
+    k1 = GetRand(std::numeric_limits<uint64_t>::max());
+    vLayers.clear();
+    AddLayer(nInitialElements, nFPRate);
+}
+
+uint64_t CScalableBloomFilter::size() const
+{
+    uint64_t nSize = 0;
+    for (const Layer& layer : vLayers)
+        nSize += layer.nInsertions;
+    return nSize;
+}
+
+size_t CScalableBloomFilter::DynamicMemoryUsage() const
+{
+    size_t nUsage = memusage::DynamicUsage(vLayers);
+    for (const Layer& layer : vLayers)
+        nUsage += memusage::DynamicUsage(layer.vData);
+    return nUsage;
+}
@@ -149,5 +149,47 @@ private:
     CBloomFilter b1, b2;
 };
 
+/**
+ * ScalableBloomFilter is a probabilistic set of uint256 values of unknown,
+ * growing size, used to answer "definitely not present" without a database
+ * lookup. It is a list of bloom filters; once the newest one holds the
+ * number of elements it was sized for, a new one twice as large and with half
+ * the false-positive rate is added, so the overall false-positive rate stays
+ * below 2 * nFPRate however large the set grows. Items cannot be removed.
+ * Keys are hashed with SipHash under a random key, so peers cannot choose
+ * values that are likely false positives.
+ */
+class CScalableBloomFilter
+{
+public:
+    // Calls GetRand(), don't create global CScalableBloomFilter objects.
+    CScalableBloomFilter(unsigned int nInitialElements, double nFPRate);
+
+    void insert(const uint256& hash);
+    bool contains(const uint256& hash) const;
+
+    void clear();
+
+    //! Number of distinct items inserted (up to false positives)
+    uint64_t size() const;
+    size_t DynamicMemoryUsage() const;
+
+private:
+    struct Layer {
+        std::vector<uint64_t> vData;
+        uint32_t nBits;
+        unsigned int nHashFuncs;
+        unsigned int nElements;
+        unsigned int nInsertions;
+    };
+
+    unsigned int nInitialElements;
+    double nFPRate;
+    uint64_t k0, k1;
+    std::vector<Layer> vLayers;
+
+    void AddLayer(unsigned int nElements, double nLayerFPRate);
+};
+
 
 #endif // BITCOIN_BLOOM_H
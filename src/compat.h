@@ -116,8 +116,21 @@ typedef void* sockopt_arg_type;
 typedef char* sockopt_arg_type;
 #endif
 
+// On Linux sockets are waited on with poll() and the peer loop uses epoll,
+// neither of which is limited to descriptors below FD_SETSIZE. Without
+// epoll the peer loop falls back to select(), so descriptors must stay
+// below FD_SETSIZE and USE_POLL is left undefined.
+#if defined(__linux__) && defined(HAVE_SYS_EPOLL_H)
+#define USE_POLL
+#define USE_EPOLL
+#endif
+
+#ifdef USE_POLL
+#include <poll.h>
+#endif
+
 bool static inline IsSelectableSocket(const SOCKET& s) {
-#ifdef WIN32
+#if defined(USE_POLL) || defined(WIN32)
     return true;
 #else
     return (s < FD_SETSIZE);
@@ -4,6 +4,7 @@
 #include "pubkey.h"
 #include "zcash/JoinSplit.hpp"
 #include "util.h"
+#include "script/sigcache.h"
 
 #include "librustzcash.h"
 
@@ -36,6 +37,7 @@ int main(int argc, char **argv) {
         sprout_groth16_str.length(),
         true
     );
+    InitSignatureCache();
 
   testing::InitGoogleMock(&argc, argv);
 
@@ -1074,9 +1074,9 @@ TEST(CheckTransaction, HeartwoodAcceptsShieldedCoinbase) {
         libzcash::SaplingSpendingKey::random().default_address(), CAmount(123456), libzcash::Zip212Enabled::BeforeZip212);
     auto output = OutputDescriptionInfo(ovk, note, {{0xF6}});
 
-    auto ctx = librustzcash_sapling_proving_ctx_init();
-    auto odesc = output.Build(ctx).get();
-    librustzcash_sapling_proving_ctx_free(ctx);
+    uint256 rcv;
+    librustzcash_sapling_generate_r(rcv.begin());
+    auto odesc = output.Build(rcv).get();
 
     CMutableTransaction mtx = GetValidTransaction();
     mtx.fOverwintered = true;
@@ -1180,9 +1180,9 @@ TEST(CheckTransaction, HeartwoodEnforcesSaplingRulesOnShieldedCoinbase) {
     }
 
     // Add a Sapling output.
-    auto ctx = librustzcash_sapling_proving_ctx_init();
-    auto odesc = output.Build(ctx).get();
-    librustzcash_sapling_proving_ctx_free(ctx);
+    uint256 rcv;
+    librustzcash_sapling_generate_r(rcv.begin());
+    auto odesc = output.Build(rcv).get();
     mtx.vShieldedOutput.push_back(odesc);
 
     // Coinbase transaction should fail non-contextual checks with valueBalance
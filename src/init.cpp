@@ -39,6 +39,7 @@
 #include "komodo_globals.h"
 #include "komodo_notary.h"
 #include "komodo_gateway.h"
+#include "lightblocks.h"
 #include "main.h"
 
 #ifdef ENABLE_MINING
@@ -50,6 +51,7 @@
 #include "net.h"
 #include "rpc/server.h"
 #include "rpc/register.h"
+#include "script/sigcache.h"
 #include "script/standard.h"
 #include "scheduler.h"
 #include "txdb.h"
@@ -278,6 +280,7 @@ void Shutdown()
         LOCK(cs_main);
         if (pcoinsTip != NULL) {
             FlushStateToDisk();
+            WriteBlockIndexSnapshot();
         }
         if (pcoinsTip != NULL) {
             delete pcoinsTip;
@@ -299,6 +302,10 @@ void Shutdown()
             delete pnotarisations;
             pnotarisations = NULL;
         }
+        if (plightblocks != NULL) {
+            delete plightblocks;
+            plightblocks = NULL;
+        }
     }
 #ifdef ENABLE_WALLET
     if (pwalletMain)
@@ -420,6 +427,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-exportdir=<dir>", _("Specify directory to be used when exporting data"));
     strUsage += HelpMessageOpt("-dbcache=<n>", strprintf(_("Set database cache size in megabytes (%d to %d, default: %d)"), nMinDbCache, nMaxDbCache, nDefaultDbCache));
     strUsage += HelpMessageOpt("-loadblock=<file>", _("Imports blocks from external blk000??.dat file") + " " + _("on startup"));
+    strUsage += HelpMessageOpt("-maxblockservecachesize=<n>", strprintf(_("Keep up to <n> MiB of recently served blocks ready to send to peers (default: %u)"), DEFAULT_MAX_BLOCK_SERVE_CACHE_SIZE));
     strUsage += HelpMessageOpt("-maxorphantx=<n>", strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS));
     strUsage += HelpMessageOpt("-mempooltxinputlimit=<n>", _("[DEPRECATED FROM OVERWINTER] Set the maximum number of transparent inputs in a transaction that the mempool will accept (default: 0 = no limit applied)"));
     strUsage += HelpMessageOpt("-par=<n>", strprintf(_("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
@@ -432,6 +440,7 @@ std::string HelpMessage(HelpMessageMode mode)
     // strUsage += HelpMessageOpt("-prune=<n>", strprintf(_("Reduce storage requirements by pruning (deleting) old blocks. This mode disables wallet support and is incompatible with -txindex. "
     //         "Warning: Reverting this setting requires re-downloading the entire blockchain. "
     //         "(default: 0 = disable pruning blocks, >%u = target size in MiB to use for block files)"), MIN_DISK_SPACE_FOR_BLOCK_FILES / 1024 / 1024));
+    strUsage += HelpMessageOpt("-blockindexsnapshot", strprintf(_("Write the block index to blockindex.dat on shutdown and load it on the next start (default: %u)"), DEFAULT_BLOCKINDEX_SNAPSHOT));
     strUsage += HelpMessageOpt("-bootstrap", _("Download and install bootstrap on startup (1 to show GUI prompt, 2 to force download when using CLI)"));
     strUsage += HelpMessageOpt("-reindex", _("Rebuild block chain index from current blk000??.dat files on startup"));
 #if !defined(WIN32)
@@ -441,6 +450,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-addressindex", strprintf(_("Maintain a full address index, used to query for the balance, txids and unspent outputs for addresses (default: %u)"), DEFAULT_ADDRESSINDEX));
     strUsage += HelpMessageOpt("-timestampindex", strprintf(_("Maintain a timestamp index for block hashes, used to query blocks hashes by a range of timestamps (default: %u)"), DEFAULT_TIMESTAMPINDEX));
     strUsage += HelpMessageOpt("-spentindex", strprintf(_("Maintain a full spent index, used to query the spending txid and input index for an outpoint (default: %u)"), DEFAULT_SPENTINDEX));
+    strUsage += HelpMessageOpt("-lightblockindex", strprintf(_("Maintain compact Sapling blocks for light clients, served by the /rest/saplingblocks endpoint (default: %u)"), DEFAULT_LIGHTBLOCKINDEX));
     strUsage += HelpMessageGroup(_("Connection options:"));
     strUsage += HelpMessageOpt("-addnode=<ip>", _("Add a node to connect to and attempt to keep the connection open"));
     strUsage += HelpMessageOpt("-asmap=<file>", strprintf("Specify asn mapping used for bucketing of the peers (default: %s). Relative paths will be prefixed by the net-specific datadir location.", DEFAULT_ASMAP_FILENAME));
@@ -458,6 +468,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-maxconnections=<n>", strprintf(_("Maintain at most <n> connections to peers (default: %u)"), DEFAULT_MAX_PEER_CONNECTIONS));
     strUsage += HelpMessageOpt("-maxreceivebuffer=<n>", strprintf(_("Maximum per-connection receive buffer, <n>*1000 bytes (default: %u)"), 5000));
     strUsage += HelpMessageOpt("-maxsendbuffer=<n>", strprintf(_("Maximum per-connection send buffer, <n>*1000 bytes (default: %u)"), 1000));
+    strUsage += HelpMessageOpt("-msghandthreads=<n>", strprintf(_("Number of threads processing peer messages, each serving its own share of the peers (1 to %d, default: %d)"), MAX_MESSAGE_HANDLER_THREADS, DEFAULT_MESSAGE_HANDLER_THREADS));
     strUsage += HelpMessageOpt("-onion=<ip:port>", strprintf(_("Use separate SOCKS5 proxy to reach peers via Tor hidden services (default: %s)"), "-proxy"));
     strUsage += HelpMessageOpt("-i2psam=<ip:port>", strprintf(_("I2P SAM proxy to reach I2P peers and accept I2P connections (default: none)")));
     strUsage += HelpMessageOpt("-i2pacceptincoming", strprintf(_("If set and -i2psam is also set then incoming I2P connections are accepted via the SAM proxy. If this is not set but -i2psam is set then only outgoing connections will be made to the I2P network. Ignored if -i2psam is not set. Listening for incoming I2P connections is done through the SAM proxy, not by binding to a local address and port (default: 1)")));
@@ -504,6 +515,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-deletetx", _("Enable Old Transaction Deletion"));
     strUsage += HelpMessageOpt("-deleteinterval", strprintf(_("Delete transaction every <n> blocks during inital block download (default: %i)"), DEFAULT_TX_DELETE_INTERVAL));
     strUsage += HelpMessageOpt("-keeptxnum", strprintf(_("Keep the last <n> transactions (default: %i)"), DEFAULT_TX_RETENTION_LASTTX));
+    strUsage += HelpMessageOpt("-rescanbatchsize", strprintf(_("Read and trial decrypt <n> blocks at a time during wallet rescans (default: %i)"), DEFAULT_RESCAN_BATCH_SIZE));
     strUsage += HelpMessageOpt("-keeptxfornblocks", strprintf(_("Keep transactions for at least <n> blocks (default: %i)"), DEFAULT_TX_RETENTION_BLOCKS));
     if (showDebug)
         strUsage += HelpMessageOpt("-mintxfee=<amt>", strprintf("Fees (in %s/kB) smaller than this are considered zero fee for transaction creation (default: %s)",
@@ -562,7 +574,8 @@ std::string HelpMessage(HelpMessageMode mode)
     {
         strUsage += HelpMessageOpt("-limitfreerelay=<n>", strprintf("Continuously rate-limit free transactions to <n>*1000 bytes per minute (default: %u)", 15));
         strUsage += HelpMessageOpt("-relaypriority", strprintf("Require high priority for relaying free or low-fee transactions (default: %u)", 0));
-        strUsage += HelpMessageOpt("-maxsigcachesize=<n>", strprintf("Limit size of signature cache to <n> entries (default: %u)", 50000));
+        strUsage += HelpMessageOpt("-maxbundlecachesize=<n>", strprintf("Limit size of the Sapling bundle validity cache to <n> MiB (default: %u)", DEFAULT_MAX_BUNDLE_CACHE_SIZE));
+        strUsage += HelpMessageOpt("-maxsigcachesize=<n>", strprintf("Limit size of signature cache to <n> MiB (default: %u)", DEFAULT_MAX_SIG_CACHE_SIZE));
         strUsage += HelpMessageOpt("-maxtipage=<n>", strprintf("Maximum tip age in seconds to consider node in initial block download (default: %u)", DEFAULT_MAX_TIP_AGE));
     }
     strUsage += HelpMessageOpt("-minrelaytxfee=<amt>", strprintf(_("Fees (in %s/kB) smaller than this are considered zero fee for relaying (default: %s)"),
@@ -793,6 +806,9 @@ void ThreadImport(std::vector<boost::filesystem::path> vImportFiles)
         }
     }
 
+    // Convert any blocks connected before the light client index was enabled
+    SyncLightBlockStore();
+
     if (GetBoolArg("-stopafterblockimport", false)) {
         LogPrintf("Stopping after block import\n");
         StartShutdown();
@@ -1179,6 +1195,17 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     }
     LogPrintf("Maximum number of processing threads used in multithreaded functions %i\n", maxProcessingThreads);
 
+    // Initialize the transparent script signature cache
+    InitSignatureCache();
+
+    // Initialize the Sapling bundle validity cache used by the batch validators
+    size_t nBundleCacheSize = std::max((int64_t)0, GetArg("-maxbundlecachesize", DEFAULT_MAX_BUNDLE_CACHE_SIZE)) * ((size_t)1 << 20);
+    bundlecache::init(nBundleCacheSize);
+    LogPrintf("Using %u MiB for the Sapling bundle validity cache\n", nBundleCacheSize >> 20);
+
+    nBlockServeCacheSize = std::max((int64_t)0, GetArg("-maxblockservecachesize", DEFAULT_MAX_BLOCK_SERVE_CACHE_SIZE)) * ((size_t)1 << 20);
+    LogPrintf("Using %u MiB for the served block cache\n", nBlockServeCacheSize >> 20);
+
     // when specifying an explicit binding address, you want to listen on it
     // even when -connect or -proxy is specified
 
@@ -1278,7 +1305,13 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     int nBind = std::max((int)mapArgs.count("-bind") + (int)mapArgs.count("-whitebind"), 1);
     nMaxConnections = GetArg("-maxconnections", DEFAULT_MAX_PEER_CONNECTIONS);
     //fprintf(stderr,"nMaxConnections %d\n",nMaxConnections);
+#ifdef USE_POLL
+    // Sockets are waited on with poll() and epoll rather than select(), so
+    // descriptors are not limited to FD_SETSIZE, only by the process limit.
+    nMaxConnections = std::max(nMaxConnections, 0);
+#else
     nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS)), 0);
+#endif
     int nFD = RaiseFileDescriptorLimit(nMaxConnections + MIN_CORE_FILEDESCRIPTORS);
     //fprintf(stderr,"nMaxConnections %d FD_SETSIZE.%d nBind.%d expr.%d \n",nMaxConnections,FD_SETSIZE,nBind,(int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS));
     if (nFD < MIN_CORE_FILEDESCRIPTORS)
@@ -1341,6 +1374,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         mempool.setSanityCheck(1.0 / ratio);
     }
     fCheckBlockIndex = GetBoolArg("-checkblockindex", chainparams.DefaultConsistencyChecks());
+    fBlockIndexSnapshot = GetBoolArg("-blockindexsnapshot", DEFAULT_BLOCKINDEX_SNAPSHOT);
     fCheckpointsEnabled = GetBoolArg("-checkpoints", true);
 
     // -par=0 means autodetect, but nScriptCheckThreads==0 means no concurrency
@@ -2100,6 +2134,12 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         if (!est_filein.IsNull())
             mempool.ReadFeeEstimates(est_filein);
         fFeeEstimatesInitialized = true;
+
+        if (GetBoolArg("-lightblockindex", DEFAULT_LIGHTBLOCKINDEX)) {
+            plightblocks = new CLightBlockStore(GetDataDir() / "blocks" / "light");
+            if (!plightblocks->Open(fReindex))
+                return InitError(_("Unable to open the light client block index"));
+        }
     }
     else
     {
@@ -2117,6 +2157,10 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         LogPrintf("Wallet disabled!\n");
     } else {
 
+        // Start the Sapling note decryption workers, the scanning thread joins them as the last worker
+        for (int i = 0; i < maxProcessingThreads - 1; i++)
+            threadGroup.create_thread(&ThreadSaplingDecryption);
+
         // needed to restore wallet transaction meta data after -zapwallettxes
         std::vector<CWalletTx> vWtx;
 
@@ -2484,6 +2528,10 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         if (fDeleteInterval < 1)
           return InitError("deleteinterval must be greater than 0");
 
+        nRescanBatchSize = GetArg("-rescanbatchsize", DEFAULT_RESCAN_BATCH_SIZE);
+        if (nRescanBatchSize < 1)
+          return InitError("rescanbatchsize must be greater than 0");
+
         fKeepLastNTransactions = GetArg("-keeptxnum", DEFAULT_TX_RETENTION_LASTTX);
         if (fKeepLastNTransactions < 1)
           return InitError("keeptxnum must be greater than 0");
@@ -2628,7 +2676,8 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
             uiInterface.InitMessage(_("Rescanning..."));
             LogPrintf("Rescanning last %i blocks (from block %i)...\n", chainActive.Height() - pindexRescan->nHeight, pindexRescan->nHeight);
             nStart = GetTimeMillis();
-            pwalletMain->ScanForWalletTransactions(pindexRescan, true, false, false, false);
+            if (pwalletMain->ScanForWalletTransactions(pindexRescan, true, false, false, false) < 0)
+                return InitError(_("Wallet rescan failed, see debug.log for details"));
             LogPrintf(" rescan      %15dms\n", GetTimeMillis() - nStart);
 
             // Restore wallet transaction metadata after -zapwallettxes=1
@@ -2662,7 +2711,8 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                 uiInterface.InitMessage(_("Rescanning..."));
                 LogPrintf("Rescanning last %i blocks (from block %i)...\n", chainActive.Height() - pindexRescan->nHeight, pindexRescan->nHeight);
                 nStart = GetTimeMillis();
-                pwalletMain->ScanForWalletTransactions(pindexRescan, true, false, false, false);
+                if (pwalletMain->ScanForWalletTransactions(pindexRescan, true, false, false, false) < 0)
+                    return InitError(_("Wallet rescan failed, see debug.log for details"));
                 LogPrintf(" rescan      %15dms\n", GetTimeMillis() - nStart);
             }
         }
@@ -2803,6 +2853,9 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     // recently added to the mempool.
     threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "txnotify", &ThreadNotifyRecentlyAdded));
 
+    // Batch proof verification for relayed shielded transactions
+    threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "txadmission", &ThreadTxAdmission));
+
     // Start the thread that updates komodo internal structures
     threadGroup.create_thread(&ThreadUpdateKomodoInternals);
 
@@ -20,6 +20,8 @@
 #include "komodo.h"
 #include "rpc/net.h"
 #include "init.h"
+#include "txdb.h"
+#include "undo.h"
 
 
 /************************************************************************
@@ -2088,7 +2090,7 @@ int32_t komodo_acpublic(uint32_t tiptime)
     return(acpublic);
 }
 
-int64_t komodo_newcoins(int64_t *zfundsp,int64_t *sproutfundsp,int32_t nHeight,CBlock *pblock)
+int64_t komodo_newcoins(int64_t *zfundsp,int64_t *sproutfundsp,int32_t nHeight,CBlock *pblock,const CBlockUndo *pundo)
 {
     CTxDestination address; int32_t i,j,m,n,vout; uint8_t *script; uint256 txid,hashBlock; int64_t zfunds=0,vinsum=0,voutsum=0,sproutfunds=0;
     n = pblock->vtx.size();
@@ -2101,6 +2103,13 @@ int64_t komodo_newcoins(int64_t *zfundsp,int64_t *sproutfundsp,int32_t nHeight,C
             {
                 if ( i == 0 )
                     continue;
+                if ( pundo != nullptr )
+                {
+                    // mints such as coin imports spend no outputs, so they have no undo entries
+                    if ( (size_t)(i-1) < pundo->vtxundo.size() && (size_t)j < pundo->vtxundo[i-1].vprevout.size() )
+                        vinsum += pundo->vtxundo[i-1].vprevout[j].txout.nValue;
+                    continue;
+                }
                 txid = tx.vin[j].prevout.hash;
                 vout = tx.vin[j].prevout.n;
                 if ( !GetTransaction(txid,vintx,hashBlock, false) || vout >= vintx.vout.size() )
@@ -2117,7 +2126,7 @@ int64_t komodo_newcoins(int64_t *zfundsp,int64_t *sproutfundsp,int32_t nHeight,C
             {
                 if ( ExtractDestination(tx.vout[j].scriptPubKey,address) != 0 && strcmp("RD6GgnrMpPaTSMn8vai6yiGA7mN4QGPVMY",CBitcoinAddress(address).ToString().c_str()) != 0 )
                     voutsum += tx.vout[j].nValue;
-                else printf("skip %.8f -> %s\n",dstr(tx.vout[j].nValue),CBitcoinAddress(address).ToString().c_str());
+                else LogPrint("coinsupply","skip %.8f -> %s\n",dstr(tx.vout[j].nValue),CBitcoinAddress(address).ToString().c_str());
             }
             script = (uint8_t *)&tx.vout[j].scriptPubKey[0];
             if ( script == 0 || script[0] != 0x6a )
@@ -2147,12 +2156,19 @@ int64_t komodo_newcoins(int64_t *zfundsp,int64_t *sproutfundsp,int32_t nHeight,C
 int64_t komodo_coinsupply(int64_t *zfundsp,int64_t *sproutfundsp,int32_t height)
 {
     CBlockIndex *pindex; CBlock block; int64_t zfunds=0,sproutfunds=0,supply = 0;
+    CCoinSupplyIndexValue total; bool found = false; std::vector<CBlockIndex *> walked;
     //fprintf(stderr,"coinsupply %d\n",height);
     *zfundsp = *sproutfundsp = 0;
     if ( (pindex= komodo_chainactive(height)) != 0 )
     {
+        // walk back to the nearest persisted total, normally the requested height itself
         while ( pindex != 0 && pindex->nHeight > 0 )
         {
+            if ( pblocktree->ReadCoinSupply(pindex->nHeight,total) && total.hashBlock == pindex->GetBlockHash() )
+            {
+                found = true;
+                break;
+            }
             if ( pindex->newcoins == 0 && pindex->zfunds == 0 )
             {
                 if ( komodo_blockload(block,pindex) == 0 )
@@ -2163,18 +2179,67 @@ int64_t komodo_coinsupply(int64_t *zfundsp,int64_t *sproutfundsp,int32_t height)
                     return(0);
                 }
             }
-            supply += pindex->newcoins;
-            zfunds += pindex->zfunds;
-            sproutfunds += pindex->sproutfunds;
-            //printf("start ht.%d new %.8f -> supply %.8f zfunds %.8f -> %.8f\n",pindex->nHeight,dstr(pindex->newcoins),dstr(supply),dstr(pindex->zfunds),dstr(zfunds));
+            walked.push_back(pindex);
             pindex = pindex->pprev;
         }
+        if ( found )
+        {
+            supply = total.supply;
+            zfunds = total.zfunds;
+            sproutfunds = total.sproutfunds;
+        }
+        // persist the totals of the blocks walked so the next call is a single lookup
+        std::vector<std::pair<int, CCoinSupplyIndexValue> > vect;
+        for (auto itr = walked.rbegin(); itr != walked.rend(); ++itr)
+        {
+            supply += (*itr)->newcoins;
+            zfunds += (*itr)->zfunds;
+            sproutfunds += (*itr)->sproutfunds;
+            total.hashBlock = (*itr)->GetBlockHash();
+            total.supply = supply;
+            total.zfunds = zfunds;
+            total.sproutfunds = sproutfunds;
+            vect.push_back(std::make_pair((int)(*itr)->nHeight,total));
+            if ( vect.size() >= 10000 || itr+1 == walked.rend() )
+            {
+                if ( !pblocktree->WriteCoinSupply(vect) )
+                    fprintf(stderr,"error writing coin supply totals at ht.%d\n",(*itr)->nHeight);
+                vect.clear();
+            }
+        }
     }
     *zfundsp = zfunds;
     *sproutfundsp = sproutfunds;
     return(supply);
 }
 
+void komodo_coinsupply_connect(CBlockIndex *pindex,const CBlock& block,const CBlockUndo& blockundo)
+{
+    CCoinSupplyIndexValue prev,total;
+    if ( pindex->pprev == 0 )
+        return;
+    pindex->newcoins = komodo_newcoins(&pindex->zfunds,&pindex->sproutfunds,pindex->nHeight,(CBlock *)&block,&blockundo);
+    // genesis is not counted, otherwise extend the totals of the previous block
+    if ( pindex->pprev->nHeight > 0 )
+    {
+        if ( !pblocktree->ReadCoinSupply(pindex->pprev->nHeight,prev) || prev.hashBlock != pindex->pprev->GetBlockHash() )
+            return; // not built yet, komodo_coinsupply fills them in when first asked
+    }
+    total.hashBlock = pindex->GetBlockHash();
+    total.supply = prev.supply + pindex->newcoins;
+    total.zfunds = prev.zfunds + pindex->zfunds;
+    total.sproutfunds = prev.sproutfunds + pindex->sproutfunds;
+    std::vector<std::pair<int, CCoinSupplyIndexValue> > vect;
+    vect.push_back(std::make_pair((int)pindex->nHeight,total));
+    if ( !pblocktree->WriteCoinSupply(vect) )
+        fprintf(stderr,"error writing coin supply totals at ht.%d\n",pindex->nHeight);
+}
+
+void komodo_coinsupply_disconnect(const CBlockIndex *pindex)
+{
+    pblocktree->EraseCoinSupply(pindex->nHeight);
+}
+
 void komodo_addutxo(std::vector<komodo_staking> &array,uint32_t txtime,uint64_t nValue,uint256 txid,int32_t vout,char *address,uint8_t *hashbuf,CScript pk)
 {
     uint256 hash; uint32_t segid32; komodo_staking kp;
@@ -27,6 +27,8 @@ bool EnsureWalletIsAvailable(bool avoidException);
 
 uint32_t komodo_heightstamp(int32_t height);
 
+class CBlockUndo;
+
 struct MemoryStruct { char *memory; size_t size; };
 struct return_string { char *ptr; size_t len; };
 
@@ -218,10 +220,41 @@ int32_t komodo_checkPOW(int64_t stakeTxValue, int32_t slowflag,CBlock *pblock,in
 
 int32_t komodo_acpublic(uint32_t tiptime);
 
-int64_t komodo_newcoins(int64_t *zfundsp,int64_t *sproutfundsp,int32_t nHeight,CBlock *pblock);
-
+/*****
+ * @brief the coins created by a block
+ * @param[out] zfundsp the change in shielded funds
+ * @param[out] sproutfundsp the change in sprout funds
+ * @param nHeight the block height
+ * @param pblock the block
+ * @param pundo the block undo data to take spent output values from, looked up by txid if null
+ * @returns the transparent coins created
+ */
+int64_t komodo_newcoins(int64_t *zfundsp,int64_t *sproutfundsp,int32_t nHeight,CBlock *pblock,const CBlockUndo *pundo = nullptr);
+
+/*****
+ * @brief the coin supply of the active chain at a height, from the persisted running
+ *      totals, any missing totals are computed and persisted on the way
+ * @param[out] zfundsp the shielded funds
+ * @param[out] sproutfundsp the sprout funds
+ * @param height the height
+ * @returns the transparent supply, 0 on error
+ */
 int64_t komodo_coinsupply(int64_t *zfundsp,int64_t *sproutfundsp,int32_t height);
 
+/*****
+ * @brief extend the persisted coin supply totals with a connected block
+ * @param pindex the block index
+ * @param block the block
+ * @param blockundo the undo data of the block
+ */
+void komodo_coinsupply_connect(CBlockIndex *pindex,const CBlock& block,const CBlockUndo& blockundo);
+
+/*****
+ * @brief remove the persisted coin supply totals of a disconnected block
+ * @param pindex the block index
+ */
+void komodo_coinsupply_disconnect(const CBlockIndex *pindex);
+
 struct komodo_staking
 {
     char address[64];
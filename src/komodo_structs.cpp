@@ -345,6 +345,79 @@ std::ostream& operator<<(std::ostream& os, const event_pricefeed& in)
 
 } // namespace komodo
 
+notarized_checkpoint_index::notarized_checkpoint_index(const notarized_checkpoint_index &other)
+{
+    *this = other;
+}
+
+notarized_checkpoint_index& notarized_checkpoint_index::operator=(const notarized_checkpoint_index &other)
+{
+    if ( this != &other )
+    {
+        std::lock(mtx, other.mtx);
+        std::lock_guard<std::mutex> lock(mtx, std::adopt_lock);
+        std::lock_guard<std::mutex> otherlock(other.mtx, std::adopt_lock);
+        coverage = other.coverage;
+        hot_valid = false;
+    }
+    return *this;
+}
+
+/***
+ * @brief add a checkpoint, replacing earlier ones over the heights it covers
+ * @param idx the position of the checkpoint in the collection
+ * @param cp the checkpoint
+ */
+void notarized_checkpoint_index::Add(size_t idx, const notarized_checkpoint &cp)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    hot_valid = false;
+
+    int32_t depth = cp.MoMdepth & 0xffff;
+    if ( cp.MoMdepth == 0 || depth == 0 )
+        return;
+    // covers height > notarized_height - depth && height <= notarized_height
+    int32_t first = cp.notarized_height - depth + 1;
+    int32_t end = cp.notarized_height + 1;
+
+    // keep whatever covered the height just past this range
+    int64_t after = -1;
+    auto itr = coverage.upper_bound(end);
+    if ( itr != coverage.begin() )
+        after = std::prev(itr)->second;
+
+    coverage.erase(coverage.lower_bound(first), itr);
+    coverage[first] = idx;
+    coverage[end] = after;
+}
+
+/***
+ * @brief find the latest checkpoint covering a height
+ * @param height the height
+ * @returns the position of the checkpoint, -1 if none
+ */
+int64_t notarized_checkpoint_index::Find(int32_t height) const
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    if ( !hot_valid || hot_height != height )
+    {
+        hot_idx = -1;
+        auto itr = coverage.upper_bound(height);
+        if ( itr != coverage.begin() )
+            hot_idx = std::prev(itr)->second;
+        hot_height = height;
+        hot_valid = true;
+    }
+    return hot_idx;
+}
+
+void notarized_checkpoint_index::Clear()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    coverage.clear();
+    hot_valid = false;
+}
+
 /*****
  * @brief add a checkpoint to the collection and update member values
  * @param in the new values
@@ -353,6 +426,7 @@ void komodo_state::AddCheckpoint(const notarized_checkpoint &in)
 {
     NPOINTS.push_back(in);
     last = in;
+    NPOINTS_index.Add(NPOINTS.size() - 1, in);
 }
 
 /****
@@ -471,21 +545,18 @@ int32_t komodo_state::PrevMoMHeight() const
  */
 const notarized_checkpoint *komodo_state::CheckpointAtHeight(int32_t height) const
 {
-    // find the nearest notarization_height
-    // work backwards, get the first one that meets our criteria
-    for(auto itr = NPOINTS.rbegin(); itr != NPOINTS.rend(); ++itr)
-    {
-        if ( itr->MoMdepth != 0
-                && height > itr->notarized_height-(itr->MoMdepth&0xffff) // 2s compliment if negative
-                && height <= itr->notarized_height )
-        {
-            return &(*itr);
-        }
-    }
-    return nullptr;
+    // the latest checkpoint whose MoM covers height > notarized_height-(MoMdepth&0xffff) && height <= notarized_height
+    int64_t idx = NPOINTS_index.Find(height);
+    if ( idx < 0 )
+        return nullptr;
+    return &NPOINTS[idx];
 }
 
-void komodo_state::clear_checkpoints() { NPOINTS.clear(); }
+void komodo_state::clear_checkpoints()
+{
+    NPOINTS.clear();
+    NPOINTS_index.Clear();
+}
 const uint256& komodo_state::LastNotarizedHash() const { return last.notarized_hash; }
 void komodo_state::SetLastNotarizedHash(const uint256 &in) { last.notarized_hash = in; }
 const uint256& komodo_state::LastNotarizedDestTxId() const { return last.notarized_desttxid; }
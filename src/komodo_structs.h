@@ -15,6 +15,8 @@
 #pragma once
 #include <memory>
 #include <list>
+#include <map>
+#include <mutex>
 #include <vector>
 #include <cstdint>
 
@@ -32,7 +34,6 @@
 #define KOMODO_ASSETCHAIN_MAXLEN 65
 
 #include "bits256.h"
-#include <mutex>
 
 //extern std::mutex komodo_mutex;  //todo remove
 
@@ -242,6 +243,41 @@ struct notarized_checkpoint
     friend bool operator==(const notarized_checkpoint& lhs, const notarized_checkpoint& rhs);
 };
 
+/***
+ * Index over the heights covered by the MoM of each notarized checkpoint, so the
+ * latest checkpoint covering a height is found in O(log n) instead of a scan
+ */
+class notarized_checkpoint_index
+{
+public:
+    notarized_checkpoint_index() = default;
+    notarized_checkpoint_index(const notarized_checkpoint_index &other);
+    notarized_checkpoint_index& operator=(const notarized_checkpoint_index &other);
+
+    /***
+     * @brief add a checkpoint, replacing earlier ones over the heights it covers
+     * @param idx the position of the checkpoint in the collection
+     * @param cp the checkpoint
+     */
+    void Add(size_t idx, const notarized_checkpoint &cp);
+
+    /***
+     * @brief find the latest checkpoint covering a height
+     * @param height the height
+     * @returns the position of the checkpoint, -1 if none
+     */
+    int64_t Find(int32_t height) const;
+
+    void Clear();
+
+private:
+    std::map<int32_t, int64_t> coverage; // first height of a range -> checkpoint position, -1 for none
+    mutable int32_t hot_height = 0; // last height looked up, tip queries tend to repeat
+    mutable int64_t hot_idx = -1;
+    mutable bool hot_valid = false;
+    mutable std::mutex mtx;
+};
+
 bool operator==(const notarized_checkpoint& lhs, const notarized_checkpoint& rhs);
 
 struct komodo_ccdataMoM
@@ -304,6 +340,7 @@ protected:
     void clear_checkpoints();
     std::vector<notarized_checkpoint> NPOINTS; // collection of notarizations
     mutable size_t NPOINTS_last_index = 0; // caches checkpoint linear search position
+    notarized_checkpoint_index NPOINTS_index; // heights covered by each checkpoint
     notarized_checkpoint last;
 
 public:
@@ -0,0 +1,408 @@
+// Copyright (c) 2022 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "lightblocks.h"
+
+#include "chain.h"
+#include "clientversion.h"
+#include "init.h"
+#include "main.h"
+#include "streams.h"
+#include "util.h"
+
+#include <boost/thread.hpp>
+
+CLightBlockStore *plightblocks = NULL;
+
+/** Serialized size of a CLightBlockIndexEntry */
+static const unsigned int LIGHTBLOCK_INDEX_ENTRY_SIZE = 44;
+
+CCompactSaplingOutput::CCompactSaplingOutput(const OutputDescription& output)
+{
+    cmu = output.cmu;
+    ephemeralKey = output.ephemeralKey;
+    std::copy(output.encCiphertext.begin(), output.encCiphertext.begin() + COMPACT_NOTE_CIPHERTEXT_SIZE, encCiphertext.begin());
+}
+
+CCompactSaplingBlock::CCompactSaplingBlock(const CBlock& block, int nHeightIn)
+{
+    nHeight = nHeightIn;
+    hash = block.GetHash();
+    hashPrevBlock = block.hashPrevBlock;
+    hashFinalSaplingRoot = block.hashFinalSaplingRoot;
+    nTime = block.nTime;
+
+    for (uint32_t i = 0; i < block.vtx.size(); i++) {
+        const CTransaction& tx = block.vtx[i];
+        if (tx.vShieldedSpend.empty() && tx.vShieldedOutput.empty())
+            continue;
+
+        CCompactSaplingTx ctx;
+        ctx.nIndex = i;
+        ctx.txid = tx.GetHash();
+        ctx.vSpends.reserve(tx.vShieldedSpend.size());
+        for (const SpendDescription& spend : tx.vShieldedSpend) {
+            ctx.vSpends.push_back(CCompactSaplingSpend(spend.nullifier));
+        }
+        ctx.vOutputs.reserve(tx.vShieldedOutput.size());
+        for (const OutputDescription& output : tx.vShieldedOutput) {
+            ctx.vOutputs.push_back(CCompactSaplingOutput(output));
+        }
+        vtx.push_back(ctx);
+    }
+}
+
+CLightBlockStore::CLightBlockStore(const boost::filesystem::path& pathIn) : path(pathIn), fileIndex(NULL), nBlocks(0), nTruncations(0), fRebuild(false) {}
+
+CLightBlockStore::~CLightBlockStore()
+{
+    LOCK(cs_lightblocks);
+    if (fileIndex != NULL) {
+        FileCommit(fileIndex);
+        fclose(fileIndex);
+        fileIndex = NULL;
+    }
+}
+
+boost::filesystem::path CLightBlockStore::GetDataFilename(unsigned int nFile) const
+{
+    return path / strprintf("lbk%05u.dat", nFile);
+}
+
+FILE* CLightBlockStore::OpenDataFile(unsigned int nFile, bool fReadOnly) const
+{
+    boost::filesystem::path pathFile = GetDataFilename(nFile);
+    FILE* file = fopen(pathFile.string().c_str(), fReadOnly ? "rb" : "rb+");
+    if (!file && !fReadOnly)
+        file = fopen(pathFile.string().c_str(), "wb+");
+    if (!file)
+        LogPrintf("%s: Unable to open file %s\n", __func__, pathFile.string());
+    return file;
+}
+
+bool CLightBlockStore::ReadEntry(int nHeight, CLightBlockIndexEntry& entry) const
+{
+    AssertLockHeld(cs_lightblocks);
+    if (fileIndex == NULL || nHeight < 0 || nHeight >= nBlocks)
+        return false;
+
+    if (fseek(fileIndex, (long)nHeight * LIGHTBLOCK_INDEX_ENTRY_SIZE, SEEK_SET))
+        return false;
+
+    std::vector<char> vch(LIGHTBLOCK_INDEX_ENTRY_SIZE);
+    if (fread(vch.data(), 1, vch.size(), fileIndex) != vch.size())
+        return false;
+
+    try {
+        CDataStream ss(vch, SER_DISK, CLIENT_VERSION);
+        ss >> entry;
+    } catch (const std::exception& e) {
+        return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+    }
+    return true;
+}
+
+bool CLightBlockStore::WriteEntry(int nHeight, const CLightBlockIndexEntry& entry)
+{
+    AssertLockHeld(cs_lightblocks);
+    if (fseek(fileIndex, (long)nHeight * LIGHTBLOCK_INDEX_ENTRY_SIZE, SEEK_SET))
+        return false;
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << entry;
+    assert(ss.size() == LIGHTBLOCK_INDEX_ENTRY_SIZE);
+    if (fwrite(&ss[0], 1, ss.size(), fileIndex) != ss.size())
+        return false;
+
+    fflush(fileIndex);
+    return true;
+}
+
+bool CLightBlockStore::TruncateLocked(int nHeight)
+{
+    AssertLockHeld(cs_lightblocks);
+    if (fileIndex == NULL || nHeight < 0)
+        return false;
+    if (nHeight >= nBlocks)
+        return true;
+
+    //Stale bytes left in the data files are overwritten by the next write
+    fflush(fileIndex);
+    if (!TruncateFile(fileIndex, (unsigned int)nHeight * LIGHTBLOCK_INDEX_ENTRY_SIZE))
+        return error("%s: Unable to truncate the light block index to height %d", __func__, nHeight);
+
+    nBlocks = nHeight;
+    nTruncations++;
+    lastEntry.SetNull();
+    if (nBlocks > 0 && !ReadEntry(nBlocks - 1, lastEntry))
+        return error("%s: Unable to read light block index entry %d", __func__, nBlocks - 1);
+
+    return true;
+}
+
+bool CLightBlockStore::Open(bool fWipe)
+{
+    LOCK(cs_lightblocks);
+    try {
+        boost::filesystem::create_directories(path);
+
+        if (boost::filesystem::exists(path / "rebuild")) {
+            LogPrintf("Light client block index was marked for rebuild\n");
+            fWipe = true;
+        }
+
+        if (fWipe) {
+            LogPrintf("Wiping light client block index in %s\n", path.string());
+            boost::filesystem::remove(path / "index.dat");
+            for (unsigned int nFile = 0; boost::filesystem::exists(GetDataFilename(nFile)); nFile++) {
+                boost::filesystem::remove(GetDataFilename(nFile));
+            }
+            boost::filesystem::remove(path / "rebuild");
+        }
+    } catch (const boost::filesystem::filesystem_error& e) {
+        return error("%s: %s", __func__, e.what());
+    }
+
+    boost::filesystem::path pathIndex = path / "index.dat";
+    fileIndex = fopen(pathIndex.string().c_str(), "rb+");
+    if (fileIndex == NULL)
+        fileIndex = fopen(pathIndex.string().c_str(), "wb+");
+    if (fileIndex == NULL)
+        return error("%s: Unable to open file %s", __func__, pathIndex.string());
+
+    fseek(fileIndex, 0, SEEK_END);
+    long nIndexSize = ftell(fileIndex);
+    nBlocks = nIndexSize / LIGHTBLOCK_INDEX_ENTRY_SIZE;
+
+    //Drop trailing entries whose block data did not make it to disk
+    while (nBlocks > 0) {
+        CLightBlockIndexEntry entry;
+        if (ReadEntry(nBlocks - 1, entry)) {
+            boost::system::error_code ec;
+            uintmax_t nFileSize = boost::filesystem::file_size(GetDataFilename(entry.nFile), ec);
+            if (!ec && nFileSize >= (uintmax_t)entry.nPos + entry.nSize)
+                break;
+        }
+        nBlocks--;
+    }
+
+    if (nIndexSize != (long)nBlocks * LIGHTBLOCK_INDEX_ENTRY_SIZE) {
+        LogPrintf("%s: Discarding %d incomplete light block index entries\n", __func__,
+            (int)(nIndexSize / LIGHTBLOCK_INDEX_ENTRY_SIZE) - nBlocks);
+        fflush(fileIndex);
+        TruncateFile(fileIndex, (unsigned int)nBlocks * LIGHTBLOCK_INDEX_ENTRY_SIZE);
+    }
+
+    lastEntry.SetNull();
+    if (nBlocks > 0)
+        ReadEntry(nBlocks - 1, lastEntry);
+
+    LogPrintf("Light client block index: %d blocks\n", nBlocks);
+    return true;
+}
+
+int CLightBlockStore::Height() const
+{
+    LOCK(cs_lightblocks);
+    return nBlocks - 1;
+}
+
+bool CLightBlockStore::GetBlockHash(int nHeight, uint256& hash) const
+{
+    LOCK(cs_lightblocks);
+    CLightBlockIndexEntry entry;
+    if (!ReadEntry(nHeight, entry))
+        return false;
+
+    hash = entry.hash;
+    return true;
+}
+
+bool CLightBlockStore::Truncate(int nHeight)
+{
+    LOCK(cs_lightblocks);
+    return TruncateLocked(nHeight);
+}
+
+void CLightBlockStore::MarkForRebuild()
+{
+    LOCK(cs_lightblocks);
+    if (fRebuild)
+        return;
+
+    fRebuild = true;
+    FILE* file = fopen((path / "rebuild").string().c_str(), "wb");
+    if (file == NULL) {
+        LogPrintf("%s: Unable to mark the light client block index for rebuild, start with -reindex to rebuild it\n", __func__);
+        return;
+    }
+    fclose(file);
+}
+
+bool CLightBlockStore::NeedsRebuild() const
+{
+    LOCK(cs_lightblocks);
+    return fRebuild;
+}
+
+bool CLightBlockStore::WriteBlock(const CCompactSaplingBlock& block)
+{
+    LOCK(cs_lightblocks);
+    if (fileIndex == NULL || fRebuild || block.nHeight < 0)
+        return false;
+
+    //Blocks ahead of the store are picked up by SyncLightBlockStore
+    if (block.nHeight > nBlocks)
+        return true;
+
+    if (block.nHeight < nBlocks && !TruncateLocked(block.nHeight))
+        return false;
+
+    if (nBlocks > 0 && lastEntry.hash != block.hashPrevBlock)
+        return error("%s: Block %s at height %d does not connect to the light block index", __func__, block.hash.ToString(), block.nHeight);
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << block;
+
+    CLightBlockIndexEntry entry;
+    entry.hash = block.hash;
+    entry.nSize = ss.size();
+    if (nBlocks > 0) {
+        entry.nFile = lastEntry.nFile;
+        entry.nPos = lastEntry.nPos + lastEntry.nSize;
+        if (entry.nPos + entry.nSize > MAX_LIGHTBLOCKFILE_SIZE) {
+            entry.nFile++;
+            entry.nPos = 0;
+        }
+    }
+
+    FILE* file = OpenDataFile(entry.nFile, false);
+    if (file == NULL)
+        return false;
+
+    bool fWritten = fseek(file, entry.nPos, SEEK_SET) == 0 && fwrite(&ss[0], 1, ss.size(), file) == ss.size();
+    fclose(file);
+    if (!fWritten)
+        return error("%s: Failed to write block %d to %s", __func__, block.nHeight, GetDataFilename(entry.nFile).string());
+
+    if (!WriteEntry(nBlocks, entry))
+        return error("%s: Failed to write light block index entry %d", __func__, nBlocks);
+
+    nBlocks++;
+    lastEntry = entry;
+    return true;
+}
+
+int CLightBlockStore::ReadBlocks(int nStart, int nCount, std::string& strData) const
+{
+    //Look the blocks up under the lock, the data files are read without it
+    std::vector<CLightBlockIndexEntry> vEntries;
+    uint64_t nTruncationsStart;
+    {
+        LOCK(cs_lightblocks);
+        nTruncationsStart = nTruncations;
+        for (int nHeight = nStart; nHeight < nBlocks && (int)vEntries.size() < nCount; nHeight++) {
+            CLightBlockIndexEntry entry;
+            if (!ReadEntry(nHeight, entry))
+                break;
+            vEntries.push_back(entry);
+        }
+    }
+
+    int nRead = 0;
+    FILE* file = NULL;
+    unsigned int nOpenFile = 0;
+    std::vector<size_t> vOffsets;
+
+    for (const CLightBlockIndexEntry& entry : vEntries) {
+        if (file == NULL || nOpenFile != entry.nFile) {
+            if (file != NULL)
+                fclose(file);
+            file = OpenDataFile(entry.nFile, true);
+            nOpenFile = entry.nFile;
+            if (file == NULL)
+                break;
+        }
+
+        if (fseek(file, entry.nPos, SEEK_SET))
+            break;
+
+        size_t nOffset = strData.size();
+        strData.resize(nOffset + entry.nSize);
+        if (fread(&strData[nOffset], 1, entry.nSize, file) != entry.nSize) {
+            strData.resize(nOffset);
+            break;
+        }
+        vOffsets.push_back(nOffset);
+        nRead++;
+    }
+
+    if (file != NULL)
+        fclose(file);
+
+    //A reorg while reading may have overwritten the data, keep only the blocks still stored
+    LOCK(cs_lightblocks);
+    if (nTruncations != nTruncationsStart) {
+        for (int i = 0; i < nRead; i++) {
+            CLightBlockIndexEntry entry;
+            if (!ReadEntry(nStart + i, entry) || entry.hash != vEntries[i].hash) {
+                strData.resize(vOffsets[i]);
+                nRead = i;
+                break;
+            }
+        }
+    }
+
+    return nRead;
+}
+
+void SyncLightBlockStore()
+{
+    if (plightblocks == NULL)
+        return;
+
+    //Rewind to the last stored block that is still on the active chain
+    {
+        LOCK(cs_main);
+        int nHeight = std::min(plightblocks->Height(), chainActive.Height());
+        uint256 hash;
+        while (nHeight >= 0) {
+            if (plightblocks->GetBlockHash(nHeight, hash) && chainActive[nHeight]->GetBlockHash() == hash)
+                break;
+            nHeight--;
+        }
+        plightblocks->Truncate(nHeight + 1);
+    }
+
+    int nStart = plightblocks->Height() + 1;
+    int64_t nLastLog = GetTime();
+    while (!ShutdownRequested()) {
+        boost::this_thread::interruption_point();
+
+        LOCK(cs_main);
+        int nHeight = plightblocks->Height() + 1;
+        if (nHeight > chainActive.Height())
+            break;
+
+        CBlockIndex* pindex = chainActive[nHeight];
+        CBlock block;
+        if (!ReadBlockFromDisk(block, pindex, 1)) {
+            LogPrintf("%s: Unable to read block %d, light block index stopped\n", __func__, nHeight);
+            return;
+        }
+
+        if (!plightblocks->WriteBlock(CCompactSaplingBlock(block, nHeight))) {
+            LogPrintf("%s: Unable to store block %d, light block index stopped\n", __func__, nHeight);
+            return;
+        }
+
+        if (GetTime() - nLastLog > 60) {
+            LogPrintf("Building light client block index, height %d of %d\n", nHeight, chainActive.Height());
+            nLastLog = GetTime();
+        }
+    }
+
+    if (plightblocks->Height() + 1 > nStart)
+        LogPrintf("Light client block index synced to height %d\n", plightblocks->Height());
+}
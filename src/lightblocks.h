@@ -0,0 +1,229 @@
+// Copyright (c) 2022 The Pirate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef LIGHTBLOCKS_H
+#define LIGHTBLOCKS_H
+
+#include "primitives/block.h"
+#include "serialize.h"
+#include "sync.h"
+#include "uint256.h"
+
+#include <array>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+/** Default for -lightblockindex */
+static const bool DEFAULT_LIGHTBLOCKINDEX = false;
+/** The maximum size of a lbk?????.dat file */
+static const unsigned int MAX_LIGHTBLOCKFILE_SIZE = 0x8000000; // 128 MiB
+/** The maximum number of compact blocks served by a single REST request */
+static const unsigned int MAX_LIGHTBLOCKS_PER_REQUEST = 1000;
+/** Leading bytes of encCiphertext needed to trial decrypt a note (leadbyte, d, value, rseed) */
+static const size_t COMPACT_NOTE_CIPHERTEXT_SIZE = 52;
+
+/**
+ * Nullifier revealed by a Sapling spend.
+ */
+class CCompactSaplingSpend
+{
+public:
+    uint256 nullifier;
+
+    CCompactSaplingSpend() {}
+    CCompactSaplingSpend(const uint256& nullifierIn) : nullifier(nullifierIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(nullifier);
+    }
+};
+
+/**
+ * The parts of a Sapling output a light client needs to detect an incoming
+ * note and to update its commitment tree.
+ */
+class CCompactSaplingOutput
+{
+public:
+    uint256 cmu;
+    uint256 ephemeralKey;
+    std::array<unsigned char, COMPACT_NOTE_CIPHERTEXT_SIZE> encCiphertext;
+
+    CCompactSaplingOutput() { encCiphertext.fill(0); }
+    CCompactSaplingOutput(const OutputDescription& output);
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(cmu);
+        READWRITE(ephemeralKey);
+        READWRITE(encCiphertext);
+    }
+};
+
+/**
+ * Shielded spends and outputs of a single transaction, nIndex is the
+ * position of the transaction in the block.
+ */
+class CCompactSaplingTx
+{
+public:
+    uint32_t nIndex;
+    uint256 txid;
+    std::vector<CCompactSaplingSpend> vSpends;
+    std::vector<CCompactSaplingOutput> vOutputs;
+
+    CCompactSaplingTx() : nIndex(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(nIndex);
+        READWRITE(txid);
+        READWRITE(vSpends);
+        READWRITE(vOutputs);
+    }
+};
+
+/**
+ * Compact representation of a block for light client scanning. Only
+ * transactions with shielded spends or outputs are included.
+ */
+class CCompactSaplingBlock
+{
+public:
+    int32_t nHeight;
+    uint256 hash;
+    uint256 hashPrevBlock;
+    uint256 hashFinalSaplingRoot;
+    uint32_t nTime;
+    std::vector<CCompactSaplingTx> vtx;
+
+    CCompactSaplingBlock() : nHeight(0), nTime(0) {}
+    CCompactSaplingBlock(const CBlock& block, int nHeightIn);
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(nHeight);
+        READWRITE(hash);
+        READWRITE(hashPrevBlock);
+        READWRITE(hashFinalSaplingRoot);
+        READWRITE(nTime);
+        READWRITE(vtx);
+    }
+};
+
+/**
+ * Location of a serialized compact block, one fixed size record per height
+ * in the store index file.
+ */
+class CLightBlockIndexEntry
+{
+public:
+    uint256 hash;
+    uint32_t nFile;
+    uint32_t nPos;
+    uint32_t nSize;
+
+    CLightBlockIndexEntry() { SetNull(); }
+
+    void SetNull() {
+        hash.SetNull();
+        nFile = 0;
+        nPos = 0;
+        nSize = 0;
+    }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(hash);
+        READWRITE(nFile);
+        READWRITE(nPos);
+        READWRITE(nSize);
+    }
+};
+
+/**
+ * Flat file store of compact blocks for the active chain, written as blocks
+ * are connected and truncated as they are disconnected. It is guarded by its
+ * own lock so readers never need cs_main.
+ *
+ * Lock order: cs_main before cs_lightblocks.
+ */
+class CLightBlockStore
+{
+private:
+    mutable CCriticalSection cs_lightblocks;
+    boost::filesystem::path path;
+    FILE *fileIndex;
+    int nBlocks;
+    CLightBlockIndexEntry lastEntry;
+    //Bumped whenever stored blocks are dropped, their data may then be overwritten
+    uint64_t nTruncations;
+    bool fRebuild;
+
+    boost::filesystem::path GetDataFilename(unsigned int nFile) const;
+    FILE* OpenDataFile(unsigned int nFile, bool fReadOnly) const;
+    bool ReadEntry(int nHeight, CLightBlockIndexEntry& entry) const;
+    bool WriteEntry(int nHeight, const CLightBlockIndexEntry& entry);
+    bool TruncateLocked(int nHeight);
+
+public:
+    CLightBlockStore(const boost::filesystem::path& pathIn);
+    ~CLightBlockStore();
+
+    /** Open (or create) the store, fWipe discards any existing data */
+    bool Open(bool fWipe);
+
+    /** Height of the last stored block, -1 if the store is empty */
+    int Height() const;
+
+    bool GetBlockHash(int nHeight, uint256& hash) const;
+
+    /**
+     * Append a block at block.nHeight, replacing any stored blocks at or
+     * above that height. Fails if the block does not connect to the store.
+     * Blocks past the end of the store are skipped, they are converted by
+     * SyncLightBlockStore.
+     */
+    bool WriteBlock(const CCompactSaplingBlock& block);
+
+    /** Drop all blocks at or above nHeight */
+    bool Truncate(int nHeight);
+
+    /**
+     * Stop writing to the store after a failed update. The store is wiped
+     * and rebuilt from the block files on the next start.
+     */
+    void MarkForRebuild();
+    bool NeedsRebuild() const;
+
+    /**
+     * Append the serialized compact blocks in [nStart, nStart + nCount) to
+     * strData, stopping at the end of the store.
+     * @returns the number of blocks read
+     */
+    int ReadBlocks(int nStart, int nCount, std::string& strData) const;
+};
+
+extern CLightBlockStore *plightblocks;
+
+/**
+ * Bring the store in line with chainActive, rewinding past any reorg and
+ * converting blocks from disk up to the tip. Run from the import thread.
+ */
+void SyncLightBlockStore();
+
+#endif // LIGHTBLOCKS_H
@@ -26,6 +26,7 @@
 #include "addrman.h"
 #include "alert.h"
 #include "arith_uint256.h"
+#include "blockencodings.h"
 #include "importcoin.h"
 #include "chainparams.h"
 #include "checkpoints.h"
@@ -34,6 +35,7 @@
 #include "consensus/validation.h"
 #include "deprecation.h"
 #include "init.h"
+#include "lightblocks.h"
 #include "merkleblock.h"
 #include "metrics.h"
 #include "notarisationdb.h"
@@ -66,6 +68,9 @@
 #include <cstring>
 #include <algorithm>
 #include <atomic>
+#include <deque>
+#include <list>
+#include <memory>
 #include <sstream>
 #include <map>
 #include <unordered_map>
@@ -115,10 +120,12 @@ bool fHavePruned = false;
 bool fPruneMode = false;
 bool fIsBareMultisigStd = true;
 bool fCheckBlockIndex = false;
+bool fBlockIndexSnapshot = DEFAULT_BLOCKINDEX_SNAPSHOT;
 bool fCheckpointsEnabled = true;
 bool fUnlockedForReporting = false;
 bool fCoinbaseEnforcedProtectionEnabled = true;
 size_t nCoinCacheUsage = 5000 * 300;
+size_t nBlockServeCacheSize = DEFAULT_MAX_BLOCK_SERVE_CACHE_SIZE << 20;
 uint64_t nPruneTarget = 0;
 bool fAlerts = DEFAULT_ALERTS;
 int maxProcessingThreads = 1;
@@ -275,6 +282,7 @@ namespace {
         int64_t nTime;  //! Time of "getdata" request in microseconds.
         bool fValidatedHeaders;  //! Whether this block has validated headers at the time of request.
         int64_t nTimeDisconnect; //! The timeout for this block request (for disconnecting a slow peer)
+        std::unique_ptr<PartiallyDownloadedBlock> partialBlock;  //! Optional, set while a compact block is reconstructed.
     };
     map<uint256, pair<NodeId, list<QueuedBlock>::iterator> > mapBlocksInFlight;
 
@@ -338,6 +346,8 @@ namespace {
         int nBlocksInFlightValidHeaders;
         //! Whether we consider this a preferred download peer.
         bool fPreferredDownload;
+        //! Whether this peer sent us sendcmpct version 1, so new blocks can be fetched from it as compact blocks.
+        bool fSupportsCompactBlocks;
 
         CNodeState() {
             fCurrentlyConnected = false;
@@ -351,6 +361,7 @@ namespace {
             nBlocksInFlight = 0;
             nBlocksInFlightValidHeaders = 0;
             fPreferredDownload = false;
+            fSupportsCompactBlocks = false;
         }
     };
 
@@ -459,9 +470,9 @@ namespace {
         int64_t nNow = GetTimeMicros();
         QueuedBlock newentry = {hash, pindex, nNow, pindex != NULL, GetBlockTimeout(nNow, nQueuedValidatedHeaders, consensusParams)};
         nQueuedValidatedHeaders += newentry.fValidatedHeaders;
-        list<QueuedBlock>::iterator it = state->vBlocksInFlight.insert(state->vBlocksInFlight.end(), newentry);
+        list<QueuedBlock>::iterator it = state->vBlocksInFlight.insert(state->vBlocksInFlight.end(), std::move(newentry));
         state->nBlocksInFlight++;
-        state->nBlocksInFlightValidHeaders += newentry.fValidatedHeaders;
+        state->nBlocksInFlightValidHeaders += it->fValidatedHeaders;
         mapBlocksInFlight[hash] = std::make_pair(nodeid, it);
     }
 
@@ -1454,6 +1465,74 @@ CheckTransationResults ContextualCheckTransactionSaplingOutputWorker(
 
 }
 
+CheckTransationResults ContextualCheckTransactionSaplingBundleWorker(
+    const std::vector<const CTransaction*> vtx,
+    const std::vector<uint256> vTxSig,
+    const bool fCacheResults,
+    const uint32_t threadNumber) {
+
+    //Results to be returned
+    CheckTransationResults txResults;
+
+    //Queue every bundle of this thread batch into a single batch validator.
+    //When caching, validated bundles are added to the bundle validity cache,
+    //otherwise bundles found in the cache are skipped and evicted.
+    bool batchPassed = true;
+    auto batch = sapling::init_batch_validator(fCacheResults);
+    for (int i = 0; i < vtx.size(); i++) {
+        try {
+            CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+            ss << *vtx[i];
+            CRustTransaction rTx;
+            ss >> rTx;
+            if (!rTx.GetSaplingBundle().QueueAuthValidation(*batch, vTxSig[i])) {
+                batchPassed = false;
+                break;
+            }
+        } catch (const std::exception& e) {
+            batchPassed = false;
+            break;
+        }
+    }
+
+    if (batchPassed && batch->validate()) {
+        return txResults;
+    }
+
+    //The batch failed, fall back to the individual checks to find the invalid description
+    std::vector<const SpendDescription*> vSpend;
+    std::vector<uint256> vSpendSig;
+    std::vector<const OutputDescription*> vOutput;
+    for (int i = 0; i < vtx.size(); i++) {
+        for (const SpendDescription &spend : vtx[i]->vShieldedSpend) {
+            vSpend.emplace_back(&spend);
+            vSpendSig.emplace_back(vTxSig[i]);
+        }
+        for (const OutputDescription &output : vtx[i]->vShieldedOutput) {
+            vOutput.emplace_back(&output);
+        }
+    }
+
+    txResults = ContextualCheckTransactionBindingSigWorker(vtx, vTxSig, threadNumber);
+    if (!txResults.validationPassed) {
+        return txResults;
+    }
+
+    txResults = ContextualCheckTransactionSaplingSpendWorker(vSpend, vSpendSig, threadNumber);
+    if (!txResults.validationPassed) {
+        return txResults;
+    }
+
+    txResults = ContextualCheckTransactionSaplingOutputWorker(vOutput, threadNumber);
+    if (txResults.validationPassed) {
+        //The individual checks are authoritative
+        LogPrintf("%s: Sapling batch validation failed but individual checks passed, thread %i\n", __func__, threadNumber);
+    }
+
+    return txResults;
+
+}
+
 /**
  * Check a transaction contextually against a set of consensus rules valid at a given block height.
  *
@@ -1467,6 +1546,7 @@ bool ContextualCheckTransactionMultithreaded(int32_t slowflag, const std::vector
         CValidationState &state,
         const int nHeight,
         const int dosLevel,
+        bool fCacheResults,
         bool (*isInitBlockDownload)(),int32_t validateprices) {
 
       //Create a Vector of futures to be collected later
@@ -1474,35 +1554,21 @@ bool ContextualCheckTransactionMultithreaded(int32_t slowflag, const std::vector
 
       bool isInitialBlockDownload = isInitBlockDownload();
 
-      //Setup tx batches
+      //Setup tx batches, one batch validator per thread
       std::vector<const CTransaction*> vtx;
       std::vector<std::vector<const CTransaction*>> vvtx;
       std::vector<uint256> vTxSig;
       std::vector<std::vector<uint256>> vvTxSig;
-
-      //Setup spend batches
-      std::vector<const SpendDescription*> vSpend;
-      std::vector<std::vector<const SpendDescription*>> vvSpend;
-      std::vector<uint256> vSpendSig;
-      std::vector<std::vector<uint256>> vvSpendSig;
-
-      //Setup output batches
-      std::vector<const OutputDescription*> vOutput;
-      std::vector<std::vector<const OutputDescription*>> vvOutput;
+      std::vector<size_t> vDescriptions;
 
       //Create Thread Vectors
       for (int i = 0; i < maxProcessingThreads; i++) {
           vvtx.emplace_back(vtx);
           vvTxSig.emplace_back(vTxSig);
-          vvSpend.emplace_back(vSpend);
-          vvSpendSig.emplace_back(vSpendSig);
-          vvOutput.emplace_back(vOutput);
+          vDescriptions.emplace_back(0);
       }
 
       //Check coinbase transaction and push all transactions to thread batch vectors
-      int t = 0;
-      int s = 0;
-      int o = 0;
       for (uint32_t i = 0; i < vptx.size(); i++) {
           const CTransaction* tx = vptx[i];
 
@@ -1550,65 +1616,20 @@ bool ContextualCheckTransactionMultithreaded(int32_t slowflag, const std::vector
           if (!fCheckpointsEnabled || nHeight >= Checkpoints::GetTotalBlocksEstimate(Params().Checkpoints())) {
               //Verify Sapling
               if (!tx->vShieldedSpend.empty() || !tx->vShieldedOutput.empty()) {
-                  //Push tx to thread vector
+                  //Push tx to the thread vector with the fewest descriptions queued
+                  int t = std::min_element(vDescriptions.begin(), vDescriptions.end()) - vDescriptions.begin();
                   vvtx[t].emplace_back(tx);
                   vvTxSig[t].emplace_back(dataToBeSigned);
-                  //Increment thread vector
-                  t++;
-                  //reset if tread vector is greater qty of threads being used
-                  if (t >= vvtx.size()) {
-                      t = 0;
-                  }
-
-                  //Add this transaction sapling spend to spend thread batches
-                  for (int j = 0; j < tx->vShieldedSpend.size(); j++) {
-                      //Push spend to thread vector
-                      vvSpend[s].emplace_back(&(tx->vShieldedSpend[j]));
-                      vvSpendSig[s].emplace_back(dataToBeSigned);
-                      //Increment thread vector
-                      s++;
-                      //reset if tread vector is greater qty of threads being used
-                      if (s >= vvSpend.size()) {
-                          s = 0;
-                      }
-                  }
-
-                  //Add this transaction sapling outputs to output thread batches
-                  for (int j = 0; j < tx->vShieldedOutput.size(); j++) {
-                      //Push output to thread vector
-                      vvOutput[o].emplace_back(&(tx->vShieldedOutput[j]));
-                      //Increment thread vector
-                      o++;
-                      //reset if tread vector is greater qty of threads being used
-                      if (o >= vvOutput.size()) {
-                          o = 0;
-                      }
-                  }
+                  vDescriptions[t] += tx->vShieldedSpend.size() + tx->vShieldedOutput.size();
               }
           }
       }
 
       //Push batches of txs to async threads
       for (int i = 0; i < vvtx.size(); i++) {
-          //Perform transaction level checks
+          //Perform Sapling bundle batch validation
           if (!vvtx[i].empty()) {
-              vFutures.emplace_back(std::async(std::launch::async, ContextualCheckTransactionBindingSigWorker, vvtx[i], vvTxSig[i], i));
-          }
-      }
-
-      //Push batches of spends to async threads
-      for (int i = 0; i < vvSpend.size(); i++) {
-          //Perform SpendDescription validations
-          if (!vvSpend[i].empty()) {
-              vFutures.emplace_back(std::async(std::launch::async, ContextualCheckTransactionSaplingSpendWorker, vvSpend[i], vvSpendSig[i], i + vvtx.size()));
-          }
-      }
-
-      //Push batches of outputs to async threads
-      for (int i = 0; i < vvOutput.size(); i++) {
-          //Perform OutputDescription validations
-          if (!vvOutput[i].empty()) {
-              vFutures.emplace_back(std::async(std::launch::async, ContextualCheckTransactionSaplingOutputWorker, vvOutput[i], i + vvtx.size() + vvSpend.size()));
+              vFutures.emplace_back(std::async(std::launch::async, ContextualCheckTransactionSaplingBundleWorker, vvtx[i], vvTxSig[i], fCacheResults, i));
           }
       }
 
@@ -2256,6 +2277,36 @@ CAmount GetMinRelayFee(const CTransaction& tx, unsigned int nBytes, bool fAllowF
     return nMinFee;
 }
 
+/*****
+ * @brief Run the stateless Sapling proof and signature checks of a loose transaction without cs_main
+ * @note Valid bundles are added to the bundle validity cache, so the ContextualCheckTransactionMultithreaded
+ * call in AcceptToMemoryPool finds them there and the lock is only held for the stateful checks.
+ * If the tip moves in the meantime and changes the consensus branch, the cache simply misses.
+ * @param tx
+ * @param state
+ * @param dosLevel
+ * @returns true if the transaction has no Sapling descriptions or they are all valid
+ */
+bool PreCheckShieldedTransaction(const CTransaction &tx, CValidationState &state, int dosLevel)
+{
+    if (tx.IsCoinBase() || (tx.vShieldedSpend.empty() && tx.vShieldedOutput.empty()))
+        return true;
+
+    int nextBlockHeight;
+    {
+        LOCK(cs_main);
+        nextBlockHeight = chainActive.Height() + 1;
+    }
+
+    std::vector<const CTransaction*> vptx;
+    vptx.emplace_back(&tx);
+    if (!ContextualCheckTransactionMultithreaded(0, vptx, 0, state, nextBlockHeight, dosLevel, true))
+    {
+        return error("PreCheckShieldedTransaction: ContextualCheckTransaction failed");
+    }
+    return true;
+}
+
 /*****
  * @brief Try to add transaction to memory pool
  * @param pool
@@ -2333,7 +2384,7 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
     // Check transaction contextually against the set of consensus rules which apply in the next block to be mined.
     std::vector<const CTransaction*> vptx;
     vptx.emplace_back(&tx);
-    if (!ContextualCheckTransactionMultithreaded(0, vptx, 0, state, nextBlockHeight, (dosLevel == -1) ? 10 : dosLevel))
+    if (!ContextualCheckTransactionMultithreaded(0, vptx, 0, state, nextBlockHeight, (dosLevel == -1) ? 10 : dosLevel, true))
     {
         return error("AcceptToMemoryPool: ContextualCheckTransaction failed");
     }
@@ -3121,6 +3172,7 @@ void Misbehaving(NodeId pnode, int howmuch)
     if (howmuch == 0)
         return;
 
+    LOCK(cs_main);
     CNodeState *state = State(pnode);
     if (state == NULL)
         return;
@@ -3706,6 +3758,8 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
         }
     }
 
+    komodo_coinsupply_disconnect(pindex);
+
     return fClean;
 }
 
@@ -4116,7 +4170,8 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             sum += interest;
 
             std::vector<CScriptCheck> vChecks;
-            if (!ContextualCheckInputs(tx, state, view, fExpensiveChecks, flags, false, txdata[i], chainparams.GetConsensus(), consensusBranchId, nScriptCheckThreads ? &vChecks : NULL))
+            //Only cache signatures when just checking a block, connecting it consumes the cached entries
+            if (!ContextualCheckInputs(tx, state, view, fExpensiveChecks, flags, fJustCheck, txdata[i], chainparams.GetConsensus(), consensusBranchId, nScriptCheckThreads ? &vChecks : NULL))
                 return false;
             control.Add(vChecks);
         }
@@ -4357,6 +4412,9 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             return AbortNode(state, "Failed to write blockhash index");
     }
 
+    // running coin supply totals for coinsupply, TestBlockValidity (fJustCheck) has returned above
+    komodo_coinsupply_connect(pindex, block, blockundo);
+
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
 
@@ -4647,6 +4705,12 @@ bool static DisconnectTip(CValidationState &state, bool fBare = false) {
     // Update chainActive and related variables.
     UpdateTip(pindexDelete->pprev);
 
+    //Drop the compact block served to light clients
+    if (plightblocks != NULL && !plightblocks->NeedsRebuild() && !plightblocks->Truncate(pindexDelete->nHeight)) {
+        LogPrintf("%s: Unable to drop light client block %d, the light client block index will be rebuilt on restart\n", __func__, pindexDelete->nHeight);
+        plightblocks->MarkForRebuild();
+    }
+
     // Get the current commitment tree
     SproutMerkleTree newSproutTree;
     SaplingMerkleTree newSaplingTree;
@@ -4885,6 +4949,12 @@ bool ConnectTip(CValidationState &state, CBlockIndex *pindexNew, CBlock *pblock)
 
     // Update chainActive & related variables.
     UpdateTip(pindexNew);
+
+    //Convert the block once for light clients, served from the flat file store without cs_main
+    if (plightblocks != NULL && !plightblocks->NeedsRebuild() && !plightblocks->WriteBlock(CCompactSaplingBlock(*pblock, pindexNew->nHeight))) {
+        LogPrintf("%s: Unable to store light client block %d, the light client block index will be rebuilt on restart\n", __func__, pindexNew->nHeight);
+        plightblocks->MarkForRebuild();
+    }
     if ( KOMODO_NSPV_FULLNODE )
     {
         // Tell wallet about transactions that went from mempool
@@ -6063,7 +6133,7 @@ bool ContextualCheckBlockHeader(const CBlockHeader& block, CValidationState& sta
     return true;
 }
 
-bool ContextualCheckBlock(int32_t slowflag,const CBlock& block, CValidationState& state, CBlockIndex * const pindexPrev)
+bool ContextualCheckBlock(int32_t slowflag,const CBlock& block, CValidationState& state, CBlockIndex * const pindexPrev, bool fCacheResults)
 {
     const int nHeight = pindexPrev == NULL ? 0 : pindexPrev->nHeight + 1;
     const Consensus::Params& consensusParams = Params().GetConsensus();
@@ -6108,8 +6178,10 @@ bool ContextualCheckBlock(int32_t slowflag,const CBlock& block, CValidationState
         }
     }
 
-    // Check transaction contextually against consensus rules at block height
-    if (!ContextualCheckTransactionMultithreaded(slowflag,vptx,pindexPrev, state, nHeight, 100)) {
+    // Check transaction contextually against consensus rules at block height.
+    // Sapling bundles already validated on mempool admission are found in the
+    // bundle validity cache and skip proof verification.
+    if (!ContextualCheckTransactionMultithreaded(slowflag,vptx,pindexPrev, state, nHeight, 100, fCacheResults)) {
         return false; // Failure reason has been set in validation state object
     }
 
@@ -6166,7 +6238,7 @@ bool AcceptBlockHeader(int32_t *futureblockp,const CBlockHeader& block, CValidat
         //    fprintf(stderr,"accepthdr %s already known but no pindex\n",hash.ToString().c_str());
         return true;
     }
-    if (!CheckBlockHeader(futureblockp,*ppindex!=0?(*ppindex)->nHeight:0,*ppindex, block, state,0))
+    if (!CheckBlockHeader(futureblockp,*ppindex!=0?(*ppindex)->nHeight:0,*ppindex, block, state,1))
     {
         if ( *futureblockp == 0 )
         {
@@ -6520,7 +6592,8 @@ bool TestBlockValidity(CValidationState &state, const CBlock& block, CBlockIndex
     {
         return false;
     }
-    if (!ContextualCheckBlock(0,block, state, pindexPrev))
+    // Keep the bundle validity cache entries for when the block is connected
+    if (!ContextualCheckBlock(0,block, state, pindexPrev, true))
     {
         return false;
     }
@@ -6770,13 +6843,259 @@ CBlockIndex * InsertBlockIndex(uint256 hash)
     return pindexNew;
 }
 
-/****
- * Load the block index database
+static const char* BLOCKINDEX_SNAPSHOT_FILENAME = "blockindex.dat";
+static const int BLOCKINDEX_SNAPSHOT_VERSION = 1;
+//Set once mapBlockIndex holds the full block tree, a snapshot is only written then
+static bool fBlockIndexLoaded = false;
+
+/**
+ * Block index entry in the snapshot file. Entries are written in height order,
+ * so the parent and skip pointers refer to earlier entries by position.
+ */
+class CBlockIndexSnapshotEntry
+{
+public:
+    CBlockIndex* pindex;
+    uint256 hash;
+    int32_t nPrev;
+    int32_t nSkip;
+
+    CBlockIndexSnapshotEntry(CBlockIndex* pindexIn) : pindex(pindexIn), nPrev(-1), nSkip(-1) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(hash);
+        READWRITE(nPrev);
+        READWRITE(nSkip);
+        READWRITE(pindex->nHeight);
+        READWRITE(pindex->nFile);
+        READWRITE(pindex->nDataPos);
+        READWRITE(pindex->nUndoPos);
+        uint256 chainWork = ArithToUint256(pindex->nChainWork);
+        READWRITE(chainWork);
+        if (ser_action.ForRead())
+            pindex->nChainWork = UintToArith256(chainWork);
+        READWRITE(pindex->nTx);
+        READWRITE(pindex->nChainTx);
+        READWRITE(pindex->nStatus);
+        READWRITE(pindex->nCachedBranchId);
+        READWRITE(pindex->hashSproutAnchor);
+        READWRITE(pindex->nChainSupplyDelta);
+        READWRITE(pindex->nChainTotalSupply);
+        READWRITE(pindex->nTransparentValue);
+        READWRITE(pindex->nChainTransparentValue);
+        READWRITE(pindex->nBurnedAmountDelta);
+        READWRITE(pindex->nChainTotalBurned);
+        READWRITE(pindex->nSproutValue);
+        READWRITE(pindex->nChainSproutValue);
+        READWRITE(pindex->nSaplingValue);
+        READWRITE(pindex->nChainSaplingValue);
+        READWRITE(pindex->nVersion);
+        READWRITE(pindex->hashMerkleRoot);
+        READWRITE(pindex->hashFinalSaplingRoot);
+        READWRITE(pindex->nTime);
+        READWRITE(pindex->nBits);
+        READWRITE(pindex->nNonce);
+        READWRITE(pindex->segid);
+        READWRITE(pindex->nNotaryPay);
+    }
+};
+
+bool WriteBlockIndexSnapshot()
+{
+    AssertLockHeld(cs_main);
+    if (!fBlockIndexSnapshot || !fBlockIndexLoaded || fReindex || fImporting || pcoinsTip == NULL)
+        return false;
+
+    uint256 hashBestBlock = pcoinsTip->GetBestBlock();
+    if (mapBlockIndex.count(hashBestBlock) == 0)
+        return false;
+
+    int64_t nStart = GetTimeMillis();
+
+    vector<pair<int, CBlockIndex*> > vSortedByHeight;
+    vSortedByHeight.reserve(mapBlockIndex.size());
+    for (const auto& item : mapBlockIndex)
+    {
+        if (item.second != NULL)
+            vSortedByHeight.push_back(make_pair(item.second->nHeight, item.second));
+    }
+    sort(vSortedByHeight.begin(), vSortedByHeight.end());
+
+    std::unordered_map<const CBlockIndex*, int32_t> mapPosition;
+    mapPosition.reserve(vSortedByHeight.size());
+
+    boost::filesystem::path pathSnapshot = GetDataDir() / BLOCKINDEX_SNAPSHOT_FILENAME;
+    boost::filesystem::path pathTmp = GetDataDir() / (std::string(BLOCKINDEX_SNAPSHOT_FILENAME) + ".new");
+    CAutoFile fileout(fopen(pathTmp.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+    if (fileout.IsNull())
+        return error("%s: Failed to open file %s", __func__, pathTmp.string());
+
+    // serialize the entries, checksum data up to that point, then append csum
+    try {
+        CHashWriter hasher(SER_DISK, CLIENT_VERSION);
+        uint32_t nEntries = vSortedByHeight.size();
+        fileout << FLATDATA(Params().MessageStart()) << BLOCKINDEX_SNAPSHOT_VERSION << hashBestBlock << nLastBlockFile << nEntries;
+        hasher << FLATDATA(Params().MessageStart()) << BLOCKINDEX_SNAPSHOT_VERSION << hashBestBlock << nLastBlockFile << nEntries;
+
+        for (const auto& item : vSortedByHeight)
+        {
+            CBlockIndex* pindex = item.second;
+            CBlockIndexSnapshotEntry entry(pindex);
+            entry.hash = pindex->GetBlockHash();
+            if (pindex->pprev) {
+                auto it = mapPosition.find(pindex->pprev);
+                if (it == mapPosition.end())
+                    throw std::runtime_error("parent not written before " + entry.hash.ToString());
+                entry.nPrev = it->second;
+            }
+            if (pindex->pskip) {
+                auto it = mapPosition.find(pindex->pskip);
+                if (it == mapPosition.end())
+                    throw std::runtime_error("skip entry not written before " + entry.hash.ToString());
+                entry.nSkip = it->second;
+            }
+            mapPosition.insert(make_pair(pindex, (int32_t)mapPosition.size()));
+
+            fileout << entry;
+            hasher << entry;
+        }
+
+        fileout << hasher.GetHash();
+    }
+    catch (const std::exception& e) {
+        fileout.fclose();
+        boost::filesystem::remove(pathTmp);
+        return error("%s: Serialize or I/O error - %s", __func__, e.what());
+    }
+    FileCommit(fileout.Get());
+    fileout.fclose();
+
+    // replace existing snapshot, if any
+    if (!RenameOver(pathTmp, pathSnapshot))
+        return error("%s: Rename-into-place failed", __func__);
+
+    LogPrintf("%s: wrote %u block index entries in %dms\n", __func__, mapPosition.size(), GetTimeMillis() - nStart);
+    return true;
+}
+
+/**
+ * Load mapBlockIndex from the snapshot written on the last clean shutdown. The
+ * snapshot is removed once read, so it is never used after the block tree
+ * database has moved past it.
+ * @returns true if mapBlockIndex was loaded from the snapshot
+ */
+static bool LoadBlockIndexSnapshot()
+{
+    boost::filesystem::path pathSnapshot = GetDataDir() / BLOCKINDEX_SNAPSHOT_FILENAME;
+    if (!boost::filesystem::exists(pathSnapshot))
+        return false;
+
+    int64_t nStart = GetTimeMillis();
+    std::vector<CBlockIndex*> vIndex;
+    bool fLoaded = false;
+
+    if (fBlockIndexSnapshot && mapBlockIndex.empty())
+    {
+        CAutoFile filein(fopen(pathSnapshot.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull()) {
+            LogPrintf("%s: Failed to open file %s\n", __func__, pathSnapshot.string());
+        } else {
+            try {
+                CHashVerifier<CAutoFile> verifier(&filein);
+                unsigned char pchMsgTmp[4];
+                int nVersion = 0;
+                uint256 hashBestBlock;
+                int nLastFile = 0;
+                uint32_t nEntries = 0;
+                verifier >> FLATDATA(pchMsgTmp) >> nVersion >> hashBestBlock >> nLastFile >> nEntries;
+
+                // the snapshot must describe the block tree database as it is now
+                int nLastFileDB = 0;
+                bool fReindexing = false;
+                pblocktree->ReadLastBlockFile(nLastFileDB);
+                pblocktree->ReadReindexing(fReindexing);
+                if (memcmp(pchMsgTmp, Params().MessageStart(), sizeof(pchMsgTmp)) || nVersion != BLOCKINDEX_SNAPSHOT_VERSION) {
+                    LogPrintf("%s: snapshot is from another network or version, ignoring it\n", __func__);
+                } else if (hashBestBlock != pcoinsTip->GetBestBlock() || nLastFile != nLastFileDB || fReindexing) {
+                    LogPrintf("%s: snapshot does not match the block tree database, ignoring it\n", __func__);
+                } else {
+                    uiInterface.ShowProgress(_("Loading block index snapshot..."), 0, false);
+                    vIndex.reserve(nEntries);
+                    mapBlockIndex.reserve(nEntries);
+                    for (uint32_t i = 0; i < nEntries; i++)
+                    {
+                        CBlockIndex* pindexNew = new CBlockIndex();
+                        vIndex.push_back(pindexNew);
+
+                        CBlockIndexSnapshotEntry entry(pindexNew);
+                        verifier >> entry;
+                        if (entry.nPrev >= (int32_t)i || entry.nSkip >= (int32_t)i)
+                            throw std::runtime_error("entry out of order");
+                        pindexNew->pprev = entry.nPrev < 0 ? NULL : vIndex[entry.nPrev];
+                        pindexNew->pskip = entry.nSkip < 0 ? NULL : vIndex[entry.nSkip];
+
+                        std::pair<BlockMap::iterator, bool> ret = mapBlockIndex.insert(make_pair(entry.hash, pindexNew));
+                        if (!ret.second)
+                            throw std::runtime_error("duplicate entry " + entry.hash.ToString());
+                        pindexNew->phashBlock = &((*ret.first).first);
+
+                        if (i % 100000 == 0)
+                            uiInterface.ShowProgress(_("Loading block index snapshot..."), (int)((double)(i*100)/(double)nEntries), false);
+                    }
+
+                    uint256 hashTmp = verifier.GetHash();
+                    uint256 hashIn;
+                    filein >> hashIn;
+                    if (hashIn != hashTmp)
+                        LogPrintf("%s: snapshot checksum mismatch, ignoring it\n", __func__);
+                    else
+                        fLoaded = true;
+                    uiInterface.ShowProgress("", 100, false);
+                }
+            }
+            catch (const std::exception& e) {
+                LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+            }
+        }
+    }
+
+    boost::system::error_code ec;
+    boost::filesystem::remove(pathSnapshot, ec);
+
+    if (!fLoaded) {
+        for (CBlockIndex* pindex : vIndex)
+            delete pindex;
+        mapBlockIndex.clear();
+        return false;
+    }
+
+    // Rebuild the in-memory sets, parents come before their children
+    for (CBlockIndex* pindex : vIndex)
+    {
+        if (pindex->nTx > 0 && pindex->pprev && !pindex->pprev->nChainTx)
+            mapBlocksUnlinked.insert(std::make_pair(pindex->pprev, pindex));
+        if (pindex->IsValid(BLOCK_VALID_TRANSACTIONS) && (pindex->nChainTx || pindex->pprev == NULL))
+            setBlockIndexCandidates.insert(pindex);
+        if (pindex->nStatus & BLOCK_FAILED_MASK && (!pindexBestInvalid || pindex->nChainWork > pindexBestInvalid->nChainWork))
+            pindexBestInvalid = pindex;
+        if (pindex->IsValid(BLOCK_VALID_TREE) && (pindexBestHeader == NULL || CBlockIndexWorkComparator()(pindexBestHeader, pindex)))
+            pindexBestHeader = pindex;
+    }
+
+    LogPrintf("%s: loaded %u block index entries in %dms\n", __func__, vIndex.size(), GetTimeMillis() - nStart);
+    return true;
+}
+
+/**
+ * Load mapBlockIndex from the block tree database and compute the chain values
+ * that are not stored on disk
  * @returns true on success
  */
-bool static LoadBlockIndexDB()
+static bool LoadBlockIndexFromDB()
 {
-    const CChainParams& chainparams = Params();
     LogPrintf("%s: start loading guts\n", __func__);
     {
         LOCK(cs_main);
@@ -6884,6 +7203,18 @@ bool static LoadBlockIndexDB()
     }
 
     uiInterface.ShowProgress("", 100, false);
+    return true;
+}
+
+/****
+ * Load the block index database
+ * @returns true on success
+ */
+bool static LoadBlockIndexDB()
+{
+    const CChainParams& chainparams = Params();
+    if (!LoadBlockIndexSnapshot() && !LoadBlockIndexFromDB())
+        return false;
 
     // Load block file info
     pblocktree->ReadLastBlockFile(nLastBlockFile);
@@ -6973,6 +7304,8 @@ bool static LoadBlockIndexDB()
         }
     }
 
+    fBlockIndexLoaded = true;
+
     // Load pointer to end of best chain
     BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
     if (it == mapBlockIndex.end())
@@ -7302,6 +7635,7 @@ void UnloadBlockIndex()
     }
     mapBlockIndex.clear();
     fHavePruned = false;
+    fBlockIndexLoaded = false;
 }
 
 /******
@@ -7799,14 +8133,62 @@ bool static AlreadyHave(const CInv& inv) REQUIRES(cs_main)
     return true;
 }
 
+/**
+ * Recently served blocks in network serialization, so that the peers that all
+ * ask for a newly announced block within seconds of each other are answered
+ * with a copy of the same bytes instead of a disk read and re-serialization
+ * each. Only blocks read back from disk are inserted, never blocks as received
+ * from a peer, and entries are evicted least recently served first once
+ * nBlockServeCacheSize bytes are used.
+ */
+class CBlockServeCache
+{
+public:
+    typedef std::shared_ptr<const CDataStream> BlockData;
+
+private:
+    typedef std::list<std::pair<uint256, BlockData> > LruList;
+
+    CCriticalSection cs;
+    LruList lru;
+    std::unordered_map<uint256, LruList::iterator, BlockHasher> mapEntries;
+    size_t nBytes = 0;
+
+public:
+    BlockData Get(const uint256& hash)
+    {
+        LOCK(cs);
+        auto it = mapEntries.find(hash);
+        if (it == mapEntries.end())
+            return nullptr;
+        lru.splice(lru.begin(), lru, it->second);
+        return it->second->second;
+    }
+
+    void Insert(const uint256& hash, const BlockData& data)
+    {
+        LOCK(cs);
+        if (data->size() > nBlockServeCacheSize || mapEntries.count(hash))
+            return;
+        lru.emplace_front(hash, data);
+        mapEntries[hash] = lru.begin();
+        nBytes += data->size();
+        while (nBytes > nBlockServeCacheSize) {
+            nBytes -= lru.back().second->size();
+            mapEntries.erase(lru.back().first);
+            lru.pop_back();
+        }
+    }
+};
+
+static CBlockServeCache blockServeCache;
+
 void static ProcessGetData(CNode* pfrom)
 {
     std::deque<CInv>::iterator it = pfrom->vRecvGetData.begin();
 
     vector<CInv> vNotFound;
 
-    LOCK(cs_main);
-
     while (it != pfrom->vRecvGetData.end()) {
         // Don't bother if send buffer is too full to respond anyway
         if (pfrom->nSendSize >= SendBufferSize())
@@ -7817,47 +8199,78 @@ void static ProcessGetData(CNode* pfrom)
             boost::this_thread::interruption_point();
             it++;
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK)
+            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK)
             {
+                // Decide whether to serve the block while holding cs_main, but
+                // read it from disk without the lock so that other message
+                // handler threads are not stalled behind the disk access.
+                int nType = inv.type;
                 bool send = false;
-                BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
-                if (mi != mapBlockIndex.end())
+                int nHeight = 0;
+                CDiskBlockPos pos;
                 {
-                    if (chainActive.Contains(mi->second)) {
-                        send = true;
-                    } else {
-                        static const int nOneMonth = 30 * 24 * 60 * 60;
-                        // To prevent fingerprinting attacks, only send blocks outside of the active
-                        // chain if they are valid, and no more than a month older (both in time, and in
-                        // best equivalent proof of work) than the best header chain we know about.
-                        send = mi->second->IsValid(BLOCK_VALID_SCRIPTS) && (pindexBestHeader != NULL) &&
-                        (pindexBestHeader->GetBlockTime() - mi->second->GetBlockTime() < nOneMonth) &&
-                        (GetBlockProofEquivalentTime(*pindexBestHeader, *mi->second, *pindexBestHeader, Params().GetConsensus()) < nOneMonth);
-                        if (!send) {
-                            LogPrintf("%s: ignoring request from peer=%i for old block that isn't in the main chain\n", __func__, pfrom->GetId());
+                    LOCK(cs_main);
+                    BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
+                    if (mi != mapBlockIndex.end())
+                    {
+                        if (chainActive.Contains(mi->second)) {
+                            send = true;
+                        } else {
+                            static const int nOneMonth = 30 * 24 * 60 * 60;
+                            // To prevent fingerprinting attacks, only send blocks outside of the active
+                            // chain if they are valid, and no more than a month older (both in time, and in
+                            // best equivalent proof of work) than the best header chain we know about.
+                            send = mi->second->IsValid(BLOCK_VALID_SCRIPTS) && (pindexBestHeader != NULL) &&
+                            (pindexBestHeader->GetBlockTime() - mi->second->GetBlockTime() < nOneMonth) &&
+                            (GetBlockProofEquivalentTime(*pindexBestHeader, *mi->second, *pindexBestHeader, Params().GetConsensus()) < nOneMonth);
+                            if (!send) {
+                                LogPrintf("%s: ignoring request from peer=%i for old block that isn't in the main chain\n", __func__, pfrom->GetId());
+                            }
                         }
                     }
+                    // Pruned nodes may have deleted the block, so check whether
+                    // it's available before trying to send.
+                    send = send && (mi->second->nStatus & BLOCK_HAVE_DATA);
+                    if (send) {
+                        nHeight = mi->second->nHeight;
+                        pos = mi->second->GetBlockPos();
+                    }
+                    // A peer asking for an old block is unlikely to have a mempool to
+                    // match it against, so send it the full block instead.
+                    if (nType == MSG_CMPCT_BLOCK && nHeight < chainActive.Height() - MAX_CMPCTBLOCK_DEPTH)
+                        nType = MSG_BLOCK;
                 }
-                // Pruned nodes may have deleted the block, so check whether
-                // it's available before trying to send.
-                if (send && (mi->second->nStatus & BLOCK_HAVE_DATA))
+                if (send)
                 {
-                    // Send block from disk
-                    CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second,1))
+                    CBlockServeCache::BlockData blockData;
+                    if (nType == MSG_BLOCK)
+                        blockData = blockServeCache.Get(inv.hash);
+                    if (blockData)
                     {
-                        assert(!"cannot load block from disk");
+                        pfrom->PushMessage(NetMsgType::BLOCK, *blockData);
                     }
                     else
                     {
-                        if (inv.type == MSG_BLOCK)
+                        // Send block from disk
+                        CBlock block;
+                        if (!ReadBlockFromDisk(nHeight, block, pos, 1) || block.GetHash() != inv.hash)
+                        {
+                            // The block file may have been pruned since cs_main was released
+                            LogPrintf("%s: cannot load block %s from disk for peer=%i, disconnecting\n", __func__, inv.hash.ToString(), pfrom->GetId());
+                            pfrom->fDisconnect = true;
+                            break;
+                        }
+                        if (nType == MSG_BLOCK)
+                        {
+                            std::shared_ptr<CDataStream> ss = std::make_shared<CDataStream>(SER_NETWORK, PROTOCOL_VERSION);
+                            *ss << block;
+                            pfrom->PushMessage(NetMsgType::BLOCK, *ss);
+                            blockServeCache.Insert(inv.hash, ss);
+                        }
+                        else if (nType == MSG_CMPCT_BLOCK)
                         {
-                            //uint256 hash; int32_t z;
-                            //hash = block.GetHash();
-                            //for (z=31; z>=0; z--)
-                            //    fprintf(stderr,"%02x",((uint8_t *)&hash)[z]);
-                            //fprintf(stderr," send block %d\n",komodo_block2height(&block));
-                            pfrom->PushMessage(NetMsgType::BLOCK, block);
+                            CBlockHeaderAndShortTxIDs cmpctblock(block);
+                            pfrom->PushMessage(NetMsgType::CMPCTBLOCK, cmpctblock);
                         }
                         else // MSG_FILTERED_BLOCK)
                         {
@@ -7888,7 +8301,10 @@ void static ProcessGetData(CNode* pfrom)
                         // and we want it right after the last block so they don't
                         // wait for other stuff first.
                         vector<CInv> vInv;
-                        vInv.push_back(CInv(MSG_BLOCK, chainActive.Tip()->GetBlockHash()));
+                        {
+                            LOCK(cs_main);
+                            vInv.push_back(CInv(MSG_BLOCK, chainActive.Tip()->GetBlockHash()));
+                        }
                         pfrom->PushMessage(NetMsgType::INV, vInv);
                         pfrom->hashContinue.SetNull();
                     }
@@ -7921,7 +8337,7 @@ void static ProcessGetData(CNode* pfrom)
                 }
             }
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK)
+            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK)
                 break;
         }
     }
@@ -7948,6 +8364,311 @@ void static ProcessGetData(CNode* pfrom)
 
 void komodo_netevent(std::vector<uint8_t> payload);
 
+/** Serializes the nSPV and events handlers, whose komodo globals are not otherwise locked */
+static CCriticalSection cs_komodoMessages;
+
+/*****
+ * @brief Admit a transaction received from a peer to the mempool, relay it and resolve any orphans waiting on it
+ * @param pfrom the peer that sent the transaction
+ * @param tx the transaction
+ * @param state the result of the proof pre-check, updated by AcceptToMemoryPool
+ * @param fPreChecked false if the Sapling pre-check already rejected tx, it is then added to recentRejects
+ * and the peer is penalized by the DoS score in state
+ */
+static void ProcessTransaction(CNode* pfrom, const CTransaction& tx, CValidationState& state, bool fPreChecked)
+{
+    vector<uint256> vWorkQueue;
+    vector<uint256> vEraseQueue;
+    CInv inv(MSG_TX, tx.GetHash());
+
+    LOCK(cs_main);
+
+    bool fMissingInputs = false;
+
+    pfrom->setAskFor.erase(inv.hash);
+    mapAlreadyAskedFor.erase(inv);
+
+    if (fPreChecked && !AlreadyHave(inv) && AcceptToMemoryPool(mempool, state, tx, true, &fMissingInputs))
+    {
+        mempool.check(pcoinsTip);
+        RelayTransaction(tx);
+        vWorkQueue.push_back(inv.hash);
+
+        LogPrint("mempool", "AcceptToMemoryPool: peer=%d %s: accepted %s (poolsz %u)\n",
+                 pfrom->id, pfrom->cleanSubVer,
+                 tx.GetHash().ToString(),
+                 mempool.mapTx.size());
+
+        // Recursively process any orphan transactions that depended on this one
+        set<NodeId> setMisbehaving;
+        for (unsigned int i = 0; i < vWorkQueue.size(); i++)
+        {
+            map<uint256, set<uint256> >::iterator itByPrev = mapOrphanTransactionsByPrev.find(vWorkQueue[i]);
+            if (itByPrev == mapOrphanTransactionsByPrev.end())
+                continue;
+            for (set<uint256>::iterator mi = itByPrev->second.begin();
+                 mi != itByPrev->second.end();
+                 ++mi)
+            {
+                const uint256& orphanHash = *mi;
+                const CTransaction& orphanTx = mapOrphanTransactions[orphanHash].tx;
+                NodeId fromPeer = mapOrphanTransactions[orphanHash].fromPeer;
+                bool fMissingInputs2 = false;
+                // Use a dummy CValidationState so someone can't setup nodes to counter-DoS based on orphan
+                // resolution (that is, feeding people an invalid transaction based on LegitTxX in order to get
+                // anyone relaying LegitTxX banned)
+                CValidationState stateDummy;
+
+
+                if (setMisbehaving.count(fromPeer))
+                    continue;
+                if (AcceptToMemoryPool(mempool, stateDummy, orphanTx, true, &fMissingInputs2))
+                {
+                    LogPrint("mempool", "   accepted orphan tx %s\n", orphanHash.ToString());
+                    RelayTransaction(orphanTx);
+                    vWorkQueue.push_back(orphanHash);
+                    vEraseQueue.push_back(orphanHash);
+                }
+                else if (!fMissingInputs2)
+                {
+                    int nDos = 0;
+                    if (stateDummy.IsInvalid(nDos) && nDos > 0)
+                    {
+                        // Punish peer that gave us an invalid orphan tx
+                        Misbehaving(fromPeer, nDos);
+                        setMisbehaving.insert(fromPeer);
+                        LogPrint("mempool", "   invalid orphan tx %s\n", orphanHash.ToString());
+                    }
+                    // Has inputs but not accepted to mempool
+                    // Probably non-standard or insufficient fee/priority
+                    LogPrint("mempool", "   removed orphan tx %s\n", orphanHash.ToString());
+                    vEraseQueue.push_back(orphanHash);
+                    assert(recentRejects);
+                    recentRejects->insert(orphanHash);
+                }
+                mempool.check(pcoinsTip);
+            }
+        }
+
+        BOOST_FOREACH(uint256 hash, vEraseQueue)
+        EraseOrphanTx(hash);
+    }
+    // TODO: currently, prohibit joinsplits and shielded spends/outputs from entering mapOrphans
+    else if (fMissingInputs &&
+             tx.vjoinsplit.empty() &&
+             tx.vShieldedSpend.empty() &&
+             tx.vShieldedOutput.empty())
+    {
+        // valid stake transactions end up in the orphan tx bin
+        AddOrphanTx(tx, pfrom->GetId());
+
+        // DoS prevention: do not allow mapOrphanTransactions to grow unbounded
+        unsigned int nMaxOrphanTx = (unsigned int)std::max((int64_t)0, GetArg("-maxorphantx", DEFAULT_MAX_ORPHAN_TRANSACTIONS));
+        unsigned int nEvicted = LimitOrphanTxSize(nMaxOrphanTx);
+        if (nEvicted > 0)
+            LogPrint("mempool", "mapOrphan overflow, removed %u tx\n", nEvicted);
+    } else {
+        assert(recentRejects);
+        recentRejects->insert(tx.GetHash());
+
+        if (pfrom->fWhitelisted) {
+            // Always relay transactions received from whitelisted peers, even
+            // if they were already in the mempool or rejected from it due
+            // to policy, allowing the node to function as a gateway for
+            // nodes hidden behind it.
+            //
+            // Never relay transactions that we would assign a non-zero DoS
+            // score for, as we expect peers to do the same with us in that
+            // case.
+            int nDoS = 0;
+            if (!state.IsInvalid(nDoS) || nDoS == 0) {
+                LogPrintf("Force relaying tx %s from whitelisted peer=%d\n", tx.GetHash().ToString(), pfrom->id);
+                RelayTransaction(tx);
+            } else {
+                LogPrintf("Not relaying invalid transaction %s from whitelisted peer=%d (%s (code %d))\n",
+                          tx.GetHash().ToString(), pfrom->id, state.GetRejectReason(), state.GetRejectCode());
+            }
+        }
+    }
+    int nDoS = 0;
+    if (state.IsInvalid(nDoS))
+    {
+        LogPrint("mempool", "%s from peer=%d %s was not accepted into the memory pool: %s\n", tx.GetHash().ToString(),
+                 pfrom->id, pfrom->cleanSubVer,
+                 state.GetRejectReason());
+        pfrom->PushMessage(NetMsgType::REJECT, NetMsgType::TX, state.GetRejectCode(),
+                           state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), inv.hash);
+        if (nDoS > 0)
+            Misbehaving(pfrom->GetId(), nDoS);
+    }
+}
+
+//Shielded transactions waiting for batched proof verification ahead of mempool admission
+static boost::mutex csTxAdmission;
+static boost::condition_variable condTxAdmission;
+static std::deque<std::pair<CTransaction, CNode*> > queueTxAdmission;
+static std::atomic<bool> fTxAdmissionRunning(false);
+
+/*****
+ * @brief Hand a shielded transaction to ThreadTxAdmission
+ * @returns false if tx has to be processed in place (transparent only, thread not running or queue full)
+ */
+static bool QueueTxAdmission(const CTransaction& tx, CNode* pfrom)
+{
+    if (!fTxAdmissionRunning || (tx.vShieldedSpend.empty() && tx.vShieldedOutput.empty()))
+        return false;
+
+    {
+        boost::unique_lock<boost::mutex> lock(csTxAdmission);
+        if (queueTxAdmission.size() >= MAX_TX_ADMISSION_QUEUE)
+            return false;
+        queueTxAdmission.push_back(std::make_pair(tx, pfrom->AddRef()));
+    }
+    condTxAdmission.notify_one();
+    return true;
+}
+
+/*****
+ * @brief Verify the Sapling bundles of vptx[nBegin, nEnd) together, splitting a failed range in half
+ * until each invalid transaction is isolated
+ * @param mapInvalid receives the failed validation state of each invalid transaction
+ */
+static void CheckTxAdmissionRange(const std::vector<const CTransaction*>& vptx, size_t nBegin, size_t nEnd, int nextBlockHeight,
+                                  std::map<const CTransaction*, CValidationState>& mapInvalid)
+{
+    std::vector<const CTransaction*> vRange(vptx.begin() + nBegin, vptx.begin() + nEnd);
+    CValidationState state;
+    if (ContextualCheckTransactionMultithreaded(0, vRange, 0, state, nextBlockHeight, 10, true))
+        return;
+
+    if (nEnd - nBegin == 1) {
+        mapInvalid[vptx[nBegin]] = state;
+        return;
+    }
+
+    size_t nMid = nBegin + (nEnd - nBegin) / 2;
+    CheckTxAdmissionRange(vptx, nBegin, nMid, nextBlockHeight, mapInvalid);
+    CheckTxAdmissionRange(vptx, nMid, nEnd, nextBlockHeight, mapInvalid);
+}
+
+/*****
+ * @brief Verify the Sapling bundles of a batch together, then admit the transactions in arrival order
+ * @note ContextualCheckTransactionMultithreaded spreads the batch over the worker threads and stores
+ * valid bundles in the bundle validity cache, so AcceptToMemoryPool only performs the stateful checks.
+ * Transactions that became known or were rejected while queued are not verified again. If the batch
+ * fails it is bisected, the invalid transactions are added to recentRejects and their peers penalized.
+ */
+static void ProcessTxAdmissionBatch(std::vector<std::pair<CTransaction, CNode*> >& vBatch)
+{
+    std::vector<bool> vKnown(vBatch.size());
+    int nextBlockHeight;
+    {
+        LOCK(cs_main);
+        nextBlockHeight = chainActive.Height() + 1;
+        for (size_t i = 0; i < vBatch.size(); i++)
+            vKnown[i] = AlreadyHave(CInv(MSG_TX, vBatch[i].first.GetHash()));
+    }
+
+    //A transaction relayed by several peers is verified once, the copies find it known or rejected
+    std::vector<const CTransaction*> vptx;
+    std::set<uint256> setBatched;
+    for (size_t i = 0; i < vBatch.size(); i++) {
+        if (!vKnown[i] && setBatched.insert(vBatch[i].first.GetHash()).second)
+            vptx.emplace_back(&vBatch[i].first);
+    }
+
+    std::map<const CTransaction*, CValidationState> mapInvalid;
+    if (!vptx.empty())
+        CheckTxAdmissionRange(vptx, 0, vptx.size(), nextBlockHeight, mapInvalid);
+
+    for (auto& item : vBatch) {
+        CValidationState state;
+        std::map<const CTransaction*, CValidationState>::iterator it = mapInvalid.find(&item.first);
+        bool fPreChecked = (it == mapInvalid.end());
+        if (!fPreChecked)
+            state = it->second;
+        ProcessTransaction(item.second, item.first, state, fPreChecked);
+        item.second->Release();
+    }
+}
+
+void ThreadTxAdmission()
+{
+    fTxAdmissionRunning = true;
+    try {
+        while (true) {
+            std::vector<std::pair<CTransaction, CNode*> > vBatch;
+            {
+                boost::unique_lock<boost::mutex> lock(csTxAdmission);
+                while (queueTxAdmission.empty())
+                    condTxAdmission.wait(lock);
+
+                while (!queueTxAdmission.empty() && vBatch.size() < MAX_TX_ADMISSION_BATCH) {
+                    vBatch.push_back(queueTxAdmission.front());
+                    queueTxAdmission.pop_front();
+                }
+            }
+            ProcessTxAdmissionBatch(vBatch);
+        }
+    } catch (const boost::thread_interrupted&) {
+        fTxAdmissionRunning = false;
+        boost::unique_lock<boost::mutex> lock(csTxAdmission);
+        for (auto& item : queueTxAdmission)
+            item.second->Release();
+        queueTxAdmission.clear();
+        throw;
+    }
+}
+
+/**
+ * Finish reconstructing a compact block that pfrom is sending us, using the
+ * transactions in resp, and process it like a block received in full.
+ */
+static void CompleteCompactBlock(CNode* pfrom, const BlockTransactions& resp)
+{
+    CBlock block;
+    {
+        LOCK(cs_main);
+        map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator it = mapBlocksInFlight.find(resp.blockhash);
+        if (it == mapBlocksInFlight.end() || !it->second.second->partialBlock ||
+                it->second.first != pfrom->GetId()) {
+            LogPrint("net", "Peer %d sent us block transactions for block we weren't expecting\n", pfrom->id);
+            return;
+        }
+
+        PartiallyDownloadedBlock& partialBlock = *it->second.second->partialBlock;
+        ReadStatus status = partialBlock.FillBlock(block, resp.txn);
+        if (status == READ_STATUS_INVALID) {
+            MarkBlockAsReceived(resp.blockhash); // Reset in-flight state in case of whitelist
+            Misbehaving(pfrom->GetId(), 100);
+            LogPrintf("Peer %d sent us invalid compact block/non-matching block transactions\n", pfrom->id);
+            return;
+        } else if (status == READ_STATUS_FAILED) {
+            // Might have collided, fall back to getdata now :(
+            it->second.second->partialBlock.reset();
+            std::vector<CInv> vInv(1, CInv(MSG_BLOCK, resp.blockhash));
+            pfrom->PushMessage(NetMsgType::GETDATA, vInv);
+            return;
+        }
+    }
+
+    CInv inv(MSG_BLOCK, block.GetHash());
+    pfrom->AddInventoryKnown(inv);
+
+    CValidationState state;
+    bool forceProcessing = pfrom->fWhitelisted && !IsInitialBlockDownload();
+    ProcessNewBlock(0,0,state, pfrom, &block, forceProcessing, NULL);
+    int nDoS;
+    if (state.IsInvalid(nDoS)) {
+        pfrom->PushMessage(NetMsgType::REJECT, std::string(NetMsgType::BLOCK), state.GetRejectCode(),
+                           state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), inv.hash);
+        if (nDoS > 0) {
+            LOCK(cs_main);
+            Misbehaving(pfrom->GetId(), nDoS);
+        }
+    }
+}
+
 bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv, int64_t nTimeReceived)
 {
     int32_t nProtocolVersion;
@@ -8044,7 +8765,10 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         pfrom->fClient = !(pfrom->nServices & NODE_NETWORK);
 
         // Potentially mark this peer as a preferred download peer.
-        UpdatePreferredDownload(pfrom, State(pfrom->GetId()));
+        {
+            LOCK(cs_main);
+            UpdatePreferredDownload(pfrom, State(pfrom->GetId()));
+        }
 
         //Ask for Address Format Version 2
         pfrom->PushMessage(NetMsgType::SENDADDRV2);
@@ -8125,6 +8849,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         }
         std::vector<uint8_t> payload;
         vRecv >> payload;
+        LOCK(cs_komodoMessages);
         komodo_netevent(payload);
         return(true);
     }
@@ -8147,6 +8872,12 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             State(pfrom->GetId())->fCurrentlyConnected = true;
             AddressCurrentlyConnected(State(pfrom->GetId())->address);
         }
+
+        // Tell the peer we can receive compact blocks, announced with an inv
+        // as usual (BIP 152 low-bandwidth mode).
+        bool fAnnounceUsingCMPCTBLOCK = false;
+        uint64_t nCMPCTBLOCKVersion = 1;
+        pfrom->PushMessage(NetMsgType::SENDCMPCT, fAnnounceUsingCMPCTBLOCK, nCMPCTBLOCKVersion);
     }
 
 
@@ -8171,6 +8902,18 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         return true;
     }
 
+    else if (strCommand == NetMsgType::SENDCMPCT)
+    {
+        bool fAnnounceUsingCMPCTBLOCK = false;
+        uint64_t nCMPCTBLOCKVersion = 0;
+        vRecv >> fAnnounceUsingCMPCTBLOCK >> nCMPCTBLOCKVersion;
+        // We never announce blocks with cmpctblock, so only the version matters
+        if (nCMPCTBLOCKVersion == 1) {
+            LOCK(cs_main);
+            State(pfrom->GetId())->fSupportsCompactBlocks = true;
+        }
+    }
+
     else if (strCommand == NetMsgType::ADDR || strCommand == NetMsgType::ADDRV2)
     {
         int stream_version = vRecv.GetVersion();
@@ -8382,7 +9125,10 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         }
         pfrom->fSentAddr = true;
 
-        pfrom->vAddrToSend.clear();
+        {
+            LOCK(pfrom->cs_addrSend);
+            pfrom->vAddrToSend.clear();
+        }
         vector<CAddress> vAddr = addrman.GetAddr(pfrom->m_wants_addrv2);
         BOOST_FOREACH(const CAddress &addr, vAddr)
         pfrom->PushAddress(addr);
@@ -8394,6 +9140,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         std::vector<uint8_t> payload;
         vRecv >> payload;
 
+        LOCK(cs_komodoMessages);
         if (strCommand == NetMsgType::GETNSPV && KOMODO_NSPV == 0) {
             komodo_nSPVreq(pfrom, payload);
         } else if (strCommand == NetMsgType::NSPV && KOMODO_NSPV_SUPERLITE) {
@@ -8445,7 +9192,12 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                     CNodeState *nodestate = State(pfrom->GetId());
                     if (chainActive.Tip()->GetBlockTime() > GetTime() - chainparams.GetConsensus().nPowTargetSpacing * 20 &&
                         nodestate->nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
-                        vToFetch.push_back(inv);
+                        // A block this close to the tip mostly consists of transactions
+                        // already in our mempool, so ask for it as a compact block.
+                        if (nodestate->fSupportsCompactBlocks)
+                            vToFetch.push_back(CInv(MSG_CMPCT_BLOCK, inv.hash));
+                        else
+                            vToFetch.push_back(inv);
                         // Mark block as in flight already, even though the actual "getdata" message only goes out
                         // later (within the same cs_main lock, though).
                         MarkBlockAsInFlight(pfrom->GetId(), inv.hash, chainparams.GetConsensus());
@@ -8581,135 +9333,33 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         if (IsInitialBlockDownload())
             return true;
 
-        vector<uint256> vWorkQueue;
-        vector<uint256> vEraseQueue;
         CTransaction tx;
         vRecv >> tx;
 
         CInv inv(MSG_TX, tx.GetHash());
         pfrom->AddInventoryKnown(inv);
 
-        LOCK(cs_main);
-
-        bool fMissingInputs = false;
-        CValidationState state;
-
-        pfrom->setAskFor.erase(inv.hash);
-        mapAlreadyAskedFor.erase(inv);
-
-        if (!AlreadyHave(inv) && AcceptToMemoryPool(mempool, state, tx, true, &fMissingInputs))
+        // Transactions already in the mempool or chain, or recently rejected,
+        // skip the proof checks and go straight to the rejection and relay handling
+        bool fAlreadyHave;
         {
-            mempool.check(pcoinsTip);
-            RelayTransaction(tx);
-            vWorkQueue.push_back(inv.hash);
-
-            LogPrint("mempool", "AcceptToMemoryPool: peer=%d %s: accepted %s (poolsz %u)\n",
-                     pfrom->id, pfrom->cleanSubVer,
-                     tx.GetHash().ToString(),
-                     mempool.mapTx.size());
-
-            // Recursively process any orphan transactions that depended on this one
-            set<NodeId> setMisbehaving;
-            for (unsigned int i = 0; i < vWorkQueue.size(); i++)
-            {
-                map<uint256, set<uint256> >::iterator itByPrev = mapOrphanTransactionsByPrev.find(vWorkQueue[i]);
-                if (itByPrev == mapOrphanTransactionsByPrev.end())
-                    continue;
-                for (set<uint256>::iterator mi = itByPrev->second.begin();
-                     mi != itByPrev->second.end();
-                     ++mi)
-                {
-                    const uint256& orphanHash = *mi;
-                    const CTransaction& orphanTx = mapOrphanTransactions[orphanHash].tx;
-                    NodeId fromPeer = mapOrphanTransactions[orphanHash].fromPeer;
-                    bool fMissingInputs2 = false;
-                    // Use a dummy CValidationState so someone can't setup nodes to counter-DoS based on orphan
-                    // resolution (that is, feeding people an invalid transaction based on LegitTxX in order to get
-                    // anyone relaying LegitTxX banned)
-                    CValidationState stateDummy;
-
-
-                    if (setMisbehaving.count(fromPeer))
-                        continue;
-                    if (AcceptToMemoryPool(mempool, stateDummy, orphanTx, true, &fMissingInputs2))
-                    {
-                        LogPrint("mempool", "   accepted orphan tx %s\n", orphanHash.ToString());
-                        RelayTransaction(orphanTx);
-                        vWorkQueue.push_back(orphanHash);
-                        vEraseQueue.push_back(orphanHash);
-                    }
-                    else if (!fMissingInputs2)
-                    {
-                        int nDos = 0;
-                        if (stateDummy.IsInvalid(nDos) && nDos > 0)
-                        {
-                            // Punish peer that gave us an invalid orphan tx
-                            Misbehaving(fromPeer, nDos);
-                            setMisbehaving.insert(fromPeer);
-                            LogPrint("mempool", "   invalid orphan tx %s\n", orphanHash.ToString());
-                        }
-                        // Has inputs but not accepted to mempool
-                        // Probably non-standard or insufficient fee/priority
-                        LogPrint("mempool", "   removed orphan tx %s\n", orphanHash.ToString());
-                        vEraseQueue.push_back(orphanHash);
-                        assert(recentRejects);
-                        recentRejects->insert(orphanHash);
-                    }
-                    mempool.check(pcoinsTip);
-                }
-            }
-
-            BOOST_FOREACH(uint256 hash, vEraseQueue)
-            EraseOrphanTx(hash);
+            LOCK(cs_main);
+            fAlreadyHave = AlreadyHave(inv);
+        }
+        if (fAlreadyHave) {
+            CValidationState state;
+            ProcessTransaction(pfrom, tx, state, true);
+            return true;
         }
-        // TODO: currently, prohibit joinsplits and shielded spends/outputs from entering mapOrphans
-        else if (fMissingInputs &&
-                 tx.vjoinsplit.empty() &&
-                 tx.vShieldedSpend.empty() &&
-                 tx.vShieldedOutput.empty())
-        {
-            // valid stake transactions end up in the orphan tx bin
-            AddOrphanTx(tx, pfrom->GetId());
 
-            // DoS prevention: do not allow mapOrphanTransactions to grow unbounded
-            unsigned int nMaxOrphanTx = (unsigned int)std::max((int64_t)0, GetArg("-maxorphantx", DEFAULT_MAX_ORPHAN_TRANSACTIONS));
-            unsigned int nEvicted = LimitOrphanTxSize(nMaxOrphanTx);
-            if (nEvicted > 0)
-                LogPrint("mempool", "mapOrphan overflow, removed %u tx\n", nEvicted);
-        } else {
-            assert(recentRejects);
-            recentRejects->insert(tx.GetHash());
+        // Shielded transactions are verified in batches by ThreadTxAdmission
+        if (QueueTxAdmission(tx, pfrom))
+            return true;
 
-            if (pfrom->fWhitelisted) {
-                // Always relay transactions received from whitelisted peers, even
-                // if they were already in the mempool or rejected from it due
-                // to policy, allowing the node to function as a gateway for
-                // nodes hidden behind it.
-                //
-                // Never relay transactions that we would assign a non-zero DoS
-                // score for, as we expect peers to do the same with us in that
-                // case.
-                int nDoS = 0;
-                if (!state.IsInvalid(nDoS) || nDoS == 0) {
-                    LogPrintf("Force relaying tx %s from whitelisted peer=%d\n", tx.GetHash().ToString(), pfrom->id);
-                    RelayTransaction(tx);
-                } else {
-                    LogPrintf("Not relaying invalid transaction %s from whitelisted peer=%d (%s (code %d))\n",
-                              tx.GetHash().ToString(), pfrom->id, state.GetRejectReason(), state.GetRejectCode());
-                }
-            }
-        }
-        int nDoS = 0;
-        if (state.IsInvalid(nDoS))
-        {
-            LogPrint("mempool", "%s from peer=%d %s was not accepted into the memory pool: %s\n", tx.GetHash().ToString(),
-                     pfrom->id, pfrom->cleanSubVer,
-                     state.GetRejectReason());
-            pfrom->PushMessage(NetMsgType::REJECT, strCommand, state.GetRejectCode(),
-                               state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), inv.hash);
-            if (nDoS > 0)
-                Misbehaving(pfrom->GetId(), nDoS);
-        }
+        // Verify Sapling proofs and signatures before taking cs_main
+        CValidationState state;
+        bool fPreChecked = PreCheckShieldedTransaction(tx, state);
+        ProcessTransaction(pfrom, tx, state, fPreChecked);
     }
 
     else if (strCommand == NetMsgType::HEADERS && !fImporting && !fReindex) // Ignore headers received while importing
@@ -8728,6 +9378,30 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             ReadCompactSize(vRecv); // ignore tx count; assume it is 0.
         }
 
+        // Verify the Equihash solutions of the headers we do not know yet in
+        // parallel without holding cs_main; AcceptBlockHeader below then finds
+        // them cached. A broken sequence is rejected before any solution is
+        // checked.
+        std::vector<const CBlockHeader*> vUnknown;
+        {
+            LOCK(cs_main);
+            uint256 hashPrev;
+            for (unsigned int n = 0; n < nCount; n++) {
+                if (n > 0 && headers[n].hashPrevBlock != hashPrev) {
+                    Misbehaving(pfrom->GetId(), 20);
+                    return error("non-continuous headers sequence");
+                }
+                hashPrev = headers[n].GetHash();
+                if (mapBlockIndex.count(hashPrev) == 0)
+                    vUnknown.push_back(&headers[n]);
+            }
+        }
+        const CBlockHeader* pinvalid = CheckEquihashSolutions(vUnknown, Params(), maxProcessingThreads);
+        if (pinvalid != NULL) {
+            Misbehaving(pfrom->GetId(), 100);
+            return error("invalid Equihash solution in header %s", pinvalid->GetHash().ToString());
+        }
+
         LOCK(cs_main);
 
         if (nCount == 0) {
@@ -8838,6 +9512,148 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
     }
 
 
+    else if (strCommand == NetMsgType::CMPCTBLOCK && !fImporting && !fReindex) // Ignore blocks received while importing
+    {
+        CBlockHeaderAndShortTxIDs cmpctblock;
+        vRecv >> cmpctblock;
+
+        const uint256 hash = cmpctblock.header.GetHash();
+        LogPrint("net", "received compact block %s peer=%d\n", hash.ToString(), pfrom->id);
+
+        BlockTransactionsRequest req;
+        {
+            LOCK(cs_main);
+            // We only ask for compact blocks in place of a getdata for a block,
+            // so anything we did not request from this peer is ignored.
+            map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator it = mapBlocksInFlight.find(hash);
+            if (it == mapBlocksInFlight.end()) {
+                LogPrint("net", "Peer %d sent us a compact block %s we weren't expecting\n", pfrom->id, hash.ToString());
+                return true;
+            }
+            if (it->second.first != pfrom->GetId()) {
+                LogPrint("net", "Peer %d sent us a compact block %s requested from peer=%d\n", pfrom->id, hash.ToString(), it->second.first);
+                return true;
+            }
+            if (it->second.second->partialBlock) {
+                LogPrint("net", "Peer %d sent us a duplicate compact block %s\n", pfrom->id, hash.ToString());
+                return true;
+            }
+
+            std::unique_ptr<PartiallyDownloadedBlock>& partialBlock = it->second.second->partialBlock;
+            partialBlock.reset(new PartiallyDownloadedBlock(&mempool));
+            ReadStatus status = partialBlock->InitData(cmpctblock);
+            if (status == READ_STATUS_INVALID) {
+                MarkBlockAsReceived(hash); // Reset in-flight state in case of whitelist
+                Misbehaving(pfrom->GetId(), 100);
+                LogPrintf("Peer %d sent us invalid compact block\n", pfrom->id);
+                return true;
+            } else if (status == READ_STATUS_FAILED) {
+                // Too many short ids in one bucket, fall back to a full block
+                LogPrint("net", "Peer %d sent us a compact block %s we could not reconstruct, requesting the full block\n", pfrom->id, hash.ToString());
+                partialBlock.reset();
+                std::vector<CInv> vInv(1, CInv(MSG_BLOCK, hash));
+                pfrom->PushMessage(NetMsgType::GETDATA, vInv);
+                return true;
+            }
+
+            req.blockhash = hash;
+            for (size_t i = 0; i < cmpctblock.BlockTxCount(); i++) {
+                if (!partialBlock->IsTxAvailable(i))
+                    req.indexes.push_back(i);
+            }
+            if (!req.indexes.empty()) {
+                pfrom->PushMessage(NetMsgType::GETBLOCKTXN, req);
+                return true;
+            }
+        }
+
+        // Every transaction was in our mempool or prefilled
+        BlockTransactions txn(req);
+        CompleteCompactBlock(pfrom, txn);
+    }
+
+
+    else if (strCommand == NetMsgType::GETBLOCKTXN)
+    {
+        BlockTransactionsRequest req;
+        vRecv >> req;
+
+        int nHeight = 0;
+        CDiskBlockPos pos;
+        bool fSendFullBlock = false;
+        {
+            LOCK(cs_main);
+            BlockMap::iterator it = mapBlockIndex.find(req.blockhash);
+            if (it == mapBlockIndex.end() || !(it->second->nStatus & BLOCK_HAVE_DATA)) {
+                LogPrintf("Peer %d sent us a getblocktxn for a block we don't have\n", pfrom->id);
+                return true;
+            }
+
+            if (it->second->nHeight < chainActive.Height() - MAX_BLOCKTXN_DEPTH) {
+                // If an older block is requested (should never happen in practice,
+                // but can happen in tests) send a block response instead of a
+                // blocktxn response. Sending a full block response instead of a
+                // small blocktxn response is preferable in the case where a peer
+                // might maliciously send lots of getblocktxn requests to trigger
+                // expensive disk reads, because it will require the peer to
+                // actually receive all the data read from disk over the network.
+                LogPrint("net", "Peer %d sent us a getblocktxn for a block > %i deep\n", pfrom->id, MAX_BLOCKTXN_DEPTH);
+                // Like getdata, only serve old blocks from the active chain
+                if (!chainActive.Contains(it->second)) {
+                    LogPrint("net", "Peer %d sent us a getblocktxn for an old block %s that isn't in the main chain\n", pfrom->id, req.blockhash.ToString());
+                    return true;
+                }
+                fSendFullBlock = true;
+            }
+            nHeight = it->second->nHeight;
+            pos = it->second->GetBlockPos();
+        }
+
+        if (fSendFullBlock) {
+            CBlockServeCache::BlockData blockData = blockServeCache.Get(req.blockhash);
+            if (blockData) {
+                pfrom->PushMessage(NetMsgType::BLOCK, *blockData);
+                return true;
+            }
+        }
+
+        CBlock block;
+        if (!ReadBlockFromDisk(nHeight, block, pos, 1) || block.GetHash() != req.blockhash) {
+            LogPrintf("Failed to read block %s for getblocktxn from peer=%d\n", req.blockhash.ToString(), pfrom->id);
+            return true;
+        }
+
+        if (fSendFullBlock) {
+            std::shared_ptr<CDataStream> ss = std::make_shared<CDataStream>(SER_NETWORK, PROTOCOL_VERSION);
+            *ss << block;
+            pfrom->PushMessage(NetMsgType::BLOCK, *ss);
+            blockServeCache.Insert(req.blockhash, ss);
+            return true;
+        }
+
+        BlockTransactions resp(req);
+        for (size_t i = 0; i < req.indexes.size(); i++) {
+            if (req.indexes[i] >= block.vtx.size()) {
+                LOCK(cs_main);
+                Misbehaving(pfrom->GetId(), 100);
+                LogPrintf("Peer %d sent us a getblocktxn with out-of-bounds tx indices\n", pfrom->id);
+                return true;
+            }
+            resp.txn[i] = block.vtx[req.indexes[i]];
+        }
+        pfrom->PushMessage(NetMsgType::BLOCKTXN, resp);
+    }
+
+
+    else if (strCommand == NetMsgType::BLOCKTXN && !fImporting && !fReindex) // Ignore blocks received while importing
+    {
+        BlockTransactions resp;
+        vRecv >> resp;
+
+        CompleteCompactBlock(pfrom, resp);
+    }
+
+
     else if (strCommand == NetMsgType::MEMPOOL)
     {
         LOCK2(cs_main, pfrom->cs_filter);
@@ -8932,16 +9748,20 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 
         // Nodes must NEVER send a data item > 520 bytes (the max size for a script data object,
         // and thus, the maximum size any matched object can have) in a filteradd message
+        bool bad = false;
         if (vData.size() > MAX_SCRIPT_ELEMENT_SIZE)
         {
-            Misbehaving(pfrom->GetId(), 100);
+            bad = true;
         } else {
             LOCK(pfrom->cs_filter);
             if (pfrom->pfilter)
                 pfrom->pfilter->insert(vData);
             else
-                Misbehaving(pfrom->GetId(), 100);
+                bad = true;
         }
+        // Misbehaving takes cs_main, which must not be acquired while holding cs_filter
+        if (bad)
+            Misbehaving(pfrom->GetId(), 100);
     }
 
 
@@ -9165,8 +9985,10 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             BOOST_FOREACH(CNode* pnode, vNodes)
             {
                 // Periodically clear addrKnown to allow refresh broadcasts
-                if (nLastRebroadcast)
+                if (nLastRebroadcast) {
+                    LOCK(pnode->cs_addrSend);
                     pnode->addrKnown.reset();
+                }
 
                 // Rebroadcast our address
                 AdvertizeLocal(pnode);
@@ -9181,36 +10003,39 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         if (fSendTrickle)
         {
             vector<CAddress> vAddr;
-            vAddr.reserve(pto->vAddrToSend.size());
-            BOOST_FOREACH(const CAddress& addr, pto->vAddrToSend)
             {
-                if (!pto->addrKnown.contains(addr.GetKey()))
+                LOCK(pto->cs_addrSend);
+                vAddr.reserve(pto->vAddrToSend.size());
+                BOOST_FOREACH(const CAddress& addr, pto->vAddrToSend)
                 {
-                    pto->addrKnown.insert(addr.GetKey());
-                    vAddr.push_back(addr);
-
-                    if (vAddr.size() >= MAX_ADDR_TO_SEND)
+                    if (!pto->addrKnown.contains(addr.GetKey()))
                     {
-                      // Should be impossible since we always check size before adding to
-                      // vAddrToSend. Recover by trimming the vector.
-                      vAddr.resize(MAX_ADDR_TO_SEND);
-                    }
-                    const char* msg_type;
-                    int make_flags;
-                    if (pto->m_wants_addrv2) {
-                        msg_type = NetMsgType::ADDRV2;
-                        make_flags = ADDRV2_FORMAT;
-                    } else {
-                        msg_type = NetMsgType::ADDR;
-                        make_flags = 0;
+                        pto->addrKnown.insert(addr.GetKey());
+                        vAddr.push_back(addr);
                     }
-                    pto->PushAddrMessage(CNetMsgMaker(std::min(pto->nVersion, PROTOCOL_VERSION)).Make(make_flags, msg_type, pto->vAddrToSend));
-
                 }
+                pto->vAddrToSend.clear();
             }
 
-            pto->vAddrToSend.clear();
-            vAddr.clear();
+            if (vAddr.size() > MAX_ADDR_TO_SEND)
+            {
+              // Should be impossible since we always check size before adding to
+              // vAddrToSend. Recover by trimming the vector.
+              vAddr.resize(MAX_ADDR_TO_SEND);
+            }
+            if (!vAddr.empty())
+            {
+                const char* msg_type;
+                int make_flags;
+                if (pto->m_wants_addrv2) {
+                    msg_type = NetMsgType::ADDRV2;
+                    make_flags = ADDRV2_FORMAT;
+                } else {
+                    msg_type = NetMsgType::ADDR;
+                    make_flags = 0;
+                }
+                pto->PushAddrMessage(CNetMsgMaker(std::min(pto->nVersion, PROTOCOL_VERSION)).Make(make_flags, msg_type, vAddr));
+            }
         }
 
         CNodeState &state = *State(pto->GetId());
@@ -86,6 +86,10 @@ static const unsigned int MAX_STANDARD_TX_SIGOPS = MAX_BLOCK_SIGOPS/5;
 static const unsigned int DEFAULT_MIN_RELAY_TX_FEE = 100;
 /** Default for -maxorphantx, maximum number of orphan transactions kept in memory */
 static const unsigned int DEFAULT_MAX_ORPHAN_TRANSACTIONS = 100;
+/** Maximum number of shielded transactions verified together by ThreadTxAdmission */
+static const unsigned int MAX_TX_ADMISSION_BATCH = 64;
+/** Maximum number of shielded transactions waiting for ThreadTxAdmission, beyond that they are processed in place */
+static const unsigned int MAX_TX_ADMISSION_QUEUE = 5000;
 /** Default for -txexpirydelta, in number of blocks */
 static const unsigned int DEFAULT_TX_EXPIRY_DELTA = 200;
 /** The maximum size of a blk?????.dat file (since 0.8) */
@@ -122,6 +126,15 @@ static const unsigned int WITNESS_WRITE_UPDATES = 10000;
 /** Maximum length of reject messages. */
 static const unsigned int MAX_REJECT_MESSAGE_LENGTH = 111;
 static const int64_t DEFAULT_MAX_TIP_AGE = 24 * 60 * 60;
+/** Default for -maxbundlecachesize, size in MiB of the Sapling bundle validity cache */
+static const unsigned int DEFAULT_MAX_BUNDLE_CACHE_SIZE = 20;
+/** Default for -maxblockservecachesize, size in MiB of the cache of recently served blocks */
+static const unsigned int DEFAULT_MAX_BLOCK_SERVE_CACHE_SIZE = 32;
+
+/** Maximum depth of blocks we're willing to serve as compact blocks to peers when requested. */
+static const int MAX_CMPCTBLOCK_DEPTH = 5;
+/** Maximum depth of blocks we're willing to respond to GETBLOCKTXN requests for. */
+static const int MAX_BLOCKTXN_DEPTH = 10;
 
 /** Default NSPV support enabled */
 static const bool DEFAULT_NSPV_PROCESSING = false;
@@ -131,6 +144,8 @@ static const bool DEFAULT_NSPV_PROCESSING = false;
 #define DEFAULT_ADDRESSINDEX (GetArg("-ac_cc",0) != 0 || GetArg("-ac_ccactivate",0) != 0)
 #define DEFAULT_SPENTINDEX (GetArg("-ac_cc",0) != 0 || GetArg("-ac_ccactivate",0) != 0)
 static const bool DEFAULT_TIMESTAMPINDEX = false;
+/** Default for -blockindexsnapshot */
+static const bool DEFAULT_BLOCKINDEX_SNAPSHOT = true;
 static const unsigned int DEFAULT_DB_MAX_OPEN_FILES = 1000;
 static const bool DEFAULT_DB_COMPRESSION = true;
 
@@ -168,12 +183,14 @@ extern bool fArchive;
 extern bool fProof;
 extern bool fIsBareMultisigStd;
 extern bool fCheckBlockIndex;
+extern bool fBlockIndexSnapshot;
 extern bool fCheckpointsEnabled;
 extern bool fUnlockedForReporting;
 // TODO: remove this flag by structuring our code such that
 // it is unneeded for testing
 extern bool fCoinbaseEnforcedProtectionEnabled;
 extern size_t nCoinCacheUsage;
+extern size_t nBlockServeCacheSize;
 extern CFeeRate minRelayTxFee;
 extern bool fAlerts;
 extern int64_t nMaxTipAge;
@@ -251,6 +268,13 @@ bool LoadBlockIndex(bool reindex);
  * Clear all values related to the block index
  */
 void UnloadBlockIndex();
+/**
+ * Write the in-memory block index to blockindex.dat, to be loaded in place of
+ * the block tree database on the next start. Call on clean shutdown after
+ * FlushStateToDisk.
+ * @returns true if the snapshot was written
+ */
+bool WriteBlockIndexSnapshot();
 /** Process protocol messages received from a given node */
 bool ProcessMessages(CNode* pfrom);
 /**
@@ -262,6 +286,8 @@ bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto, bool fSendTrickle);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Verify relayed shielded transactions in batches and admit them to the mempool */
+void ThreadTxAdmission();
 /** Try to detect Partition (network isolation) attacks against us */
 void PartitionCheck(bool (*initialDownloadCheck)(), CCriticalSection& cs, const CBlockIndex *const &bestHeader, int64_t nPowTargetSpacing);
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
@@ -334,6 +360,9 @@ void PruneAndFlush();
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
                         bool* pfMissingInputs, bool fRejectAbsurdFee=false, int dosLevel=-1);
 
+/** Verify the Sapling proofs and signatures of tx without cs_main, ahead of AcceptToMemoryPool */
+bool PreCheckShieldedTransaction(const CTransaction &tx, CValidationState &state, int dosLevel=10);
+
 
 struct CNodeStateStats {
     int nMisbehavior;
@@ -766,9 +795,11 @@ CheckTransationResults ContextualCheckTransactionBindingSigWorker(const std::vec
 CheckTransationResults ContextualCheckTransactionSaplingSpendWorker(const std::vector<const SpendDescription*> vSpend, const std::vector<uint256> vSpendSig, const uint32_t threadNumber);
 //Validate a batch of Sapling output descriptions
 CheckTransationResults ContextualCheckTransactionSaplingOutputWorker(const std::vector<const OutputDescription*> vOutput, const uint32_t threadNumber);
+//Batch validate the Sapling bundles of a batch of transactions, falling back to the individual checks on failure
+CheckTransationResults ContextualCheckTransactionSaplingBundleWorker(const std::vector<const CTransaction*> vtx, const std::vector<uint256> vTxSig, const bool fCacheResults, const uint32_t threadNumber);
 /** Check a transaction contextually against a set of consensus rules */
 bool ContextualCheckTransactionMultithreaded(int32_t slowflag, const std::vector<const CTransaction*> vptx, CBlockIndex * const pindexPrev, CValidationState &state, int nHeight, int dosLevel,
-                                bool (*isInitBlockDownload)() = IsInitialBlockDownload,int32_t validateprices=1);
+                                bool fCacheResults = false, bool (*isInitBlockDownload)() = IsInitialBlockDownload,int32_t validateprices=1);
 
 
 /** Apply the effects of this transaction on the UTXO set represented by view */
@@ -902,7 +933,7 @@ bool CheckBlock(int32_t *futureblockp,int32_t height,CBlockIndex *pindex,const C
 
 /** Context-dependent validity checks */
 bool ContextualCheckBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex *pindexPrev);
-bool ContextualCheckBlock(int32_t slowflag,const CBlock& block, CValidationState& state, CBlockIndex *pindexPrev);
+bool ContextualCheckBlock(int32_t slowflag,const CBlock& block, CValidationState& state, CBlockIndex *pindexPrev, bool fCacheResults = false);
 
 /** Check a block is completely valid from start to finish (only works on top of our current best block, with cs_main held) */
 bool TestBlockValidity(CValidationState &state, const CBlock& block, CBlockIndex *pindexPrev, bool fCheckPOW = true, bool fCheckMerkleRoot = true);
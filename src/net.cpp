@@ -60,6 +60,16 @@ using namespace tls;
 #define MSG_NOSIGNAL 0
 #endif
 
+#ifdef USE_EPOLL
+#include <sys/epoll.h>
+
+// Maximum number of readiness events handled per epoll_wait() call
+static const int MAX_EPOLL_EVENTS = 1024;
+
+// epoll instance of ThreadSocketHandler, -1 until the thread has started
+static int hEpollSocket = -1;
+#endif
+
 // Fix for ancient MinGW versions, that don't have defined these in ws2tcpip.h.
 // Todo: Can be removed when our pull-tester is upgraded to a modern MinGW version.
 #ifdef _WIN32
@@ -139,7 +149,15 @@ NodeId nLastNodeId = 0;
 CCriticalSection cs_nLastNodeId;
 
 static CSemaphore *semOutbound = NULL;
-static boost::condition_variable messageHandlerCondition;
+// Each peer is served by the message handler thread of its shard, so that
+// one busy peer only delays the peers sharing its thread.
+static int nMessageHandlerThreads = 1;
+static boost::condition_variable messageHandlerCondition[MAX_MESSAGE_HANDLER_THREADS];
+
+static int MessageHandlerShard(NodeId id)
+{
+    return id % nMessageHandlerThreads;
+}
 
 // Denial-of-service detection/prevention
 // Key is IP address, value is banned-until-time
@@ -615,6 +633,12 @@ void CNode::CloseSocketDisconnect(bool sendShutDownSSL)
                     SSL_free(ssl);
                     ssl = NULL;
                 }
+#ifdef USE_EPOLL
+                // Deregister explicitly: a copy of the descriptor inherited by
+                // a child process would otherwise keep it in the epoll set.
+                if (fEpollRegistered && hEpollSocket != -1)
+                    epoll_ctl(hEpollSocket, EPOLL_CTL_DEL, hSocket, NULL);
+#endif
                 CloseSocket(hSocket);
                 LogPrint("net", "disconnecting peer=%d\n", id);
             }
@@ -927,7 +951,7 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes)
 
         if (msg.complete()) {
             msg.nTime = GetTimeMicros();
-            messageHandlerCondition.notify_one();
+            messageHandlerCondition[MessageHandlerShard(id)].notify_one();
         }
     }
 
@@ -1496,6 +1520,24 @@ void ThreadNonTLSPoolsCleaner()
 void ThreadSocketHandler()
 {
     unsigned int nPrevNodeCount = 0;
+#ifdef USE_EPOLL
+    hEpollSocket = epoll_create1(EPOLL_CLOEXEC);
+    if (hEpollSocket == SOCKET_ERROR) {
+        LogPrintf("socket epoll_create1 error %s\n", NetworkErrorString(WSAGetLastError()));
+        return;
+    }
+    BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket) {
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = (void*)&hListenSocket;
+        if (epoll_ctl(hEpollSocket, EPOLL_CTL_ADD, hListenSocket.socket, &event) == SOCKET_ERROR)
+            LogPrintf("socket epoll_ctl error %s\n", NetworkErrorString(WSAGetLastError()));
+    }
+    // Set when a node may still have data to read, or a ready node could
+    // not be serviced because its buffers were locked.
+    bool fMoreWork = false;
+    bool fContended = false;
+#endif
     while (true)
     {
         //
@@ -1561,6 +1603,80 @@ void ThreadSocketHandler()
             uiInterface.NotifyNumConnectionsChanged(nPrevNodeCount);
         }
 
+#ifdef USE_EPOLL
+        //
+        // Register new sockets and wait for readiness changes
+        //
+        {
+            LOCK(cs_vNodes);
+            BOOST_FOREACH(CNode* pnode, vNodes)
+            {
+                if (pnode->fEpollRegistered)
+                    continue;
+
+                LOCK(pnode->cs_hSocket);
+
+                if (pnode->hSocket == INVALID_SOCKET)
+                    continue;
+
+                struct epoll_event event;
+                event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+                event.data.ptr = pnode;
+                if (epoll_ctl(hEpollSocket, EPOLL_CTL_ADD, pnode->hSocket, &event) == SOCKET_ERROR) {
+                    LogPrintf("socket epoll_ctl error %s\n", NetworkErrorString(WSAGetLastError()));
+                    pnode->fDisconnect = true;
+                    continue;
+                }
+                // Readiness before registration is unknown, so try both
+                // directions once; a would-block clears the flag again.
+                pnode->fEpollRegistered = true;
+                pnode->fRecvReady = true;
+                pnode->fSendReady = true;
+            }
+        }
+
+        struct epoll_event events[MAX_EPOLL_EVENTS];
+        int nEvents = epoll_wait(hEpollSocket, events, MAX_EPOLL_EVENTS, fMoreWork ? 0 : (fContended ? 1 : 50));
+        boost::this_thread::interruption_point();
+
+        if (nEvents == SOCKET_ERROR)
+        {
+            int nErr = WSAGetLastError();
+            if (nErr != WSAEINTR)
+            {
+                LogPrintf("socket epoll_wait error %s\n", NetworkErrorString(nErr));
+                MilliSleep(50);
+            }
+            nEvents = 0;
+        }
+
+        for (int i = 0; i < nEvents; i++)
+        {
+            const ListenSocket* pListenSocket = NULL;
+            BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket) {
+                if (events[i].data.ptr == &hListenSocket)
+                    pListenSocket = &hListenSocket;
+            }
+            if (pListenSocket) {
+                // Listening sockets are level-triggered, one accept per wakeup.
+                if (pListenSocket->socket != INVALID_SOCKET)
+                    AcceptConnection(*pListenSocket);
+                continue;
+            }
+
+            // Nodes are only deleted by this thread, and their sockets are
+            // closed (and so deregistered) before that, so the pointer is valid.
+            CNode* pnode = (CNode*)events[i].data.ptr;
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP))
+                pnode->fRecvReady = true;
+            if (events[i].events & EPOLLOUT)
+                pnode->fSendReady = true;
+            if (events[i].events & (EPOLLERR | EPOLLHUP))
+                pnode->fSocketError = true;
+        }
+        fMoreWork = false;
+        fContended = false;
+#else
         //
         // Find which sockets have data to receive
         //
@@ -1657,6 +1773,8 @@ void ThreadSocketHandler()
             }
         }
 
+#endif
+
         //
         // Service each socket
         //
@@ -1671,9 +1789,60 @@ void ThreadSocketHandler()
         {
             boost::this_thread::interruption_point();
 
-            if (tlsmanager.threadSocketHandler(pnode,fdsetRecv,fdsetSend,fdsetError)==-1){
+#ifdef USE_EPOLL
+            // The cached readiness is gated the same way as the select() sets:
+            // drain pending sends first, and only read while the receive
+            // buffer has room. A ready direction that could not be serviced
+            // (lock busy) or that may still hold data is retried without
+            // waiting for another edge.
+            bool recvSet = false, sendSet = false, errorSet = pnode->fSocketError;
+            bool fSendPending = false, fSendLocked = false;
+            {
+                TRY_LOCK(pnode->cs_vSend, lockSend);
+                fSendLocked = lockSend;
+                if (lockSend)
+                    fSendPending = !pnode->vSendMsg.empty();
+            }
+            if (fSendPending) {
+                sendSet = pnode->fSendReady;
+            } else {
+                if (!fSendLocked && pnode->fSendReady)
+                    fContended = true;
+                TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+                if (!lockRecv) {
+                    if (pnode->fRecvReady)
+                        fContended = true;
+                } else if (pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
+                           pnode->GetTotalRecvSize() <= ReceiveFloodSize()) {
+                    recvSet = pnode->fRecvReady;
+                }
+            }
+
+            if (tlsmanager.threadSocketHandler(pnode,recvSet,sendSet,errorSet)==-1){
+                continue;
+            }
+            if (recvSet && pnode->fRecvReady)
+                fMoreWork = true;
+            // A read skipped for a pending send gets no new EPOLLIN edge for
+            // data already queued in the kernel, so retry it on the next pass
+            // unless the send hit would-block and an EPOLLOUT edge will wake us.
+            if (fSendPending && pnode->fRecvReady && pnode->fSendReady)
+                fMoreWork = true;
+#else
+            bool recvSet = false, sendSet = false, errorSet = false;
+            {
+                LOCK(pnode->cs_hSocket);
+                if (pnode->hSocket != INVALID_SOCKET) {
+                    recvSet = FD_ISSET(pnode->hSocket, &fdsetRecv);
+                    sendSet = FD_ISSET(pnode->hSocket, &fdsetSend);
+                    errorSet = FD_ISSET(pnode->hSocket, &fdsetError);
+                }
+            }
+
+            if (tlsmanager.threadSocketHandler(pnode,recvSet,sendSet,errorSet)==-1){
                 continue;
             }
+#endif
 
             //
             // Inactivity checking
@@ -2043,7 +2212,7 @@ bool OpenNetworkConnection(const CAddress& addrConnect, CSemaphoreGrant *grantOu
 }
 
 
-void ThreadMessageHandler()
+void ThreadMessageHandler(int nShard)
 {
     boost::mutex condition_mutex;
     boost::unique_lock<boost::mutex> lock(condition_mutex);
@@ -2060,7 +2229,9 @@ void ThreadMessageHandler()
             }
         }
 
-        // Poll the connected nodes for messages
+        // Poll the connected nodes for messages. The trickle node is drawn
+        // from all peers, so across the shards about one peer per pass
+        // still gets the trickled inventory and addresses.
         CNode* pnodeTrickle = NULL;
         if (!vNodesCopy.empty())
             pnodeTrickle = vNodesCopy[GetRand(vNodesCopy.size())];
@@ -2069,7 +2240,7 @@ void ThreadMessageHandler()
 
         BOOST_FOREACH(CNode* pnode, vNodesCopy)
         {
-            if (pnode->fDisconnect)
+            if (pnode->fDisconnect || MessageHandlerShard(pnode->GetId()) != nShard)
                 continue;
 
             // Receive messages
@@ -2107,7 +2278,7 @@ void ThreadMessageHandler()
         }
 
         if (fSleep)
-            messageHandlerCondition.timed_wait(lock, boost::posix_time::microsec_clock::universal_time() + boost::posix_time::milliseconds(100));
+            messageHandlerCondition[nShard].timed_wait(lock, boost::posix_time::microsec_clock::universal_time() + boost::posix_time::milliseconds(100));
     }
 }
 
@@ -2386,6 +2557,10 @@ void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler)
     if ( is_STAKED(chainName.symbol()) != 0 )
         SoftSetBoolArg("-dnsseed", false);
 
+    // Must be set before the socket thread starts waking up message handlers
+    nMessageHandlerThreads = std::max(1, std::min((int)GetArg("-msghandthreads", DEFAULT_MESSAGE_HANDLER_THREADS), MAX_MESSAGE_HANDLER_THREADS));
+    LogPrintf("Using %d message handler threads\n", nMessageHandlerThreads);
+
     //
     // Start threads
     //
@@ -2413,7 +2588,10 @@ void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler)
     threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "opencon", &ThreadOpenConnections));
 
     // Process messages
-    threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "msghand", &ThreadMessageHandler));
+    for (int i = 0; i < nMessageHandlerThreads; i++) {
+        boost::function<void()> msghand = boost::bind(&ThreadMessageHandler, i);
+        threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, "msghand", msghand));
+    }
 
     #if defined(USE_TLS)
         if (CNode::GetTlsFallbackNonTls())
@@ -2458,6 +2636,12 @@ public:
             if (hListenSocket.socket != INVALID_SOCKET)
                 if (!CloseSocket(hListenSocket.socket))
                     LogPrintf("CloseSocket(hListenSocket) failed with error %s\n", NetworkErrorString(WSAGetLastError()));
+#ifdef USE_EPOLL
+        if (hEpollSocket != -1) {
+            close(hEpollSocket);
+            hEpollSocket = -1;
+        }
+#endif
 
         // clean up some globals (to help leak detection)
         BOOST_FOREACH(CNode *pnode, vNodes)
@@ -2707,6 +2891,10 @@ CNode::CNode(SOCKET hSocketIn, const CAddress& addrIn, const std::string& addrNa
     fNetworkNode = false;
     fSuccessfullyConnected = false;
     fDisconnect = false;
+    fEpollRegistered = false;
+    fRecvReady = false;
+    fSendReady = false;
+    fSocketError = false;
     nRefCount = 0;
     nSendSize = 0;
     nSendOffset = 0;
@@ -90,6 +90,10 @@ static const size_t MAPASKFOR_MAX_SZ = MAX_INV_SZ;
 static const size_t SETASKFOR_MAX_SZ = 2 * MAX_INV_SZ;
 /** The maximum number of peer connections to maintain. */
 static const unsigned int DEFAULT_MAX_PEER_CONNECTIONS = 384;
+/** The default number of threads processing peer messages (-msghandthreads). */
+static const int DEFAULT_MESSAGE_HANDLER_THREADS = 4;
+/** The maximum number of threads processing peer messages. */
+static const int MAX_MESSAGE_HANDLER_THREADS = 16;
 /** The period before a network upgrade activates, where connections to upgrading peers are preferred (in blocks). */
 static const int NETWORK_UPGRADE_PEER_PREFERENCE_BLOCK_PERIOD = 24 * 24 * 3;
 
@@ -377,6 +381,12 @@ public:
     uint64_t nServices;
     SOCKET hSocket;
     CCriticalSection cs_hSocket;
+    // Edge-triggered readiness of hSocket, only used by the epoll socket loop:
+    // set by events, cleared once a read or write would block.
+    bool fEpollRegistered;
+    bool fRecvReady;
+    bool fSendReady;
+    bool fSocketError;
     CDataStream ssSend;
     size_t nSendSize; // total size of all vSendMsg entries
     size_t nSendOffset; // offset inside the first vSendMsg already sent
@@ -461,6 +471,10 @@ public:
     int nStartingHeight;
 
     // flood relay
+    // vAddrToSend and addrKnown are also filled by the message handler
+    // threads of other peers when they relay addresses, so they are
+    // guarded by cs_addrSend.
+    CCriticalSection cs_addrSend;
     std::vector<CAddress> vAddrToSend;
     CRollingBloomFilter addrKnown;
     bool fGetAddr;
@@ -559,6 +573,7 @@ public:
 
     void AddAddressKnown(const CAddress& _addr)
     {
+        LOCK(cs_addrSend);
         addrKnown.insert(_addr.GetKey());
     }
 
@@ -569,6 +584,7 @@ public:
         // because they require ADDRv2 (BIP155) encoding.
         const bool addr_format_supported = m_wants_addrv2 || _addr.IsAddrV1Compatible();
 
+        LOCK(cs_addrSend);
         // Known checking here is only to save space from duplicates.
         // SendMessages will filter it again for knowns that were added
         // after addresses were pushed.
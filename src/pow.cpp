@@ -27,6 +27,7 @@
 #include "crypto/equihash.h"
 #include "primitives/block.h"
 #include "streams.h"
+#include "sync.h"
 #include "uint256.h"
 #include "util.h"
 #include "komodo.h"
@@ -42,6 +43,11 @@
 
 #include "komodo_defs.h"
 
+#include <atomic>
+#include <future>
+#include <list>
+#include <unordered_map>
+
 /* from zawy repo
  Preliminary code for super-fast increases in difficulty.
  Requires the ability to change the difficulty during the current block,
@@ -550,19 +556,31 @@ unsigned int CalculateNextWorkRequired(arith_uint256 bnAvg,
     return bnNew.GetCompact();
 }
 
-bool CheckEquihashSolution(const CBlockHeader *pblock, const CChainParams& params)
+namespace {
+
+struct EquihashCacheHasher
 {
-    if (ASSETCHAINS_ALGO != ASSETCHAINS_EQUIHASH)
-        return true;
-    
-    if ( ASSETCHAINS_NK[0] != 0 && ASSETCHAINS_NK[1] != 0 && pblock->GetHash().ToString() == "027e3758c3a65b12aa1046462b486d0a63bfa1beae327897f56c5cfb7daaae71" )
-        return true;
+    size_t operator()(const uint256& hash) const { return hash.GetCheapHash(); }
+};
+
+/** Maximum number of header hashes remembered as carrying a valid Equihash solution */
+static const size_t MAX_EQUIHASH_CACHE_SIZE = 100000;
+
+/**
+ * Hashes of headers whose Equihash solution has already been verified, most
+ * recently used first. The header hash commits to nSolution, so a hit means
+ * the same solution was checked before, e.g. during header sync before the
+ * block arrived.
+ */
+CCriticalSection cs_equihashcache;
+std::list<uint256> lruValidEquihash;
+std::unordered_map<uint256, std::list<uint256>::iterator, EquihashCacheHasher> mapValidEquihash;
 
+bool VerifyEquihashSolution(const CBlockHeader *pblock, const CChainParams& params)
+{
     unsigned int n = params.EquihashN();
     unsigned int k = params.EquihashK();
 
-    if ( Params().NetworkIDString() == "regtest" )
-        return(true);
     // Hash state
     crypto_generichash_blake2b_state state;
     EhInitialiseState(n, k, state);
@@ -579,13 +597,78 @@ bool CheckEquihashSolution(const CBlockHeader *pblock, const CChainParams& param
 
     bool isValid;
     EhIsValidSolution(n, k, state, pblock->nSolution, isValid);
+    return isValid;
+}
+
+} // namespace
 
-    if (!isValid)
+bool CheckEquihashSolution(const CBlockHeader *pblock, const CChainParams& params)
+{
+    if (ASSETCHAINS_ALGO != ASSETCHAINS_EQUIHASH)
+        return true;
+    
+    if ( ASSETCHAINS_NK[0] != 0 && ASSETCHAINS_NK[1] != 0 && pblock->GetHash().ToString() == "027e3758c3a65b12aa1046462b486d0a63bfa1beae327897f56c5cfb7daaae71" )
+        return true;
+
+    if ( Params().NetworkIDString() == "regtest" )
+        return(true);
+
+    uint256 hash = pblock->GetHash();
+    {
+        LOCK(cs_equihashcache);
+        auto it = mapValidEquihash.find(hash);
+        if (it != mapValidEquihash.end()) {
+            lruValidEquihash.splice(lruValidEquihash.begin(), lruValidEquihash, it->second);
+            return true;
+        }
+    }
+
+    if (!VerifyEquihashSolution(pblock, params))
         return error("CheckEquihashSolution(): invalid solution");
 
+    LOCK(cs_equihashcache);
+    if (mapValidEquihash.count(hash))
+        return true;
+    if (lruValidEquihash.size() >= MAX_EQUIHASH_CACHE_SIZE) {
+        mapValidEquihash.erase(lruValidEquihash.back());
+        lruValidEquihash.pop_back();
+    }
+    lruValidEquihash.push_front(hash);
+    mapValidEquihash[hash] = lruValidEquihash.begin();
     return true;
 }
 
+const CBlockHeader* CheckEquihashSolutions(const std::vector<const CBlockHeader*>& vHeaders, const CChainParams& params, int nThreads)
+{
+    if (ASSETCHAINS_ALGO != ASSETCHAINS_EQUIHASH || vHeaders.empty())
+        return NULL;
+    nThreads = std::max(1, std::min(nThreads, (int)vHeaders.size()));
+
+    // Each worker takes every nThreads-th header in ascending order and stops
+    // once it reaches the lowest invalid index found so far. That index only
+    // ever decreases, so every header before the one returned was checked.
+    std::atomic<size_t> nFirstInvalid(vHeaders.size());
+    auto worker = [&vHeaders, &params, &nFirstInvalid, nThreads](int t) {
+        for (size_t i = t; i < nFirstInvalid.load(); i += nThreads) {
+            if (!CheckEquihashSolution(vHeaders[i], params)) {
+                size_t nPrev = nFirstInvalid.load();
+                while (i < nPrev && !nFirstInvalid.compare_exchange_weak(nPrev, i)) {}
+                return;
+            }
+        }
+    };
+
+    std::vector<std::future<void>> vFutures;
+    for (int t = 1; t < nThreads; t++)
+        vFutures.emplace_back(std::async(std::launch::async, worker, t));
+    worker(0);
+    for (auto &future : vFutures)
+        future.get();
+
+    size_t nInvalid = nFirstInvalid.load();
+    return nInvalid < vHeaders.size() ? vHeaders[nInvalid] : NULL;
+}
+
 int32_t komodo_is_special(uint8_t pubkeys[66][33],int32_t mids[66],uint32_t blocktimes[66],int32_t height,uint8_t pubkey33[33],uint32_t blocktime);
 int32_t komodo_currentheight();
 void komodo_index2pubkey33(uint8_t *pubkey33,CBlockIndex *pindex,int32_t height);
@@ -25,6 +25,7 @@
 #include "consensus/params.h"
 
 #include <stdint.h>
+#include <vector>
 
 class CBlockHeader;
 class CBlockIndex;
@@ -40,6 +41,15 @@ unsigned int CalculateNextWorkRequired(arith_uint256 bnAvg,
 /** Check whether the Equihash solution in a block header is valid */
 bool CheckEquihashSolution(const CBlockHeader *pblock, const CChainParams&);
 
+/**
+ * Check the Equihash solutions of a batch of headers on nThreads threads,
+ * stopping at the first invalid one. Valid solutions are cached, so the
+ * in-order CheckEquihashSolution calls made while accepting the headers (and
+ * later their blocks) return at once.
+ * @return the first header with an invalid solution, or NULL if all are valid
+ */
+const CBlockHeader* CheckEquihashSolutions(const std::vector<const CBlockHeader*>& vHeaders, const CChainParams&, int nThreads);
+
 /**
  * @brief Check if given notaryid is allowed to mine a mindiff block in case of GAP
  *
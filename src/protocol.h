@@ -456,6 +456,9 @@ enum {
     // Nodes may always request a MSG_FILTERED_BLOCK in a getdata, however,
     // MSG_FILTERED_BLOCK should not appear in any invs except as a part of getdata.
     MSG_FILTERED_BLOCK,
+    // Requests a block as a cmpctblock message (BIP 152). Like MSG_FILTERED_BLOCK,
+    // it only appears in getdata and only to peers that sent us sendcmpct.
+    MSG_CMPCT_BLOCK,
 };
 
 #endif // BITCOIN_PROTOCOL_H
@@ -23,6 +23,7 @@
 #include "primitives/transaction.h"
 #include "main.h"
 #include "httpserver.h"
+#include "lightblocks.h"
 #include "rpc/server.h"
 #include "streams.h"
 #include "sync.h"
@@ -280,6 +281,56 @@ static bool rest_block_notxdetails(HTTPRequest* req, const std::string& strURIPa
     return rest_block(req, strURIPart, false);
 }
 
+static bool rest_saplingblocks(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    if (plightblocks == NULL)
+        return RESTERR(req, HTTP_NOT_FOUND, "Light client block index not enabled (start with -lightblockindex)");
+    vector<string> params;
+    const RetFormat rf = ParseDataFormat(params, strURIPart);
+    vector<string> path;
+    boost::split(path, params[0], boost::is_any_of("/"));
+
+    if (path.size() != 2)
+        return RESTERR(req, HTTP_BAD_REQUEST, "No block range specified. Use /rest/saplingblocks/<height>/<count>.<ext>.");
+
+    long nStart = strtol(path[0].c_str(), NULL, 10);
+    if (nStart < 0 || nStart > std::numeric_limits<int>::max())
+        return RESTERR(req, HTTP_BAD_REQUEST, "Height out of range: " + path[0]);
+
+    long nCount = strtol(path[1].c_str(), NULL, 10);
+    if (nCount < 1 || nCount > MAX_LIGHTBLOCKS_PER_REQUEST)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Block count out of range: " + path[1]);
+
+    // Compact blocks are read straight from the light block store, cs_main is not taken
+    std::string strData;
+    if (plightblocks->ReadBlocks(nStart, nCount, strData) == 0)
+        return RESTERR(req, HTTP_NOT_FOUND, "No compact blocks available from height " + path[0]);
+
+    switch (rf) {
+    case RF_BINARY: {
+        req->WriteHeader("Content-Type", "application/octet-stream");
+        req->WriteReply(HTTP_OK, strData);
+        return true;
+    }
+
+    case RF_HEX: {
+        string strHex = HexStr(strData.begin(), strData.end()) + "\n";
+        req->WriteHeader("Content-Type", "text/plain");
+        req->WriteReply(HTTP_OK, strHex);
+        return true;
+    }
+
+    default: {
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: .bin, .hex)");
+    }
+    }
+
+    // not reached
+    return true; // continue to process further HTTP reqs on this cxn
+}
+
 // A bit of a hack - dependency on a function defined in rpc/blockchain.cpp
 UniValue getblockchaininfo(const UniValue& params, bool fHelp, const CPubKey& mypk);
 
@@ -618,6 +669,7 @@ static const struct {
       {"/rest/mempool/info", rest_mempool_info},
       {"/rest/mempool/contents", rest_mempool_contents},
       {"/rest/headers/", rest_headers},
+      {"/rest/saplingblocks/", rest_saplingblocks},
       {"/rest/getutxos", rest_getutxos},
 };
 
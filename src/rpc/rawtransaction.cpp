@@ -1389,7 +1389,6 @@ UniValue sendrawtransaction(const UniValue& params, bool fHelp, const CPubKey& m
             + HelpExampleRpc("sendrawtransaction", "\"signedhex\"")
         );
     }
-    LOCK(cs_main);
     RPCTypeCheck(params, boost::assign::list_of(UniValue::VSTR)(UniValue::VBOOL));
 
     // parse hex string from parameter
@@ -1398,6 +1397,16 @@ UniValue sendrawtransaction(const UniValue& params, bool fHelp, const CPubKey& m
         throw JSONRPCError(RPC_DESERIALIZATION_ERROR, "TX decode failed");
     uint256 hashTx = tx.GetHash();
 
+    // Verify Sapling proofs and signatures before taking cs_main
+    if ( KOMODO_NSPV_FULLNODE && !mempool.exists(hashTx) )
+    {
+        CValidationState state;
+        if (!PreCheckShieldedTransaction(tx, state))
+            throw JSONRPCError(RPC_TRANSACTION_REJECTED, strprintf("%i: %s", state.GetRejectCode(), state.GetRejectReason()));
+    }
+
+    LOCK(cs_main);
+
     bool fOverrideFees = false;
     if (params.size() > 1)
         fOverrideFees = params[1].get_bool();
@@ -147,6 +147,50 @@ extern "C" {
         unsigned char *result
     );
 
+    /// This function constructs a Spend proof like
+    /// `librustzcash_sapling_spend_proof`, but without a proving context,
+    /// so that proofs can be created concurrently. The caller chooses the
+    /// value commitment randomness `rcv`.
+    bool librustzcash_sapling_spend_proof_rcv(
+        const unsigned char *ak,
+        const unsigned char *nsk,
+        const unsigned char *diversifier,
+        const unsigned char *rcm,
+        const unsigned char *ar,
+        const unsigned char *rcv,
+        const uint64_t value,
+        const unsigned char *anchor,
+        const unsigned char *witness,
+        unsigned char *cv,
+        unsigned char *rk,
+        unsigned char *zkproof
+    );
+
+    /// This function constructs an Output proof like
+    /// `librustzcash_sapling_output_proof`, but without a proving context.
+    /// The caller chooses the value commitment randomness `rcv`.
+    bool librustzcash_sapling_output_proof_rcv(
+        const unsigned char *esk,
+        const unsigned char *payment_address,
+        const unsigned char *rcm,
+        const unsigned char *rcv,
+        const uint64_t value,
+        unsigned char *cv,
+        unsigned char *zkproof
+    );
+
+    /// This function constructs the binding signature for proofs made
+    /// with the `_rcv` functions above, given the 32-byte `rcv` of every
+    /// Spend and every Output.
+    bool librustzcash_sapling_binding_sig_rcv(
+        const unsigned char *spend_rcv,
+        size_t spend_rcv_len,
+        const unsigned char *output_rcv,
+        size_t output_rcv_len,
+        const unsigned char *sighash,
+        unsigned char *result
+    );
+
     /// Frees a Sapling proving context returned from
     /// `librustzcash_sapling_proving_ctx_init`.
     void librustzcash_sapling_proving_ctx_free(void *);
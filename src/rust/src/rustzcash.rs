@@ -51,7 +51,10 @@ use std::os::windows::ffi::OsStringExt;
 
 use zcash_primitives::{
     block::equihash,
-    constants::{CRH_IVK_PERSONALIZATION, PROOF_GENERATION_KEY_GENERATOR, SPENDING_KEY_GENERATOR},
+    constants::{
+        CRH_IVK_PERSONALIZATION, PROOF_GENERATION_KEY_GENERATOR, SPENDING_KEY_GENERATOR,
+        VALUE_COMMITMENT_RANDOMNESS_GENERATOR, VALUE_COMMITMENT_VALUE_GENERATOR,
+    },
     merkle_tree::{HashSer,merkle_path_from_slice},
     sapling::{
         merkle_hash,
@@ -65,6 +68,7 @@ use zcash_primitives::{
     zip32,
 };
 use zcash_proofs::{
+    circuit::sapling::{Output as OutputCircuit, Spend as SpendCircuit, ValueCommitmentOpening},
     sapling::{SaplingProvingContext, SaplingVerificationContext},
     sprout as old_sprout,
 };
@@ -1033,6 +1037,248 @@ pub extern "C" fn librustzcash_sapling_spend_proof(
     true
 }
 
+/// Computes the value commitment `cv` for `value` under the randomness `rcv`.
+fn sapling_value_commitment(value: u64, rcv: &jubjub::Fr) -> [u8; 32] {
+    (VALUE_COMMITMENT_VALUE_GENERATOR * jubjub::Fr::from(value)
+        + VALUE_COMMITMENT_RANDOMNESS_GENERATOR * rcv)
+        .to_bytes()
+}
+
+/// This function constructs a Spend proof like
+/// [`librustzcash_sapling_spend_proof`], but without a proving context, so
+/// that the proofs of a transaction can be created concurrently. The caller
+/// chooses the value commitment randomness `rcv` and passes it on to
+/// [`librustzcash_sapling_binding_sig_rcv`].
+#[no_mangle]
+pub extern "C" fn librustzcash_sapling_spend_proof_rcv(
+    ak: *const [c_uchar; 32],
+    nsk: *const [c_uchar; 32],
+    diversifier: *const [c_uchar; 11],
+    rcm: *const [c_uchar; 32],
+    ar: *const [c_uchar; 32],
+    rcv: *const [c_uchar; 32],
+    value: u64,
+    anchor: *const [c_uchar; 32],
+    merkle_path: *const [c_uchar; 1 + 33 * SAPLING_TREE_DEPTH + 8],
+    cv: *mut [c_uchar; 32],
+    rk_out: *mut [c_uchar; 32],
+    zkproof: *mut [c_uchar; GROTH_PROOF_SIZE],
+) -> bool {
+    // Grab `ak` from the caller, which should be a point of prime order.
+    let ak = match de_ct(jubjub::ExtendedPoint::from_bytes(unsafe { &*ak })) {
+        Some(p) => p,
+        None => return false,
+    };
+    let ak = match de_ct(ak.into_subgroup()) {
+        Some(p) => p,
+        None => return false,
+    };
+
+    let nsk = match de_ct(jubjub::Scalar::from_bytes(unsafe { &*nsk })) {
+        Some(p) => p,
+        None => return false,
+    };
+
+    let proof_generation_key = ProofGenerationKey { ak, nsk };
+    let diversifier = Diversifier(unsafe { *diversifier });
+
+    let rcm = match de_ct(jubjub::Scalar::from_bytes(unsafe { &*rcm })) {
+        Some(p) => p,
+        None => return false,
+    };
+
+    let ar = match de_ct(jubjub::Scalar::from_bytes(unsafe { &*ar })) {
+        Some(p) => p,
+        None => return false,
+    };
+
+    let rcv = match de_ct(jubjub::Scalar::from_bytes(unsafe { &*rcv })) {
+        Some(p) => p,
+        None => return false,
+    };
+
+    let anchor = match de_ct(bls12_381::Scalar::from_bytes(unsafe { &*anchor })) {
+        Some(p) => p,
+        None => return false,
+    };
+
+    let merkle_path = match merkle_path_from_slice(unsafe { &(&*merkle_path)[..] }) {
+        Ok(w) => w,
+        Err(_) => return false,
+    };
+
+    let payment_address = match proof_generation_key
+        .to_viewing_key()
+        .to_payment_address(diversifier)
+    {
+        Some(pa) => pa,
+        None => return false,
+    };
+
+    // We now have the full witness for the circuit
+    let position = u64::from(merkle_path.position());
+    let instance = SpendCircuit {
+        value_commitment_opening: Some(ValueCommitmentOpening {
+            value,
+            randomness: rcv,
+        }),
+        proof_generation_key: Some(proof_generation_key.clone()),
+        payment_address: Some(payment_address),
+        commitment_randomness: Some(rcm),
+        ar: Some(ar),
+        auth_path: merkle_path
+            .path_elems()
+            .iter()
+            .enumerate()
+            .map(|(i, node)| Some(((*node).into(), (position >> i) & 0x1 == 1)))
+            .collect(),
+        anchor: Some(anchor),
+    };
+
+    let proof = match groth16::create_random_proof(
+        instance,
+        unsafe { SAPLING_SPEND_PARAMS.as_ref() }.unwrap(),
+        &mut OsRng,
+    ) {
+        Ok(p) => p,
+        Err(_) => return false,
+    };
+
+    *unsafe { &mut *cv } = sapling_value_commitment(value, &rcv);
+
+    proof
+        .write(&mut (unsafe { &mut *zkproof })[..])
+        .expect("should be able to serialize a proof");
+
+    let rk = redjubjub::PublicKey(proof_generation_key.ak.into())
+        .randomize(ar, SPENDING_KEY_GENERATOR);
+    rk.write(&mut unsafe { &mut *rk_out }[..])
+        .expect("should be able to write to rk_out");
+
+    true
+}
+
+/// This function constructs an Output proof like
+/// [`librustzcash_sapling_output_proof`], but without a proving context.
+/// The caller chooses the value commitment randomness `rcv` and passes it
+/// on to [`librustzcash_sapling_binding_sig_rcv`].
+#[no_mangle]
+pub extern "C" fn librustzcash_sapling_output_proof_rcv(
+    esk: *const [c_uchar; 32],
+    payment_address: *const [c_uchar; 43],
+    rcm: *const [c_uchar; 32],
+    rcv: *const [c_uchar; 32],
+    value: u64,
+    cv: *mut [c_uchar; 32],
+    zkproof: *mut [c_uchar; GROTH_PROOF_SIZE],
+) -> bool {
+    let esk = match de_ct(jubjub::Scalar::from_bytes(unsafe { &*esk })) {
+        Some(p) => p,
+        None => return false,
+    };
+
+    let payment_address = match PaymentAddress::from_bytes(unsafe { &*payment_address }) {
+        Some(pa) => pa,
+        None => return false,
+    };
+
+    let rcm = match de_ct(jubjub::Scalar::from_bytes(unsafe { &*rcm })) {
+        Some(p) => p,
+        None => return false,
+    };
+
+    let rcv = match de_ct(jubjub::Scalar::from_bytes(unsafe { &*rcv })) {
+        Some(p) => p,
+        None => return false,
+    };
+
+    let instance = OutputCircuit {
+        value_commitment_opening: Some(ValueCommitmentOpening {
+            value,
+            randomness: rcv,
+        }),
+        payment_address: Some(payment_address),
+        commitment_randomness: Some(rcm),
+        esk: Some(esk),
+    };
+
+    let proof = match groth16::create_random_proof(
+        instance,
+        unsafe { SAPLING_OUTPUT_PARAMS.as_ref() }.unwrap(),
+        &mut OsRng,
+    ) {
+        Ok(p) => p,
+        Err(_) => return false,
+    };
+
+    *unsafe { &mut *cv } = sapling_value_commitment(value, &rcv);
+
+    proof
+        .write(&mut (unsafe { &mut *zkproof })[..])
+        .expect("should be able to serialize a proof");
+
+    true
+}
+
+/// This function constructs the binding signature for proofs created with
+/// [`librustzcash_sapling_spend_proof_rcv`] and
+/// [`librustzcash_sapling_output_proof_rcv`], given the `rcv` of every Spend
+/// and every Output in transaction order.
+#[no_mangle]
+pub extern "C" fn librustzcash_sapling_binding_sig_rcv(
+    spend_rcv: *const [c_uchar; 32],
+    spend_rcv_len: size_t,
+    output_rcv: *const [c_uchar; 32],
+    output_rcv_len: size_t,
+    sighash: *const [c_uchar; 32],
+    result: *mut [c_uchar; 64],
+) -> bool {
+    let spend_rcv = if spend_rcv_len == 0 {
+        &[][..]
+    } else {
+        unsafe { slice::from_raw_parts(spend_rcv, spend_rcv_len) }
+    };
+    let output_rcv = if output_rcv_len == 0 {
+        &[][..]
+    } else {
+        unsafe { slice::from_raw_parts(output_rcv, output_rcv_len) }
+    };
+
+    // bsk is the Spend randomness minus the Output randomness, as a proving
+    // context would have accumulated it
+    let mut bsk = jubjub::Fr::from(0u64);
+    for rcv in spend_rcv {
+        match de_ct(jubjub::Scalar::from_bytes(rcv)) {
+            Some(p) => bsk += p,
+            None => return false,
+        }
+    }
+    for rcv in output_rcv {
+        match de_ct(jubjub::Scalar::from_bytes(rcv)) {
+            Some(p) => bsk -= p,
+            None => return false,
+        }
+    }
+
+    let bsk = redjubjub::PrivateKey(bsk);
+    let bvk = redjubjub::PublicKey::from_private(&bsk, VALUE_COMMITMENT_RANDOMNESS_GENERATOR);
+
+    let mut data_to_be_signed = [0u8; 64];
+    data_to_be_signed[0..32].copy_from_slice(&bvk.0.to_bytes());
+    data_to_be_signed[32..64].copy_from_slice(&(unsafe { &*sighash })[..]);
+
+    let sig = bsk.sign(
+        &data_to_be_signed,
+        &mut OsRng,
+        VALUE_COMMITMENT_RANDOMNESS_GENERATOR,
+    );
+
+    sig.write(&mut (unsafe { &mut *result })[..])
+        .expect("result should be 64 bytes");
+
+    true
+}
+
 /// Creates a Sapling proving context. Please free this when you're done.
 #[no_mangle]
 pub extern "C" fn librustzcash_sapling_proving_ctx_init() -> *mut SaplingProvingContext {
@@ -25,7 +25,15 @@
 
 #include <vector>
 
+// DoS prevention: limit cache size to 32MB (over 1000000 entries on 64-bit
+// systems). Due to how we count cache size, actual memory usage is slightly
+// more (~32.25 MB)
+static const unsigned int DEFAULT_MAX_SIG_CACHE_SIZE = 32;
+// Maximum sig cache size allowed
+static const int64_t MAX_MAX_SIG_CACHE_SIZE = 16384;
+
 class CPubKey;
+class uint256;
 
 class CachingTransactionSignatureChecker : public TransactionSignatureChecker
 {
@@ -38,4 +46,10 @@ public:
     bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
 };
 
+void InitSignatureCache();
+
+/** Look up a signature in the shared cache, computing its cache entry. A hit is erased when erase is set. */
+bool GetCachedSignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash, bool erase, uint256& entry);
+void SetCachedSignature(const uint256& entry);
+
 #endif // BITCOIN_SCRIPT_SIGCACHE_H
@@ -4,12 +4,21 @@
 #include "gtest/gtest.h"
 #include "crypto/common.h"
 #include "testutils.h"
+#include "script/sigcache.h"
+#include <rust/bridge.h>
+#include "librustzcash.h"
 
 
 int main(int argc, char **argv) {
     assert(init_and_check_sodium() != -1);
     ECC_Start();
     ECCVerifyHandle handle;  // Inits secp256k1 verify context
+    InitSignatureCache();
+    // Block and mempool validation in the tests go through
+    // ContextualCheckTransactionMultithreaded, which needs the bundle cache
+    bundlecache::init(1 << 20);
+    // The Sapling parameters are built in, Sprout proving is never used here
+    librustzcash_init_zksnark_params(nullptr, 0, true);
     SetupNetworking();
     SelectParams(CBaseChainParams::REGTEST);
     chainName = assetchain(); // KMD by default
@@ -4,6 +4,7 @@
 #include "consensus/validation.h"
 #include "coincontrol.h"
 #include "miner.h"
+#include "txdb.h"
 
 #include <thread>
 #include <gtest/gtest.h>
@@ -237,4 +238,47 @@ TEST(test_block, TestProcessBadBlock)
     EXPECT_EQ(state.GetRejectReason(), "bad-txnmrklroot");
     // Verify transaction is still in mempool
     EXPECT_EQ(mempool.size(), 1);
-}
\ No newline at end of file
+}
+TEST(test_block, TestBlockValidityWritesNoCoinSupply)
+{
+    TestChain chain;
+    auto notary = std::make_shared<TestWallet>(chain.getNotaryKey(), "notary");
+    std::shared_ptr<CBlock> lastBlock = chain.generateBlock(notary); // gives notary everything
+    EXPECT_EQ(chain.GetIndex()->nHeight, 1);
+    chain.IncrementChainTime();
+    // connecting a block extends the running supply totals
+    CCoinSupplyIndexValue supply;
+    EXPECT_TRUE( pblocktree->ReadCoinSupply(1, supply) );
+    EXPECT_EQ( supply.hashBlock, lastBlock->GetHash() );
+    // construct the next block
+    CBlock block;
+    int32_t newHeight = chain.GetIndex()->nHeight + 1;
+    auto consensusParams = Params().GetConsensus();
+    CMutableTransaction txNew = CreateNewContextualCMutableTransaction(consensusParams, newHeight);
+    txNew.vin.resize(1);
+    txNew.vin[0].prevout.SetNull();
+    txNew.vin[0].scriptSig = (CScript() << newHeight << CScriptNum(1)) + COINBASE_FLAGS;
+    txNew.vout.resize(1);
+    txNew.vout[0].nValue = GetBlockSubsidy(newHeight,consensusParams);
+    txNew.nExpiryHeight = 0;
+    block.vtx.push_back(CTransaction(txNew));
+    block.nBits = GetNextWorkRequired( chain.GetIndex(), &block, Params().GetConsensus());
+    block.nTime = GetTime();
+    block.hashPrevBlock = lastBlock->GetHash();
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    EXPECT_TRUE(CalcPoW(&block));
+    // checking the block connects it with fJustCheck, nothing may be persisted
+    CValidationState state;
+    {
+        LOCK(cs_main);
+        EXPECT_TRUE( TestBlockValidity(state, block, chain.GetIndex(), true, true) );
+    }
+    if (!state.IsValid())
+        FAIL() << state.GetRejectReason();
+    EXPECT_FALSE( pblocktree->ReadCoinSupply(newHeight, supply) );
+    // connecting it for real writes the record
+    EXPECT_TRUE( ProcessNewBlock(false, newHeight, state, nullptr, &block, false, nullptr) );
+    EXPECT_EQ(chain.GetIndex()->nHeight, newHeight);
+    EXPECT_TRUE( pblocktree->ReadCoinSupply(newHeight, supply) );
+    EXPECT_EQ( supply.hashBlock, block.GetHash() );
+}
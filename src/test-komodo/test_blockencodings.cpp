@@ -0,0 +1,216 @@
+#include "blockencodings.h"
+#include "consensus/upgrades.h"
+#include "hash.h"
+#include "primitives/block.h"
+#include "random.h"
+#include "streams.h"
+#include "txmempool.h"
+#include "version.h"
+
+#include <gtest/gtest.h>
+
+namespace TestBlockEncodings {
+
+    /** Exposes the short ids and prefilled transactions so tests can corrupt them */
+    class TestHeaderAndShortIDs : public CBlockHeaderAndShortTxIDs {
+    public:
+        explicit TestHeaderAndShortIDs(const CBlock& block) : CBlockHeaderAndShortTxIDs(block) {}
+        std::vector<uint64_t>& ShortTxIDs() { return shorttxids; }
+        std::vector<PrefilledTransaction>& PrefilledTxn() { return prefilledtxn; }
+    };
+
+    CTransaction MakeTx(uint32_t n)
+    {
+        CMutableTransaction mtx;
+        mtx.vin.resize(1);
+        mtx.vin[0].prevout.hash = GetRandHash();
+        mtx.vin[0].prevout.n = n;
+        mtx.vin[0].scriptSig << OP_1;
+        mtx.vout.resize(1);
+        mtx.vout[0].nValue = 1000 + n;
+        mtx.vout[0].scriptPubKey << OP_TRUE;
+        return CTransaction(mtx);
+    }
+
+    /** A block with a coinbase and nTx - 1 other transactions */
+    CBlock MakeBlock(size_t nTx)
+    {
+        CBlock block;
+        CMutableTransaction coinbase;
+        coinbase.vin.resize(1);
+        coinbase.vin[0].prevout.SetNull();
+        coinbase.vin[0].scriptSig << 42 << OP_0;
+        coinbase.vout.resize(1);
+        coinbase.vout[0].nValue = 10000;
+        coinbase.vout[0].scriptPubKey << OP_TRUE;
+        block.vtx.push_back(CTransaction(coinbase));
+        for (size_t i = 1; i < nTx; i++)
+            block.vtx.push_back(MakeTx(i));
+        block.nVersion = 4;
+        block.hashPrevBlock = GetRandHash();
+        block.nBits = 0x200f0f0f;
+        block.nTime = 1600000000;
+        bool mutated;
+        block.hashMerkleRoot = block.BuildMerkleTree(&mutated);
+        return block;
+    }
+
+    void AddToPool(CTxMemPool& pool, const CTransaction& tx)
+    {
+        CTxMemPoolEntry entry(tx, 0, 0, 0.0, 1, true, false, SPROUT_BRANCH_ID);
+        pool.addUnchecked(tx.GetHash(), entry, false);
+    }
+
+    template<typename T>
+    T RoundTrip(const T& in)
+    {
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << in;
+        T out;
+        ss >> out;
+        EXPECT_TRUE(ss.empty());
+        return out;
+    }
+
+    TEST(TestBlockEncodings, siphash)
+    {
+        // SipHash-2-4 reference vectors for the key 00 01 .. 0f, fed incrementally
+        CSipHasher hasher(0x0706050403020100ULL, 0x0F0E0D0C0B0A0908ULL);
+        EXPECT_EQ(hasher.Finalize(), 0x726fdb47dd0e0e31ull);
+        static const unsigned char t0[1] = {0};
+        hasher.Write(t0, 1);
+        EXPECT_EQ(hasher.Finalize(), 0x74f839c593dc67fdull);
+        static const unsigned char t1[7] = {1, 2, 3, 4, 5, 6, 7};
+        hasher.Write(t1, 7);
+        EXPECT_EQ(hasher.Finalize(), 0x93f5f5799a932462ull);
+        hasher.Write(0x0F0E0D0C0B0A0908ULL);
+        EXPECT_EQ(hasher.Finalize(), 0x3f2acc7f57c29bdbull);
+        static const unsigned char t2[2] = {16, 17};
+        hasher.Write(t2, 2);
+        EXPECT_EQ(hasher.Finalize(), 0x4bc1b3f0968dd39cull);
+        static const unsigned char t3[9] = {18, 19, 20, 21, 22, 23, 24, 25, 26};
+        hasher.Write(t3, 9);
+        EXPECT_EQ(hasher.Finalize(), 0x2f2e6163076bcfadull);
+        static const unsigned char t4[5] = {27, 28, 29, 30, 31};
+        hasher.Write(t4, 5);
+        EXPECT_EQ(hasher.Finalize(), 0x7127512f72f27cceull);
+        hasher.Write(0x2726252423222120ULL);
+        EXPECT_EQ(hasher.Finalize(), 0x0e3ea96b5304a7d0ull);
+        hasher.Write(0x2F2E2D2C2B2A2928ULL);
+        EXPECT_EQ(hasher.Finalize(), 0xe612a3cb9ecba951ull);
+
+        // The uint256 specialization matches the generic hasher on the same 32 bytes
+        EXPECT_EQ(SipHashUint256(0x0706050403020100ULL, 0x0F0E0D0C0B0A0908ULL,
+                                 uint256S("1f1e1d1c1b1a191817161514131211100f0e0d0c0b0a09080706050403020100")),
+                  0x7127512f72f27cceull);
+        for (int i = 0; i < 16; i++) {
+            uint256 x = GetRandHash();
+            uint64_t k0 = GetRand(std::numeric_limits<uint64_t>::max());
+            uint64_t k1 = GetRand(std::numeric_limits<uint64_t>::max());
+            EXPECT_EQ(SipHashUint256(k0, k1, x), CSipHasher(k0, k1).Write(x.begin(), 32).Finalize());
+        }
+    }
+
+    TEST(TestBlockEncodings, reconstruct_from_mempool_and_blocktxn)
+    {
+        CBlock block = MakeBlock(6);
+        CTxMemPool pool(CFeeRate(0));
+        // Transactions 2 and 4 are missing from the mempool
+        AddToPool(pool, block.vtx[1]);
+        AddToPool(pool, block.vtx[3]);
+        AddToPool(pool, block.vtx[5]);
+        AddToPool(pool, MakeTx(100));
+
+        CBlockHeaderAndShortTxIDs cmpctblock = RoundTrip(CBlockHeaderAndShortTxIDs(block));
+        EXPECT_EQ(cmpctblock.BlockTxCount(), block.vtx.size());
+
+        PartiallyDownloadedBlock partialBlock(&pool);
+        ASSERT_EQ(partialBlock.InitData(cmpctblock), READ_STATUS_OK);
+
+        BlockTransactionsRequest req;
+        req.blockhash = block.GetHash();
+        for (size_t i = 0; i < cmpctblock.BlockTxCount(); i++) {
+            if (!partialBlock.IsTxAvailable(i))
+                req.indexes.push_back(i);
+        }
+        ASSERT_EQ(req.indexes, std::vector<uint16_t>({2, 4}));
+
+        BlockTransactionsRequest req2 = RoundTrip(req);
+        EXPECT_EQ(req2.blockhash, req.blockhash);
+        EXPECT_EQ(req2.indexes, req.indexes);
+
+        BlockTransactions resp(req2);
+        for (size_t i = 0; i < req2.indexes.size(); i++)
+            resp.txn[i] = block.vtx[req2.indexes[i]];
+        BlockTransactions resp2 = RoundTrip(resp);
+
+        CBlock reconstructed;
+        ASSERT_EQ(partialBlock.FillBlock(reconstructed, resp2.txn), READ_STATUS_OK);
+        EXPECT_EQ(reconstructed.GetHash(), block.GetHash());
+        ASSERT_EQ(reconstructed.vtx.size(), block.vtx.size());
+        for (size_t i = 0; i < block.vtx.size(); i++)
+            EXPECT_EQ(reconstructed.vtx[i].GetHash(), block.vtx[i].GetHash());
+
+        // Wrong transactions fail the merkle check, a wrong count is invalid
+        std::vector<CTransaction> vWrong = resp2.txn;
+        vWrong[1] = MakeTx(200);
+        EXPECT_EQ(partialBlock.FillBlock(reconstructed, vWrong), READ_STATUS_FAILED);
+        vWrong.pop_back();
+        EXPECT_EQ(partialBlock.FillBlock(reconstructed, vWrong), READ_STATUS_INVALID);
+    }
+
+    TEST(TestBlockEncodings, shortid_collision)
+    {
+        CBlock block = MakeBlock(5);
+        CTxMemPool pool(CFeeRate(0));
+        for (size_t i = 1; i < block.vtx.size(); i++)
+            AddToPool(pool, block.vtx[i]);
+
+        // Transactions 1 and 2 share a short id, so neither can be taken from
+        // the mempool; both are requested and the rest still come from it.
+        TestHeaderAndShortIDs cmpctblock(block);
+        cmpctblock.ShortTxIDs()[1] = cmpctblock.ShortTxIDs()[0];
+
+        PartiallyDownloadedBlock partialBlock(&pool);
+        ASSERT_EQ(partialBlock.InitData(cmpctblock), READ_STATUS_OK);
+        EXPECT_TRUE(partialBlock.IsTxAvailable(0));
+        EXPECT_FALSE(partialBlock.IsTxAvailable(1));
+        EXPECT_FALSE(partialBlock.IsTxAvailable(2));
+        EXPECT_TRUE(partialBlock.IsTxAvailable(3));
+        EXPECT_TRUE(partialBlock.IsTxAvailable(4));
+
+        CBlock reconstructed;
+        std::vector<CTransaction> vMissing = {block.vtx[1], block.vtx[2]};
+        ASSERT_EQ(partialBlock.FillBlock(reconstructed, vMissing), READ_STATUS_OK);
+        EXPECT_EQ(reconstructed.GetHash(), block.GetHash());
+    }
+
+    TEST(TestBlockEncodings, malformed_prefilled_index)
+    {
+        CBlock block = MakeBlock(4);
+        CTxMemPool pool(CFeeRate(0));
+
+        // The coinbase placed past the end of the block
+        TestHeaderAndShortIDs pastEnd(block);
+        pastEnd.PrefilledTxn()[0].index = block.vtx.size();
+        PartiallyDownloadedBlock partialPastEnd(&pool);
+        EXPECT_EQ(partialPastEnd.InitData(pastEnd), READ_STATUS_INVALID);
+
+        // A second prefilled transaction whose differential index overflows 16 bits
+        TestHeaderAndShortIDs overflow(block);
+        PrefilledTransaction prefilled;
+        prefilled.index = std::numeric_limits<uint16_t>::max();
+        prefilled.tx = block.vtx[1];
+        overflow.PrefilledTxn().push_back(prefilled);
+        PartiallyDownloadedBlock partialOverflow(&pool);
+        EXPECT_EQ(partialOverflow.InitData(overflow), READ_STATUS_INVALID);
+
+        // An index that does not fit in 16 bits is rejected while deserializing
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        WriteCompactSize(ss, uint64_t(std::numeric_limits<uint16_t>::max()) + 1);
+        ss << block.vtx[0];
+        PrefilledTransaction decoded;
+        EXPECT_THROW(ss >> decoded, std::ios_base::failure);
+    }
+
+}
@@ -0,0 +1,162 @@
+#include "bloom.h"
+#include "coins.h"
+#include "random.h"
+#include "txdb.h"
+#include "uint256.h"
+#include "util.h"
+
+#include <gtest/gtest.h>
+#include <boost/filesystem.hpp>
+
+namespace TestBloom {
+
+    TEST(TestBloom, scalable_bloom)
+    {
+        // Start small so the inserts below add several layers
+        CScalableBloomFilter sbf(100, 0.01);
+        static const int DATASIZE = 5000;
+        std::vector<uint256> data(DATASIZE);
+        for (int i = 0; i < DATASIZE; i++) {
+            data[i] = GetRandHash();
+            sbf.insert(data[i]);
+            // Nothing inserted so far may be lost while layers are added
+            if (i % 500 == 0) {
+                for (int j = 0; j <= i; j++)
+                    ASSERT_TRUE(sbf.contains(data[j])) << j << " lost after " << i << " inserts";
+            }
+        }
+        for (int i = 0; i < DATASIZE; i++)
+            ASSERT_TRUE(sbf.contains(data[i])) << i;
+        EXPECT_LE(sbf.size(), (uint64_t)DATASIZE);
+        EXPECT_GT(sbf.size(), (uint64_t)DATASIZE * 9 / 10);
+
+        // The combined false positive rate approaches its 2 * 1% bound after
+        // this many layers, so expect about 200 hits
+        unsigned int nHits = 0;
+        for (int i = 0; i < 10000; i++) {
+            if (sbf.contains(GetRandHash()))
+                ++nHits;
+        }
+        EXPECT_LT(nHits, 300U);
+
+        sbf.clear();
+        EXPECT_EQ(sbf.size(), 0U);
+        EXPECT_FALSE(sbf.contains(data[0]));
+        sbf.insert(data[0]);
+        EXPECT_TRUE(sbf.contains(data[0]));
+    }
+
+    /** Exposes the nullifier filters of an in-memory CCoinsViewDB */
+    class CNullifierFilterTestDB : public CCoinsViewDB
+    {
+    public:
+        CNullifierFilterTestDB() : CCoinsViewDB(1 << 20, true) {}
+
+        void ClearFilters()
+        {
+            LOCK(cs_nullifierFilters);
+            sproutNullifierFilter.clear();
+            saplingNullifierFilter.clear();
+        }
+
+        using CCoinsViewDB::LoadNullifierFilters;
+
+        bool WriteNullifiers(const std::vector<uint256>& vSprout, const std::vector<uint256>& vSapling, bool fSpent)
+        {
+            CCoinsMap mapCoins;
+            CAnchorsSproutMap mapSproutAnchors;
+            CAnchorsSaplingMap mapSaplingAnchors;
+            CAnchorsSaplingFrontierMap mapSaplingFrontierAnchors;
+            CNullifiersMap mapSproutNullifiers, mapSaplingNullifiers;
+            CProofHashMap mapZkOutputProofHash, mapZkSpendProofHash;
+            for (const uint256& nf : vSprout) {
+                mapSproutNullifiers[nf].entered = fSpent;
+                mapSproutNullifiers[nf].flags = CNullifiersCacheEntry::DIRTY;
+            }
+            for (const uint256& nf : vSapling) {
+                mapSaplingNullifiers[nf].entered = fSpent;
+                mapSaplingNullifiers[nf].flags = CNullifiersCacheEntry::DIRTY;
+            }
+            return BatchWrite(mapCoins, uint256(), uint256(), uint256(), uint256(),
+                              mapSproutAnchors, mapSaplingAnchors, mapSaplingFrontierAnchors,
+                              mapSproutNullifiers, mapSaplingNullifiers,
+                              mapZkOutputProofHash, mapZkSpendProofHash);
+        }
+    };
+
+    /** Points -datadir at a scratch directory for the in-memory coins database */
+    class TestNullifierFilter : public ::testing::Test {
+    protected:
+        boost::filesystem::path pathTemp;
+        std::string datadirOld;
+
+        virtual void SetUp()
+        {
+            if (mapArgs.count("-datadir"))
+                datadirOld = mapArgs["-datadir"];
+            pathTemp = GetTempPath() / strprintf("test_komodo_bloom_%lu_%i", (unsigned long)GetTime(), (int)GetRand(100000));
+            boost::filesystem::create_directories(pathTemp);
+            mapArgs["-datadir"] = pathTemp.string();
+            ClearDatadirCache();
+        }
+
+        virtual void TearDown()
+        {
+            if (datadirOld.empty())
+                mapArgs.erase("-datadir");
+            else
+                mapArgs["-datadir"] = datadirOld;
+            ClearDatadirCache();
+            boost::filesystem::remove_all(pathTemp);
+        }
+    };
+
+    TEST_F(TestNullifierFilter, erase)
+    {
+        CNullifierFilterTestDB db;
+        std::vector<uint256> vSprout(1, GetRandHash()), vSapling(1, GetRandHash());
+
+        ASSERT_TRUE(db.WriteNullifiers(vSprout, vSapling, true));
+        EXPECT_TRUE(db.GetNullifier(vSprout[0], SPROUT));
+        EXPECT_TRUE(db.GetNullifier(vSapling[0], SAPLING));
+        EXPECT_FALSE(db.GetNullifier(vSapling[0], SPROUT));
+
+        // An erased nullifier stays in the filter, the database read decides
+        ASSERT_TRUE(db.WriteNullifiers(vSprout, vSapling, false));
+        EXPECT_FALSE(db.GetNullifier(vSprout[0], SPROUT));
+        EXPECT_FALSE(db.GetNullifier(vSapling[0], SAPLING));
+
+        // and spending it again after a reorg is seen at once
+        ASSERT_TRUE(db.WriteNullifiers(vSprout, vSapling, true));
+        EXPECT_TRUE(db.GetNullifier(vSprout[0], SPROUT));
+        EXPECT_TRUE(db.GetNullifier(vSapling[0], SAPLING));
+    }
+
+    TEST_F(TestNullifierFilter, load)
+    {
+        CNullifierFilterTestDB db;
+        std::vector<uint256> vSprout, vSapling;
+        for (int i = 0; i < 200; i++) {
+            vSprout.push_back(GetRandHash());
+            vSapling.push_back(GetRandHash());
+        }
+        ASSERT_TRUE(db.WriteNullifiers(vSprout, vSapling, true));
+        std::vector<uint256> vErased(1, vSapling.back());
+        vSapling.pop_back();
+        ASSERT_TRUE(db.WriteNullifiers(std::vector<uint256>(), vErased, false));
+
+        // With empty filters the database is never asked
+        db.ClearFilters();
+        EXPECT_FALSE(db.GetNullifier(vSprout[0], SPROUT));
+        EXPECT_FALSE(db.GetNullifier(vSapling[0], SAPLING));
+
+        // The filters must never miss a nullifier that is in the database
+        db.LoadNullifierFilters();
+        for (const uint256& nf : vSprout)
+            EXPECT_TRUE(db.GetNullifier(nf, SPROUT));
+        for (const uint256& nf : vSapling)
+            EXPECT_TRUE(db.GetNullifier(nf, SAPLING));
+        EXPECT_FALSE(db.GetNullifier(vErased[0], SAPLING));
+    }
+
+}
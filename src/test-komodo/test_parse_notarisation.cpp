@@ -14,6 +14,7 @@
 
 #include <boost/filesystem.hpp>
 #include <fstream>
+#include <random>
 
 // todo remove
 /*komodo_state *komodo_stateptr(char *symbol,char *dest);
@@ -91,7 +92,23 @@ class komodo_state_accessor : public komodo_state
 public:
     void clear_npoints()
     {
-        NPOINTS.clear();
+        clear_checkpoints();
+    }
+    /***
+     * The linear scan CheckpointAtHeight did before the checkpoints were indexed by height
+     */
+    const notarized_checkpoint *scan_checkpoints(int32_t height)
+    {
+        for(auto itr = NPOINTS.rbegin(); itr != NPOINTS.rend(); ++itr)
+        {
+            if ( itr->MoMdepth != 0
+                    && height > itr->notarized_height-(itr->MoMdepth&0xffff) // 2s compliment if negative
+                    && height <= itr->notarized_height )
+            {
+                return &(*itr);
+            }
+        }
+        return nullptr;
     }
     const notarized_checkpoint *last_checkpoint()
     {
@@ -413,6 +430,50 @@ TEST(TestParseNotarisation, test_npptr)
     clear_npoints(sp);
 }
 
+TEST(TestParseNotarisation, test_checkpoint_at_height)
+{
+    komodo_state_accessor state;
+    std::mt19937 rng(17);
+
+    // checkpoints arrive in any order, with overlapping, empty and high bit MoM depths
+    for(int i = 0; i < 500; i++)
+    {
+        notarized_checkpoint cp;
+        cp.nHeight = i + 1;
+        cp.notarized_height = rng() % 1000;
+        cp.MoMdepth = rng() % 60;
+        if ( i % 7 == 0 )
+            cp.MoMdepth |= 0x10000;
+        state.AddCheckpoint(cp);
+
+        if ( i % 50 == 0 || i == 499 )
+        {
+            for(int32_t height = -2; height < 1010; height++)
+                ASSERT_EQ(state.scan_checkpoints(height), state.CheckpointAtHeight(height)) << "height " << height << " after " << i + 1 << " checkpoints";
+        }
+    }
+
+    // the index follows the state when it is copied
+    komodo_state_accessor copy = state;
+    for(int32_t height = -2; height < 1010; height++)
+    {
+        const notarized_checkpoint *expected = state.CheckpointAtHeight(height);
+        const notarized_checkpoint *found = copy.CheckpointAtHeight(height);
+        if ( expected == nullptr )
+            EXPECT_EQ(found, nullptr);
+        else
+        {
+            ASSERT_NE(found, nullptr);
+            EXPECT_EQ(*expected, *found);
+        }
+    }
+
+    // and is emptied with the checkpoints
+    state.clear_npoints();
+    for(int32_t height = -2; height < 1010; height++)
+        EXPECT_EQ(state.CheckpointAtHeight(height), nullptr);
+}
+
 TEST(TestParseNotarisation, test_prevMoMheight)
 {
     // get the komodo_state to play with
@@ -0,0 +1,244 @@
+#include "chainparams.h"
+#include "consensus/upgrades.h"
+#include "main.h"
+#include "testutils.h"
+#include "transaction_builder.h"
+#include "wallet/wallet.h"
+#include "wallet/walletdb.h"
+#include "zcash/Note.hpp"
+
+#include <gtest/gtest.h>
+
+namespace TestSaplingWallet {
+
+    // Decrypt every note in mapWallet and check the decrypted note index holds
+    // exactly the same notes, addresses and memos.
+    void ExpectSaplingNoteIndexMatchesFullScan(CWallet& wallet)
+    {
+        size_t nNotes = 0;
+        for (const auto& wtxItem : wallet.mapWallet) {
+            const CWalletTx& wtx = wtxItem.second;
+            for (const auto& item : wtx.mapSaplingNoteData) {
+                const SaplingOutPoint& op = item.first;
+                auto optPt = SaplingNotePlaintext::decrypt(
+                    Params().GetConsensus(),
+                    1,
+                    wtx.vShieldedOutput[op.n].encCiphertext,
+                    item.second.ivk,
+                    wtx.vShieldedOutput[op.n].ephemeralKey,
+                    wtx.vShieldedOutput[op.n].cmu);
+                ASSERT_TRUE(static_cast<bool>(optPt));
+                auto notePt = optPt.get();
+                auto pa = item.second.ivk.address(notePt.d).get();
+
+                auto it = wallet.mapSaplingNoteIndex.find(op);
+                ASSERT_TRUE(it != wallet.mapSaplingNoteIndex.end());
+                EXPECT_EQ(pa, it->second.address);
+                EXPECT_EQ(notePt.value(), it->second.note.value());
+                EXPECT_EQ(notePt.memo(), it->second.memo);
+                EXPECT_EQ(1, wallet.mapSaplingAddressNotes[pa].count(op));
+                nNotes++;
+            }
+        }
+        EXPECT_EQ(nNotes, wallet.mapSaplingNoteIndex.size());
+
+        size_t nAddressNotes = 0;
+        for (const auto& item : wallet.mapSaplingAddressNotes) {
+            nAddressNotes += item.second.size();
+        }
+        EXPECT_EQ(nNotes, nAddressNotes);
+    }
+
+    TEST(TestSaplingWallet, note_index_matches_full_scan)
+    {
+        TestChain chain;
+        UpdateNetworkUpgradeParameters(Consensus::UPGRADE_OVERWINTER, Consensus::NetworkUpgrade::ALWAYS_ACTIVE);
+        UpdateNetworkUpgradeParameters(Consensus::UPGRADE_SAPLING, Consensus::NetworkUpgrade::ALWAYS_ACTIVE);
+        auto consensusParams = Params().GetConsensus();
+
+        bool fFirstRun;
+        CWallet wallet("wallet-noteindex.dat");
+        ASSERT_EQ(DB_LOAD_OK, wallet.LoadWallet(fFirstRun));
+        LOCK2(cs_main, wallet.cs_wallet);
+
+        // Generate dummy Sapling address
+        std::vector<unsigned char, secure_allocator<unsigned char>> rawSeed(32);
+        HDSeed seed(rawSeed);
+        auto sk = libzcash::SaplingExtendedSpendingKey::Master(seed);
+        auto expsk = sk.expsk;
+        auto fvk = expsk.full_viewing_key();
+        auto pk = sk.DefaultAddress();
+        ASSERT_TRUE(wallet.AddSaplingZKey(sk));
+
+        // Generate dummy Sapling note
+        libzcash::SaplingNote note(pk, 50000, libzcash::Zip212Enabled::BeforeZip212);
+        SaplingMerkleTree tree;
+        tree.append(note.cmu().get());
+        auto anchor = tree.root();
+        auto path = tree.witness().path();
+
+        // Generate transaction with an output and change to the wallet
+        auto builder = TransactionBuilder(consensusParams, 1);
+        ASSERT_TRUE(builder.AddSaplingSpend(expsk, note, anchor, path));
+        builder.AddSaplingOutput(fvk.ovk, pk, 25000, {});
+        auto result = builder.Build();
+        ASSERT_TRUE(result.IsTx()) << result.GetError();
+        CTransaction tx = result.GetTxOrThrow();
+        uint256 hash = tx.GetHash();
+
+        // Add the transaction without note data, nothing is indexed
+        CWalletTx wtx {&wallet, tx};
+        wallet.AddToWallet(wtx, false, NULL, 0);
+        EXPECT_EQ(0, wallet.mapSaplingNoteIndex.size());
+        ExpectSaplingNoteIndexMatchesFullScan(wallet);
+
+        // Merge the note data into the existing transaction
+        CWalletTx wtxNotes {&wallet, tx};
+        auto saplingNoteData = wallet.FindMySaplingNotes({tx}, 1).first;
+        ASSERT_EQ(2, saplingNoteData.size());
+        wtxNotes.SetSaplingNoteData(saplingNoteData);
+        wallet.AddToWallet(wtxNotes, false, NULL, 0);
+        EXPECT_EQ(2, wallet.mapSaplingNoteIndex.size());
+        ExpectSaplingNoteIndexMatchesFullScan(wallet);
+
+        // Merge a transaction holding only one of the notes
+        CWalletTx wtxOneNote {&wallet, tx};
+        mapSaplingNoteData_t oneNote;
+        oneNote.insert(*saplingNoteData.begin());
+        wtxOneNote.SetSaplingNoteData(oneNote);
+        wallet.AddToWallet(wtxOneNote, false, NULL, 0);
+        EXPECT_EQ(1, wallet.mapSaplingNoteIndex.size());
+        ExpectSaplingNoteIndexMatchesFullScan(wallet);
+
+        // Erase the transaction, its notes leave the index
+        EXPECT_TRUE(wallet.EraseFromWallet(hash));
+        EXPECT_EQ(0, wallet.mapSaplingNoteIndex.size());
+        ExpectSaplingNoteIndexMatchesFullScan(wallet);
+
+        // Revert to default
+        UpdateNetworkUpgradeParameters(Consensus::UPGRADE_SAPLING, Consensus::NetworkUpgrade::NO_ACTIVATION_HEIGHT);
+        UpdateNetworkUpgradeParameters(Consensus::UPGRADE_OVERWINTER, Consensus::NetworkUpgrade::NO_ACTIVATION_HEIGHT);
+    }
+
+    class SaplingLogTestWallet : public CWallet {
+    public:
+        SaplingLogTestWallet(const std::string& strWalletFileIn) : CWallet(strWalletFileIn) { }
+
+        SaplingWallet& GetSaplingWallet() {
+            return saplingWallet;
+        }
+    };
+
+    class SaplingLogTestWalletDB : public CWalletDB {
+    public:
+        SaplingLogTestWalletDB(const std::string& strFilename) : CWalletDB(strFilename, "cr+") { }
+
+        bool HasSnapshot() {
+            return Exists(std::string("sapling_note_commitment_tree"));
+        }
+
+        bool HasLogRecord(uint32_t nSeq) {
+            return Exists(std::make_pair(std::string("sapling_tree_log"), nSeq));
+        }
+    };
+
+    // Write the Sapling tree the way SetBestChain does, a snapshot or the pending log record
+    bool WriteSaplingTree(const std::string& strWalletFile, SaplingWallet& saplingWallet)
+    {
+        bool fSnapshot = saplingWallet.SnapshotRequired();
+        if (!SaplingLogTestWalletDB(strWalletFile).WriteSaplingWitnesses(saplingWallet))
+            return false;
+        saplingWallet.MarkPersisted(fSnapshot);
+        return true;
+    }
+
+    TEST(TestSaplingWallet, log_append_replay_and_compact)
+    {
+        TestChain chain;
+        UpdateNetworkUpgradeParameters(Consensus::UPGRADE_OVERWINTER, Consensus::NetworkUpgrade::ALWAYS_ACTIVE);
+        UpdateNetworkUpgradeParameters(Consensus::UPGRADE_SAPLING, Consensus::NetworkUpgrade::ALWAYS_ACTIVE);
+        auto consensusParams = Params().GetConsensus();
+        std::string strWalletFile = "wallet-saplinglog.dat";
+
+        bool fFirstRun;
+        SaplingLogTestWallet wallet(strWalletFile);
+        ASSERT_EQ(DB_LOAD_OK, wallet.LoadWallet(fFirstRun));
+        SaplingWallet& saplingWallet = wallet.GetSaplingWallet();
+
+        // A fresh tree is always written as a snapshot
+        EXPECT_TRUE(saplingWallet.SnapshotRequired());
+        ASSERT_TRUE(WriteSaplingTree(strWalletFile, saplingWallet));
+        EXPECT_FALSE(saplingWallet.SnapshotRequired());
+        EXPECT_TRUE(SaplingLogTestWalletDB(strWalletFile).HasSnapshot());
+        EXPECT_FALSE(SaplingLogTestWalletDB(strWalletFile).HasLogRecord(0));
+
+        // Generate a transaction with Sapling outputs
+        auto sk = libzcash::SaplingSpendingKey::random();
+        auto expsk = sk.expanded_spending_key();
+        auto fvk = sk.full_viewing_key();
+        auto pk = sk.default_address();
+        libzcash::SaplingNote note(pk, 50000, libzcash::Zip212Enabled::BeforeZip212);
+        SaplingMerkleTree tree;
+        tree.append(note.cmu().get());
+        auto builder = TransactionBuilder(consensusParams, 1);
+        ASSERT_TRUE(builder.AddSaplingSpend(expsk, note, tree.root(), tree.witness().path()));
+        builder.AddSaplingOutput(fvk.ovk, pk, 25000, {});
+        auto tx = builder.Build().GetTxOrThrow();
+
+        // Appends are persisted as incremental records
+        ASSERT_TRUE(saplingWallet.AppendNoteCommitments(1, tx, 0));
+        ASSERT_TRUE(saplingWallet.CheckpointNoteCommitmentTree(1));
+        EXPECT_EQ(2, saplingWallet.GetPendingLog().size());
+        ASSERT_TRUE(WriteSaplingTree(strWalletFile, saplingWallet));
+        EXPECT_EQ(0, saplingWallet.GetPendingLog().size());
+        EXPECT_EQ(1, saplingWallet.GetLogRecordCount());
+
+        ASSERT_TRUE(saplingWallet.CheckpointNoteCommitmentTree(2));
+        ASSERT_TRUE(WriteSaplingTree(strWalletFile, saplingWallet));
+        EXPECT_EQ(2, saplingWallet.GetLogRecordCount());
+        EXPECT_TRUE(SaplingLogTestWalletDB(strWalletFile).HasLogRecord(0));
+        EXPECT_TRUE(SaplingLogTestWalletDB(strWalletFile).HasLogRecord(1));
+        uint256 anchor = saplingWallet.GetLatestAnchor();
+
+        // Crash before the next write, the unpersisted checkpoint is lost and
+        // the reloaded tree is the snapshot with both records replayed
+        ASSERT_TRUE(saplingWallet.CheckpointNoteCommitmentTree(3));
+        SaplingLogTestWallet walletReplayed(strWalletFile);
+        ASSERT_EQ(DB_LOAD_OK, walletReplayed.LoadWallet(fFirstRun));
+        SaplingWallet& saplingReplayed = walletReplayed.GetSaplingWallet();
+        EXPECT_EQ(2, saplingReplayed.GetLastCheckpointHeight());
+        EXPECT_EQ(anchor, saplingReplayed.GetLatestAnchor());
+        EXPECT_EQ(2, saplingReplayed.GetLogRecordCount());
+        EXPECT_FALSE(saplingReplayed.SnapshotRequired());
+
+        // Keep appending records until the tree is due for compaction
+        int nHeight = 2;
+        while (!saplingReplayed.SnapshotRequired()) {
+            ASSERT_TRUE(saplingReplayed.CheckpointNoteCommitmentTree(++nHeight));
+            ASSERT_TRUE(WriteSaplingTree(strWalletFile, saplingReplayed));
+        }
+        EXPECT_EQ(SAPLING_WALLET_LOG_COMPACT_INTERVAL, saplingReplayed.GetLogRecordCount());
+        EXPECT_TRUE(SaplingLogTestWalletDB(strWalletFile).HasLogRecord(SAPLING_WALLET_LOG_COMPACT_INTERVAL - 1));
+
+        // The snapshot erases every record it supersedes
+        ASSERT_TRUE(saplingReplayed.CheckpointNoteCommitmentTree(++nHeight));
+        ASSERT_TRUE(WriteSaplingTree(strWalletFile, saplingReplayed));
+        EXPECT_EQ(0, saplingReplayed.GetLogRecordCount());
+        EXPECT_TRUE(SaplingLogTestWalletDB(strWalletFile).HasSnapshot());
+        for (uint32_t i = 0; i < SAPLING_WALLET_LOG_COMPACT_INTERVAL; i++) {
+            EXPECT_FALSE(SaplingLogTestWalletDB(strWalletFile).HasLogRecord(i));
+        }
+
+        // The compacted snapshot loads on its own
+        SaplingLogTestWallet walletCompacted(strWalletFile);
+        ASSERT_EQ(DB_LOAD_OK, walletCompacted.LoadWallet(fFirstRun));
+        EXPECT_EQ(nHeight, walletCompacted.GetSaplingWallet().GetLastCheckpointHeight());
+        EXPECT_EQ(anchor, walletCompacted.GetSaplingWallet().GetLatestAnchor());
+        EXPECT_EQ(0, walletCompacted.GetSaplingWallet().GetLogRecordCount());
+
+        // Revert to default
+        UpdateNetworkUpgradeParameters(Consensus::UPGRADE_SAPLING, Consensus::NetworkUpgrade::NO_ACTIVATION_HEIGHT);
+        UpdateNetworkUpgradeParameters(Consensus::UPGRADE_OVERWINTER, Consensus::NetworkUpgrade::NO_ACTIVATION_HEIGHT);
+    }
+
+}
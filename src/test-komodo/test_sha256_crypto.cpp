@@ -1,5 +1,7 @@
 #include <gtest/gtest.h>
 #include "crypto/sha256.h"
+#include "hash.h"
+#include "primitives/block.h"
 #include "uint256.h"
 #include <stdexcept>
 #include "random.h"
@@ -155,4 +157,112 @@ namespace TestSHA256Crypto {
             "d7a8fbb307d7809469ca9abcb0082e4f8d5651e46d3cdb762d02d0bf37c9e592");
     }
 
-}
\ No newline at end of file
+    /** Reference merkle root: plain double-SHA256 of each pair, duplicating an odd last node. */
+    uint256 NaiveMerkleRoot(std::vector<uint256> level)
+    {
+        if (level.empty())
+            return uint256();
+        while (level.size() > 1) {
+            std::vector<uint256> next;
+            for (size_t i = 0; i < level.size(); i += 2) {
+                const uint256 &right = (i + 1 < level.size()) ? level[i + 1] : level[i];
+                uint256 node;
+                CHash256().Write(level[i].begin(), 32).Write(right.begin(), 32).Finalize(node.begin());
+                next.push_back(node);
+            }
+            level.swap(next);
+        }
+        return level[0];
+    }
+
+    uint256 InsecureRand256()
+    {
+        uint256 ret;
+        for (unsigned char *p = ret.begin(); p != ret.end(); ++p)
+            *p = (unsigned char)insecure_rand();
+        return ret;
+    }
+
+    TEST(TestSHA256Crypto, sha256d64)
+    {
+        // SHA256D64 dispatches to whatever SHA256AutoDetect() selected, so
+        // compare it against the generic double-SHA256 for every batch size
+        // the SSE4/AVX2/SHA-NI transforms split into.
+        std::string algo = SHA256AutoDetect();
+        ASSERT_FALSE(algo.empty());
+        std::cerr << log_tab << "Checking SHA256D64 with \"" << algo << "\" ..." << std::endl;
+
+        for (int blocks = 0; blocks <= 34; blocks++) {
+            std::vector<unsigned char> in(64 * blocks);
+            for (size_t i = 0; i < in.size(); i++)
+                in[i] = (unsigned char)insecure_rand();
+
+            std::vector<unsigned char> out(32 * blocks + 1, 0x5a);
+            SHA256D64(out.data(), in.data(), blocks);
+            // The byte past the last digest must be left untouched.
+            ASSERT_EQ(out[32 * blocks], 0x5a) << blocks;
+
+            for (int i = 0; i < blocks; i++) {
+                unsigned char expected[CHash256::OUTPUT_SIZE];
+                CHash256().Write(&in[64 * i], 64).Finalize(expected);
+                ASSERT_EQ(memcmp(expected, &out[32 * i], 32), 0) << "block " << i << " of " << blocks;
+            }
+        }
+    }
+
+    TEST(TestSHA256Crypto, merkle_root)
+    {
+        for (int nLeaves = 0; nLeaves <= 40; nLeaves++) {
+            std::vector<uint256> leaves;
+            for (int i = 0; i < nLeaves; i++)
+                leaves.push_back(InsecureRand256());
+
+            std::vector<uint256> vMerkleTree;
+            bool mutated = true;
+            uint256 root = BuildMerkleTree(&mutated, leaves, vMerkleTree);
+            ASSERT_EQ(root, NaiveMerkleRoot(leaves)) << nLeaves;
+            ASSERT_FALSE(mutated) << nLeaves;
+        }
+    }
+
+    TEST(TestSHA256Crypto, merkle_root_mutated)
+    {
+        // [1,2,3,4,5,6] and [1,2,3,4,5,6,5,6] share a root (CVE-2012-2459);
+        // only the duplicated list may be flagged as mutated.
+        std::vector<uint256> leaves;
+        for (int i = 0; i < 6; i++)
+            leaves.push_back(InsecureRand256());
+        std::vector<uint256> dup(leaves);
+        dup.push_back(leaves[4]);
+        dup.push_back(leaves[5]);
+
+        std::vector<uint256> vMerkleTree;
+        bool mutated = true;
+        uint256 root = BuildMerkleTree(&mutated, leaves, vMerkleTree);
+        ASSERT_FALSE(mutated);
+        uint256 rootDup = BuildMerkleTree(&mutated, dup, vMerkleTree);
+        ASSERT_TRUE(mutated);
+        ASSERT_EQ(root, rootDup);
+
+        // A duplicated last leaf on an even level is caught at the bottom.
+        std::vector<uint256> pair(leaves.begin(), leaves.begin() + 3);
+        pair.push_back(leaves[2]);
+        BuildMerkleTree(&mutated, pair, vMerkleTree);
+        ASSERT_TRUE(mutated);
+
+        // The same mutation through CBlock, built from distinct transactions.
+        CBlock block;
+        for (int i = 0; i < 6; i++) {
+            CMutableTransaction mtx;
+            mtx.nLockTime = i;
+            block.vtx.push_back(CTransaction(mtx));
+        }
+        uint256 blockRoot = block.BuildMerkleTree(&mutated);
+        ASSERT_FALSE(mutated);
+        block.vtx.push_back(block.vtx[4]);
+        block.vtx.push_back(block.vtx[5]);
+        ASSERT_EQ(block.BuildMerkleTree(&mutated), blockRoot);
+        ASSERT_TRUE(mutated);
+    }
+
+}
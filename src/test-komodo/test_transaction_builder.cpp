@@ -0,0 +1,92 @@
+#include "chainparams.h"
+#include "consensus/upgrades.h"
+#include "main.h"
+#include "script/interpreter.h"
+#include "transaction_builder.h"
+#include "zcash/Note.hpp"
+
+#include <gtest/gtest.h>
+
+namespace TestTransactionBuilder {
+
+    /** Run the Sapling proofs and signatures of tx through the bundle validator */
+    bool CheckSaplingBundle(const CTransaction& tx, int nHeight)
+    {
+        uint256 dataToBeSigned = SignatureHash(CScript(), tx, NOT_AN_INPUT, SIGHASH_ALL, 0,
+                                               CurrentEpochBranchId(nHeight, Params().GetConsensus()));
+        std::vector<const CTransaction*> vtx(1, &tx);
+        std::vector<uint256> vTxSig(1, dataToBeSigned);
+        return ContextualCheckTransactionSaplingBundleWorker(vtx, vTxSig, false, 0).validationPassed;
+    }
+
+    TEST(TestTransactionBuilder, parallel_proofs_match_sequential)
+    {
+        UpdateNetworkUpgradeParameters(Consensus::UPGRADE_OVERWINTER, Consensus::NetworkUpgrade::ALWAYS_ACTIVE);
+        UpdateNetworkUpgradeParameters(Consensus::UPGRADE_SAPLING, Consensus::NetworkUpgrade::ALWAYS_ACTIVE);
+        auto consensusParams = Params().GetConsensus();
+        int maxProcessingThreadsOld = maxProcessingThreads;
+
+        auto sk = libzcash::SaplingSpendingKey::random();
+        auto expsk = sk.expanded_spending_key();
+        auto fvk = sk.full_viewing_key();
+        auto pk = sk.default_address();
+
+        // Three notes in one tree, so every spend shares the anchor
+        std::vector<libzcash::SaplingNote> vNotes;
+        std::vector<SaplingWitness> vWitnesses;
+        SaplingMerkleTree tree;
+        for (int i = 0; i < 3; i++) {
+            vNotes.emplace_back(pk, 40000 + i, libzcash::Zip212Enabled::BeforeZip212);
+            uint256 cmu = vNotes.back().cmu().get();
+            tree.append(cmu);
+            for (auto& witness : vWitnesses)
+                witness.append(cmu);
+            vWitnesses.push_back(tree.witness());
+        }
+
+        // Spends, outputs and a change output are proved together
+        auto builder = TransactionBuilder(consensusParams, 1);
+        for (int i = 0; i < 3; i++)
+            ASSERT_TRUE(builder.AddSaplingSpend(expsk, vNotes[i], tree.root(), vWitnesses[i].path()));
+        builder.AddSaplingOutput(fvk.ovk, pk, 30000, {});
+        builder.AddSaplingOutput(fvk.ovk, pk, 20000, {});
+
+        maxProcessingThreads = 1;
+        auto sequential = builder;
+        auto resultSequential = sequential.Build();
+        maxProcessingThreads = 4;
+        auto parallel = builder;
+        auto resultParallel = parallel.Build();
+        maxProcessingThreads = maxProcessingThreadsOld;
+
+        ASSERT_TRUE(resultSequential.IsTx()) << resultSequential.GetError();
+        ASSERT_TRUE(resultParallel.IsTx()) << resultParallel.GetError();
+        CTransaction txSequential = resultSequential.GetTxOrThrow();
+        CTransaction txParallel = resultParallel.GetTxOrThrow();
+
+        // Proofs and signatures are randomized, everything else must match
+        EXPECT_EQ(txParallel.valueBalance, txSequential.valueBalance);
+        ASSERT_EQ(txParallel.vShieldedSpend.size(), 3U);
+        ASSERT_EQ(txSequential.vShieldedSpend.size(), 3U);
+        for (int i = 0; i < 3; i++) {
+            EXPECT_EQ(txParallel.vShieldedSpend[i].nullifier, txSequential.vShieldedSpend[i].nullifier);
+            EXPECT_EQ(txParallel.vShieldedSpend[i].anchor, txSequential.vShieldedSpend[i].anchor);
+        }
+        ASSERT_EQ(txParallel.vShieldedOutput.size(), 3U);
+        ASSERT_EQ(txSequential.vShieldedOutput.size(), 3U);
+
+        // The binding signature made from the separate proofs must verify
+        EXPECT_TRUE(CheckSaplingBundle(txSequential, 1));
+        EXPECT_TRUE(CheckSaplingBundle(txParallel, 1));
+
+        // A tampered value balance no longer matches the binding signature
+        CMutableTransaction mtx(txParallel);
+        mtx.valueBalance += 1;
+        EXPECT_FALSE(CheckSaplingBundle(CTransaction(mtx), 1));
+
+        // Revert to default
+        UpdateNetworkUpgradeParameters(Consensus::UPGRADE_SAPLING, Consensus::NetworkUpgrade::NO_ACTIVATION_HEIGHT);
+        UpdateNetworkUpgradeParameters(Consensus::UPGRADE_OVERWINTER, Consensus::NetworkUpgrade::NO_ACTIVATION_HEIGHT);
+    }
+
+}
@@ -287,14 +287,24 @@ int TLSManager::waitFor(SSLConnectionRoutine eRoutine, SOCKET hSocket, SSL* ssl,
             break;
         }
 
+#ifdef USE_POLL
+        struct pollfd pfd = {};
+        pfd.fd = hSocket;
+        pfd.events = (sslErr == SSL_ERROR_WANT_READ) ? POLLIN : POLLOUT;
+#else
         fd_set socketSet;
         FD_ZERO(&socketSet);
         FD_SET(hSocket, &socketSet);
 
         struct timeval timeout = {timeoutSec, 0};
+#endif
 
         if (sslErr == SSL_ERROR_WANT_READ) {
+#ifdef USE_POLL
+            int result = poll(&pfd, 1, timeoutSec * 1000);
+#else
             int result = select(hSocket + 1, &socketSet, NULL, NULL, &timeout);
+#endif
             if (result == 0) {
                 LogPrint("tls", "TLS: ERROR: %s: %s():%d - WANT_READ timeout on %s\n", __FILE__, __func__, __LINE__,
                     (eRoutine == SSL_CONNECT ? "SSL_CONNECT" :
@@ -309,7 +319,11 @@ int TLSManager::waitFor(SSLConnectionRoutine eRoutine, SOCKET hSocket, SSL* ssl,
                 break;
             }
         } else {
+#ifdef USE_POLL
+            int result = poll(&pfd, 1, timeoutSec * 1000);
+#else
             int result = select(hSocket + 1, NULL, &socketSet, NULL, &timeout);
+#endif
             if (result == 0) {
                 LogPrint("tls", "TLS: ERROR: %s: %s():%d - WANT_WRITE timeout on %s\n", __FILE__, __func__, __LINE__,
                     (eRoutine == SSL_CONNECT ? "SSL_CONNECT" :
@@ -630,28 +644,25 @@ void TLSManager::cleanNonTLSPool(std::vector<NODE_ADDR>& vPool, CCriticalSection
 /**
  * @brief Handles send and recieve functionality in TLS Sockets.
  *
+ * When a read would block pnode->fRecvReady is cleared, and when queued data
+ * is left unsent pnode->fSendReady is cleared, for the edge-triggered loop.
+ *
  * @param pnode reference to the CNode object.
- * @param fdsetRecv
- * @param fdsetSend
- * @param fdsetError
+ * @param recvSet the socket is readable
+ * @param sendSet the socket is writable
+ * @param errorSet the socket has an error or hangup pending
  * @return int returns -1 when socket is invalid. returns 0 otherwise.
  */
-int TLSManager::threadSocketHandler(CNode* pnode, fd_set& fdsetRecv, fd_set& fdsetSend, fd_set& fdsetError)
+int TLSManager::threadSocketHandler(CNode* pnode, bool recvSet, bool sendSet, bool errorSet)
 {
     //
     // Receive
     //
-    bool recvSet = false, sendSet = false, errorSet = false;
-
     {
         LOCK(pnode->cs_hSocket);
 
         if (pnode->hSocket == INVALID_SOCKET)
             return -1;
-
-        recvSet = FD_ISSET(pnode->hSocket, &fdsetRecv);
-        sendSet = FD_ISSET(pnode->hSocket, &fdsetSend);
-        errorSet = FD_ISSET(pnode->hSocket, &fdsetError);
     }
 
     if (recvSet || errorSet) {
@@ -735,13 +746,17 @@ int TLSManager::threadSocketHandler(CNode* pnode, fd_set& fdsetRecv, fd_set& fds
                             LogPrint("tls", "TLS: WARNING: %s: %s():%d - SSL_read - code[0x%x], err: %s\n",
                                 __FILE__, __func__, __LINE__, nRet, error_str);
 
+                        } else if (nRet == SSL_ERROR_WANT_READ) {
+                            pnode->fRecvReady = false;
                         } else {
                             // preventive measure from exhausting CPU usage
                             //
                             MilliSleep(1); // 1 msec
                         }
                     } else {
-                        if (nRet != WSAEWOULDBLOCK && nRet != WSAEMSGSIZE && nRet != WSAEINTR && nRet != WSAEINPROGRESS) {
+                        if (nRet == WSAEWOULDBLOCK) {
+                            pnode->fRecvReady = false;
+                        } else if (nRet != WSAEMSGSIZE && nRet != WSAEINTR && nRet != WSAEINPROGRESS) {
                             if (!pnode->fDisconnect)
                                 LogPrint("tls","TSL: ERROR: socket recv %s\n", NetworkErrorString(nRet));
 
@@ -762,8 +777,11 @@ int TLSManager::threadSocketHandler(CNode* pnode, fd_set& fdsetRecv, fd_set& fds
     //
     if (sendSet) {
         TRY_LOCK(pnode->cs_vSend, lockSend);
-        if (lockSend)
+        if (lockSend) {
             SocketSendData(pnode);
+            if (!pnode->vSendMsg.empty())
+                pnode->fSendReady = false;
+        }
     }
     return 0;
 }
@@ -16,6 +16,9 @@
 #include <boost/variant.hpp>
 #include <librustzcash.h>
 
+#include <atomic>
+#include <future>
+
 
 SpendDescriptionInfo::SpendDescriptionInfo(
     libzcash::SaplingExpandedSpendingKey expsk,
@@ -27,7 +30,7 @@ SpendDescriptionInfo::SpendDescriptionInfo(
     //printf("SpendDescriptionInfo saplingMerklePath.position()=%lx\n", saplingMerklePath.position() );
 }
 
-boost::optional<OutputDescription> OutputDescriptionInfo::Build(void* ctx) {
+boost::optional<OutputDescription> OutputDescriptionInfo::Build(const uint256& rcv) {
     auto cmu = this->note.cmu();
     if (!cmu) {
         return boost::none;
@@ -49,11 +52,11 @@ boost::optional<OutputDescription> OutputDescriptionInfo::Build(void* ctx) {
 
     OutputDescription odesc;
     uint256 rcm = this->note.rcm();
-    if (!librustzcash_sapling_output_proof(
-            ctx,
+    if (!librustzcash_sapling_output_proof_rcv(
             encryptor.get_esk().begin(),
             addressBytes.data(),
             rcm.begin(),
+            rcv.begin(),
             this->note.value(),
             odesc.cv.begin(),
             odesc.zkproof.begin())) {
@@ -914,74 +917,106 @@ TransactionBuilderResult TransactionBuilder::Build()
     // Sapling spends and outputs
     //
 
-    auto ctx = librustzcash_sapling_proving_ctx_init();
-
-    // Create Sapling SpendDescriptions
-    //for (auto spend : spends)
-    for (size_t i = 0; i < spends.size(); i++)
-    {
-        auto spend = spends[i];
-        uint64_t      lMerklePathPosition = alMerklePathPosition[i];
-        myCharArray_s sMerkle         = asMerklePath[i];
-
-        // libzcash::diversifier_t d     = spend.note.d;
-        // uint256       pk_d            = spend.note.pk_d;
-        // uint256       rcm             = spend.note.rcm;
-        // uint64_t      value           = spend.note.value();
-        // libzcash::SaplingNote myNote (d, pk_d, value, r);
-
-        //printf("transaction_builder.cpp process spends-for()\n");
-        //auto cm = spend.note.cm();
-        //auto nf = spend.note.nullifier(spend.expsk.full_viewing_key(), lMerklePathPosition);
-        auto cmu = spend.note.cmu();
-        auto nf = spend.note.nullifier(spend.expsk.full_viewing_key(), lMerklePathPosition);
-        if (!(cmu && nf))
-        {
-            //printf("transaction_builder.cpp cm && nf error\n");
-            librustzcash_sapling_proving_ctx_free(ctx);
+    // Check the spends and outputs before any proof is made
+    std::vector<uint256> vNullifiers;
+    for (size_t i = 0; i < spends.size(); i++) {
+        auto cmu = spends[i].note.cmu();
+        auto nf = spends[i].note.nullifier(spends[i].expsk.full_viewing_key(), alMerklePathPosition[i]);
+        if (!(cmu && nf)) {
             return TransactionBuilderResult("Spend is invalid");
         }
-
-        std::vector<unsigned char> vMerkle ( &sMerkle.cArray[0], &sMerkle.cArray[0] +  sizeof(myCharArray_s) );
-
-        SpendDescription sdesc;
-        uint256 rcm = spend.note.rcm();
-        if (!librustzcash_sapling_spend_proof(
-                ctx,
-                spend.expsk.full_viewing_key().ak.begin(),
-                spend.expsk.nsk.begin(),
-                spend.note.d.data(),
-                rcm.begin(),
-                spend.alpha.begin(),
-                spend.note.value(),
-                spend.anchor.begin(),
-                vMerkle.data(),
-                sdesc.cv.begin(),
-                sdesc.rk.begin(),
-                sdesc.zkproof.data())) {
-            librustzcash_sapling_proving_ctx_free(ctx);
-            return TransactionBuilderResult("Spend proof failed");
-        }
-        //printf("transaction_builder.cpp librustzcash_sapling_spend_proof() passed!\n");
-        sdesc.anchor = spend.anchor;
-        sdesc.nullifier = *nf;
-        mtx.vShieldedSpend.push_back(sdesc);
+        vNullifiers.push_back(*nf);
     }
-
-    // Create Sapling OutputDescriptions
     for (auto output : outputs) {
         // Check this out here as well to provide better logging.
         if (!output.note.cmu()) {
-            librustzcash_sapling_proving_ctx_free(ctx);
             return TransactionBuilderResult("Output is invalid");
         }
+    }
+
+    //Every proof gets its own value commitment randomness instead of sharing a
+    //proving context, so the proofs can be made concurrently. The binding
+    //signature is made from all of them once the proofs are done.
+    std::vector<uint256> vSpendRcv(spends.size());
+    std::vector<uint256> vOutputRcv(outputs.size());
+    for (auto &rcv : vSpendRcv) {
+        librustzcash_sapling_generate_r(rcv.begin());
+    }
+    for (auto &rcv : vOutputRcv) {
+        librustzcash_sapling_generate_r(rcv.begin());
+    }
+
+    std::vector<SpendDescription> vSpendDescs(spends.size());
+    std::vector<boost::optional<OutputDescription>> vOutputDescs(outputs.size());
+    std::atomic<bool> fSpendFailed(false);
+    std::atomic<size_t> nNext(0);
+    size_t nProofs = spends.size() + outputs.size();
+
+    //Each worker takes the next proof until none are left
+    auto worker = [&]() {
+        for (size_t i = nNext++; i < nProofs; i = nNext++) {
+            if (i >= spends.size()) {
+                vOutputDescs[i - spends.size()] = outputs[i - spends.size()].Build(vOutputRcv[i - spends.size()]);
+                continue;
+            }
+
+            const SpendDescriptionInfo &spend = spends[i];
+            SpendDescription &sdesc = vSpendDescs[i];
+            uint256 rcm = spend.note.rcm();
+            if (!librustzcash_sapling_spend_proof_rcv(
+                    spend.expsk.full_viewing_key().ak.begin(),
+                    spend.expsk.nsk.begin(),
+                    spend.note.d.data(),
+                    rcm.begin(),
+                    spend.alpha.begin(),
+                    vSpendRcv[i].begin(),
+                    spend.note.value(),
+                    spend.anchor.begin(),
+                    asMerklePath[i].cArray,
+                    sdesc.cv.begin(),
+                    sdesc.rk.begin(),
+                    sdesc.zkproof.data())) {
+                fSpendFailed = true;
+            }
+        }
+    };
+
+    std::vector<std::future<void>> vWorkers;
+    int nWorkers = std::min<size_t>(std::max(maxProcessingThreads, 1), nProofs);
+    for (int i = 0; i < nWorkers; i++) {
+        vWorkers.emplace_back(std::async(std::launch::async, worker));
+    }
+
+    //Rethrow the first failure only after every worker has stopped
+    std::exception_ptr pException;
+    for (auto &future : vWorkers) {
+        try {
+            future.get();
+        } catch (...) {
+            if (!pException) {
+                pException = std::current_exception();
+            }
+        }
+    }
+    if (pException) {
+        std::rethrow_exception(pException);
+    }
+
+    // Create Sapling SpendDescriptions
+    if (fSpendFailed) {
+        return TransactionBuilderResult("Spend proof failed");
+    }
+    for (size_t i = 0; i < spends.size(); i++) {
+        vSpendDescs[i].anchor = spends[i].anchor;
+        vSpendDescs[i].nullifier = vNullifiers[i];
+        mtx.vShieldedSpend.push_back(vSpendDescs[i]);
+    }
 
-        auto odesc = output.Build(ctx);
+    // Create Sapling OutputDescriptions
+    for (auto &odesc : vOutputDescs) {
         if (!odesc) {
-            librustzcash_sapling_proving_ctx_free(ctx);
             return TransactionBuilderResult("Failed to create output description");
         }
-
         mtx.vShieldedOutput.push_back(odesc.get());
     }
 
@@ -996,7 +1031,6 @@ TransactionBuilderResult TransactionBuilder::Build()
     try {
         dataToBeSigned = SignatureHash(scriptCode, mtx, NOT_AN_INPUT, SIGHASH_ALL, 0, consensusBranchId);
     } catch (std::logic_error ex) {
-        librustzcash_sapling_proving_ctx_free(ctx);
         return TransactionBuilderResult("Could not construct signature hash: " + std::string(ex.what()));
     }
 
@@ -1008,13 +1042,15 @@ TransactionBuilderResult TransactionBuilder::Build()
             dataToBeSigned.begin(),
             mtx.vShieldedSpend[i].spendAuthSig.data());
     }
-    librustzcash_sapling_binding_sig(
-        ctx,
-        mtx.valueBalance,
-        dataToBeSigned.begin(),
-        mtx.bindingSig.data());
-
-    librustzcash_sapling_proving_ctx_free(ctx);
+    if (!librustzcash_sapling_binding_sig_rcv(
+            vSpendRcv.empty() ? nullptr : vSpendRcv[0].begin(),
+            vSpendRcv.size(),
+            vOutputRcv.empty() ? nullptr : vOutputRcv[0].begin(),
+            vOutputRcv.size(),
+            dataToBeSigned.begin(),
+            mtx.bindingSig.data())) {
+        return TransactionBuilderResult("Failed to create binding signature");
+    }
 
     // Transparent signatures
     CTransaction txNewConst(mtx);
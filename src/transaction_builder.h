@@ -78,7 +78,9 @@ struct OutputDescriptionInfo {
         libzcash::SaplingNote note,
         std::array<unsigned char, ZC_MEMO_SIZE> memo) : ovk(ovk), note(note), memo(memo) {}
 
-    boost::optional<OutputDescription> Build(void* ctx);
+    // rcv is the value commitment randomness of the proof, the caller signs
+    // the transaction with it
+    boost::optional<OutputDescription> Build(const uint256& rcv);
 };
 
 
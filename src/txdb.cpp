@@ -33,6 +33,9 @@
 #include "init.h"
 
 #include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <future>
 
 #include <boost/thread.hpp>
 
@@ -54,6 +57,7 @@ static const char DB_TIMESTAMPINDEX = 'H';
 static const char DB_BLOCKHASHINDEX = 'h';
 static const char DB_SPENTINDEX = 'p';
 static const char DB_BLOCK_INDEX = 'b';
+static const char DB_COINSUPPLY = 'C';
 
 static const char DB_BEST_BLOCK = 'B';
 static const char DB_BEST_SPROUT_ANCHOR = 'a';
@@ -68,11 +72,45 @@ static const char OUTPUT_PROOF_HASH = 'E';
 
 static const char DB_VERSION = 'V';
 
-CCoinsViewDB::CCoinsViewDB(std::string dbName, size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / dbName, nCacheSize, fMemory, fWipe) {
+CCoinsViewDB::CCoinsViewDB(std::string dbName, size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / dbName, nCacheSize, fMemory, fWipe),
+    sproutNullifierFilter(NULLIFIER_FILTER_INITIAL_ELEMENTS, NULLIFIER_FILTER_FP_RATE),
+    saplingNullifierFilter(NULLIFIER_FILTER_INITIAL_ELEMENTS, NULLIFIER_FILTER_FP_RATE)
+{
+    LoadNullifierFilters();
+}
+
+CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe),
+    sproutNullifierFilter(NULLIFIER_FILTER_INITIAL_ELEMENTS, NULLIFIER_FILTER_FP_RATE),
+    saplingNullifierFilter(NULLIFIER_FILTER_INITIAL_ELEMENTS, NULLIFIER_FILTER_FP_RATE)
+{
+    LoadNullifierFilters();
 }
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe)
+void CCoinsViewDB::LoadNullifierFilters()
 {
+    int64_t nStart = GetTimeMillis();
+    LOCK(cs_nullifierFilters);
+    sproutNullifierFilter.clear();
+    saplingNullifierFilter.clear();
+
+    boost::scoped_ptr<CDBIterator> pcursor(db.NewIterator());
+    const char dbChars[] = {DB_NULLIFIER, DB_SAPLING_NULLIFIER};
+    for (char dbChar : dbChars) {
+        CScalableBloomFilter& filter = dbChar == DB_NULLIFIER ? sproutNullifierFilter : saplingNullifierFilter;
+        pcursor->Seek(make_pair(dbChar, uint256()));
+        while (pcursor->Valid()) {
+            std::pair<char, uint256> key;
+            if (!pcursor->GetKey(key) || key.first != dbChar)
+                break;
+            filter.insert(key.second);
+            pcursor->Next();
+        }
+    }
+
+    LogPrintf("Loaded %u Sprout and %u Sapling nullifiers into filters (%u KiB) in %dms\n",
+              sproutNullifierFilter.size(), saplingNullifierFilter.size(),
+              (sproutNullifierFilter.DynamicMemoryUsage() + saplingNullifierFilter.DynamicMemoryUsage()) >> 10,
+              GetTimeMillis() - nStart);
 }
 
 
@@ -115,16 +153,24 @@ bool CCoinsViewDB::GetSaplingFrontierAnchorAt(const uint256 &rt, SaplingMerkleFr
 bool CCoinsViewDB::GetNullifier(const uint256 &nf, ShieldedType type) const {
     bool spent = false;
     char dbChar;
+    const CScalableBloomFilter* filter;
     switch (type) {
         case SPROUT:
             dbChar = DB_NULLIFIER;
+            filter = &sproutNullifierFilter;
             break;
         case SAPLING:
             dbChar = DB_SAPLING_NULLIFIER;
+            filter = &saplingNullifierFilter;
             break;
         default:
             throw runtime_error("Unknown shielded type");
     }
+    {
+        LOCK(cs_nullifierFilters);
+        if (!filter->contains(nf))
+            return false;
+    }
     return db.Read(make_pair(dbChar, nf), spent);
 }
 
@@ -182,14 +228,16 @@ uint256 CCoinsViewDB::GetBestAnchor(ShieldedType type) const {
     return hashBestAnchor;
 }
 
-void BatchWriteNullifiers(CDBBatch& batch, CNullifiersMap& mapToUse, const char& dbChar)
+void BatchWriteNullifiers(CDBBatch& batch, CNullifiersMap& mapToUse, const char& dbChar, CScalableBloomFilter& filter)
 {
     for (CNullifiersMap::iterator it = mapToUse.begin(); it != mapToUse.end();) {
         if (it->second.flags & CNullifiersCacheEntry::DIRTY) {
             if (!it->second.entered)
                 batch.Erase(make_pair(dbChar, it->first));
-            else
+            else {
                 batch.Write(make_pair(dbChar, it->first), true);
+                filter.insert(it->first);
+            }
             // TODO: changed++? ... See comment in CCoinsViewDB::BatchWrite. If this is needed we could return an int
         }
         CNullifiersMap::iterator itOld = it++;
@@ -264,8 +312,13 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins,
     ::BatchWriteAnchors<CAnchorsSaplingMap, CAnchorsSaplingMap::iterator, CAnchorsSaplingCacheEntry, SaplingMerkleTree>(batch, mapSaplingAnchors, DB_SAPLING_ANCHOR);
     ::BatchWriteAnchors<CAnchorsSaplingFrontierMap, CAnchorsSaplingFrontierMap::iterator, CAnchorsSaplingFrontierCacheEntry, SaplingMerkleFrontier>(batch, mapSaplingFrontierAnchors, DB_SAPLING_FRONTIER_ANCHOR);
 
-    ::BatchWriteNullifiers(batch, mapSproutNullifiers, DB_NULLIFIER);
-    ::BatchWriteNullifiers(batch, mapSaplingNullifiers, DB_SAPLING_NULLIFIER);
+    {
+        // The filters may claim a nullifier before the batch is written, which
+        // only costs a read; they must never miss one that is in the database.
+        LOCK(cs_nullifierFilters);
+        ::BatchWriteNullifiers(batch, mapSproutNullifiers, DB_NULLIFIER, sproutNullifierFilter);
+        ::BatchWriteNullifiers(batch, mapSaplingNullifiers, DB_SAPLING_NULLIFIER, saplingNullifierFilter);
+    }
 
     ::BatchWriteProofHashes(batch, mapZkOutputProofHash, OUTPUT_PROOF_HASH);
     ::BatchWriteProofHashes(batch, mapZkSpendProofHash, SPEND_PROOF_HASH);
@@ -768,6 +821,21 @@ bool CBlockTreeDB::ReadTimestampBlockIndex(const uint256 &hash, unsigned int &lt
     return true;
 }
 
+bool CBlockTreeDB::WriteCoinSupply(const std::vector<std::pair<int, CCoinSupplyIndexValue> > &vect) {
+    CDBBatch batch(*this);
+    for (std::vector<std::pair<int, CCoinSupplyIndexValue> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
+        batch.Write(make_pair(DB_COINSUPPLY, it->first), it->second);
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::ReadCoinSupply(int nHeight, CCoinSupplyIndexValue &value) const {
+    return Read(make_pair(DB_COINSUPPLY, nHeight), value);
+}
+
+bool CBlockTreeDB::EraseCoinSupply(int nHeight) {
+    return Erase(make_pair(DB_COINSUPPLY, nHeight));
+}
+
 bool CBlockTreeDB::WriteFlag(const std::string &name, bool fValue) {
     return Write(std::make_pair(DB_FLAG, name), fValue ? '1' : '0');
 }
@@ -793,95 +861,152 @@ bool CBlockTreeDB::blockOnchainActive(const uint256 &hash) {
     return true;
 }
 
-bool CBlockTreeDB::LoadBlockIndexGuts()
+/**
+ * Block index entry deserialized by a loader thread, linked to its parent once
+ * all ranges have been read.
+ */
+struct CLoadedBlockIndex
 {
-    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+    uint256 hash;
+    uint256 hashPrev;
+    CBlockIndex* pindex;
+};
 
-    pcursor->Seek(make_pair(DB_BLOCK_INDEX, uint256()));
-    int64_t count = 0; int reportDone = 0;
-    uiInterface.ShowProgress(_("Loading guts..."), 0, false);
+/**
+ * Read and deserialize the block index entries whose hash starts with a byte
+ * in [nBegin, nEnd). Each loader uses its own iterator over the key range.
+ */
+static bool LoadBlockIndexRange(CBlockTreeDB* pdb, unsigned int nBegin, unsigned int nEnd,
+                                std::vector<CLoadedBlockIndex>* pvLoaded, std::atomic<int64_t>* pnLoaded)
+{
+    boost::scoped_ptr<CDBIterator> pcursor(pdb->NewIterator());
+
+    uint256 hashStart;
+    *hashStart.begin() = nBegin;
+    pcursor->Seek(make_pair(DB_BLOCK_INDEX, hashStart));
 
-    // Load mapBlockIndex
     while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
         if (ShutdownRequested()) return false;
 
         std::pair<char, uint256> key;
+        if (!pcursor->GetKey(key) || key.first != DB_BLOCK_INDEX || *key.second.begin() >= nEnd)
+            break;
 
-        if (pcursor->GetKey(key) && key.first == DB_BLOCK_INDEX) {
+        CDiskBlockIndex diskindex;
+        if (!pcursor->GetValue(diskindex))
+            return error("LoadBlockIndex() : failed to read value");
+
+        // Construct block index object
+        CBlockIndex* pindexNew            = new CBlockIndex();
+        pindexNew->nHeight                = diskindex.nHeight;
+        pindexNew->nFile                  = diskindex.nFile;
+        pindexNew->nDataPos               = diskindex.nDataPos;
+        pindexNew->nUndoPos               = diskindex.nUndoPos;
+        pindexNew->hashSproutAnchor       = diskindex.hashSproutAnchor;
+        pindexNew->nVersion               = diskindex.nVersion;
+        pindexNew->hashMerkleRoot         = diskindex.hashMerkleRoot;
+        pindexNew->hashFinalSaplingRoot   = diskindex.hashFinalSaplingRoot;
+        pindexNew->nTime                  = diskindex.nTime;
+        pindexNew->nBits                  = diskindex.nBits;
+        pindexNew->nNonce                 = diskindex.nNonce;
+        // the Equihash solution will be loaded lazily from the dbindex entry
+        pindexNew->nStatus                = diskindex.nStatus;
+        pindexNew->nCachedBranchId        = diskindex.nCachedBranchId;
+        pindexNew->nTx                    = diskindex.nTx;
+        pindexNew->nChainSupplyDelta      = diskindex.nChainSupplyDelta;
+        pindexNew->nTransparentValue      = diskindex.nTransparentValue;
+        pindexNew->nBurnedAmountDelta     = diskindex.nBurnedAmountDelta;
+        pindexNew->nSproutValue           = diskindex.nSproutValue;
+        pindexNew->nSaplingValue          = diskindex.nSaplingValue;
+        pindexNew->segid                  = diskindex.segid;
+        pindexNew->nNotaryPay             = diskindex.nNotaryPay;
+
+        //Index the entry by the hash of its stored header, not by the key it was found under
+        CLoadedBlockIndex loaded;
+        loaded.hash = diskindex.GetBlockHash();
+        if (loaded.hash != key.second)
+            LogPrintf("LoadBlockIndex(): block index entry %s found under key %s\n", loaded.hash.ToString(), key.second.ToString());
+        loaded.hashPrev = diskindex.hashPrev;
+        loaded.pindex = pindexNew;
+        pvLoaded->push_back(loaded);
+
+        (*pnLoaded)++;
+        pcursor->Next();
+    }
 
-            if (count++ % 256 == 0) {
-                uint32_t high = 0x100 * *key.second.begin() + *(key.second.begin() + 1);
-                int percentageDone = (int)(high * 100.0 / 65536.0 + 0.5);
-                uiInterface.ShowProgress(_("Loading guts..."), percentageDone, false);
-                if (reportDone < percentageDone/10) {
-                    // report max. every 10% step
-                    LogPrintf("[%d%%]...", percentageDone); /* Continued */
-                    reportDone = percentageDone/10;
-                }
+    return true;
+}
+
+bool CBlockTreeDB::LoadBlockIndexGuts()
+{
+    uiInterface.ShowProgress(_("Loading guts..."), 0, false);
+
+    //Split the hash space into one key range per processing thread. Block
+    //hashes are uniformly distributed, so the ranges are of similar size.
+    int nRanges = std::min(std::max(1, maxProcessingThreads), 256);
+    std::vector<std::vector<CLoadedBlockIndex>> vLoaded(nRanges);
+    std::vector<std::future<bool>> vLoaders;
+    std::atomic<int64_t> nLoaded(0);
+    for (int i = 0; i < nRanges; i++) {
+        unsigned int nBegin = (i * 256) / nRanges;
+        unsigned int nEnd = ((i + 1) * 256) / nRanges;
+        vLoaders.emplace_back(std::async(std::launch::async, LoadBlockIndexRange, this, nBegin, nEnd, &vLoaded[i], &nLoaded));
+    }
+
+    //Report progress while the loaders run, the total is unknown so show
+    //the number of ranges completed
+    bool fLoaded = true;
+    int reportDone = 0;
+    for (int i = 0; i < nRanges; i++) {
+        while (vLoaders[i].wait_for(std::chrono::milliseconds(250)) != std::future_status::ready) {
+            uiInterface.ShowProgress(_("Loading guts..."), (i * 100) / nRanges, false);
+        }
+        if (!vLoaders[i].get())
+            fLoaded = false;
+
+        int percentageDone = ((i + 1) * 100) / nRanges;
+        if (reportDone < percentageDone/10) {
+            // report max. every 10% step
+            LogPrintf("[%d%%]...", percentageDone); /* Continued */
+            reportDone = percentageDone/10;
+        }
+    }
+
+    //Insert into mapBlockIndex, then link each entry to its parent once every
+    //entry has been inserted
+    mapBlockIndex.reserve(mapBlockIndex.size() + nLoaded.load());
+    for (auto& vRange : vLoaded) {
+        for (auto& loaded : vRange) {
+            if (!fLoaded) {
+                delete loaded.pindex;
+                continue;
             }
 
-            CDiskBlockIndex diskindex;
-            if (pcursor->GetValue(diskindex)) {
-                // Construct block index object
-                CBlockIndex* pindexNew            = InsertBlockIndex(diskindex.GetBlockHash());
-                pindexNew->pprev                  = InsertBlockIndex(diskindex.hashPrev);
-                pindexNew->nHeight                = diskindex.nHeight;
-                pindexNew->nFile                  = diskindex.nFile;
-                pindexNew->nDataPos               = diskindex.nDataPos;
-                pindexNew->nUndoPos               = diskindex.nUndoPos;
-                pindexNew->hashSproutAnchor       = diskindex.hashSproutAnchor;
-                pindexNew->nVersion               = diskindex.nVersion;
-                pindexNew->hashMerkleRoot         = diskindex.hashMerkleRoot;
-                pindexNew->hashFinalSaplingRoot   = diskindex.hashFinalSaplingRoot;
-                pindexNew->nTime                  = diskindex.nTime;
-                pindexNew->nBits                  = diskindex.nBits;
-                pindexNew->nNonce                 = diskindex.nNonce;
-                // the Equihash solution will be loaded lazily from the dbindex entry
-                pindexNew->nStatus                = diskindex.nStatus;
-                pindexNew->nCachedBranchId        = diskindex.nCachedBranchId;
-                pindexNew->nTx                    = diskindex.nTx;
-                pindexNew->nChainSupplyDelta      = diskindex.nChainSupplyDelta;
-                pindexNew->nTransparentValue      = diskindex.nTransparentValue;
-                pindexNew->nBurnedAmountDelta     = diskindex.nBurnedAmountDelta;
-                pindexNew->nSproutValue           = diskindex.nSproutValue;
-                pindexNew->nSaplingValue          = diskindex.nSaplingValue;
-                pindexNew->segid                  = diskindex.segid;
-                pindexNew->nNotaryPay             = diskindex.nNotaryPay;
-
-                if ( 0 ) // POW will be checked before any block is connected
-                {
-                    // Consistency checks
-                    CBlockHeader header;
-                    {
-                        LOCK(cs_main);
-                        try {
-                            header = pindexNew->GetBlockHeader();
-                        } catch (const runtime_error&) {
-                            return error("LoadBlockIndex(): failed to read index entry: diskindex hash = %s",
-                                diskindex.GetBlockHash().ToString());
-                        }
-                    }
-                    if (header.GetHash() != pindexNew->GetBlockHash())
-                        return error("LoadBlockIndex(): block header inconsistency detected: on-disk = %s, in-memory = %s",
-                                    diskindex.ToString(),  pindexNew->ToString());
-
-                    uint8_t pubkey33[33];
-                    komodo_index2pubkey33(pubkey33,pindexNew,pindexNew->nHeight);
-                    if (!CheckProofOfWork(header,pubkey33,pindexNew->nHeight,Params().GetConsensus()))
-                        return error("LoadBlockIndex(): CheckProofOfWork failed: %s", pindexNew->ToString());
-                }
-                pcursor->Next();
+            BlockMap::iterator mi = mapBlockIndex.find(loaded.hash);
+            if (mi == mapBlockIndex.end()) {
+                mi = mapBlockIndex.insert(make_pair(loaded.hash, loaded.pindex)).first;
+            } else if (mi->second == NULL) {
+                mi->second = loaded.pindex;
             } else {
-                return error("LoadBlockIndex() : failed to read value");
+                //Fill in an entry created before the load
+                *mi->second = *loaded.pindex;
+                delete loaded.pindex;
+                loaded.pindex = mi->second;
+            }
+            loaded.pindex->phashBlock = &((*mi).first);
+        }
+    }
+
+    if (fLoaded) {
+        for (auto& vRange : vLoaded) {
+            for (auto& loaded : vRange) {
+                loaded.pindex->pprev = InsertBlockIndex(loaded.hashPrev);
             }
-        } else {
-            break;
         }
     }
 
     uiInterface.ShowProgress("", 100, false);
-    LogPrintf("[%s].\n", ShutdownRequested() ? "CANCELLED" : "DONE");
+    LogPrintf("[%s]. %d entries\n", ShutdownRequested() ? "CANCELLED" : "DONE", nLoaded.load());
 
-    return true;
+    return fLoaded;
 }
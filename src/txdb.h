@@ -22,8 +22,10 @@
 #ifndef BITCOIN_TXDB_H
 #define BITCOIN_TXDB_H
 
+#include "bloom.h"
 #include "coins.h"
 #include "dbwrapper.h"
+#include "sync.h"
 
 #include <map>
 #include <string>
@@ -54,6 +56,10 @@ static const int64_t nDefaultDbCache = 450;
 static const int64_t nMaxDbCache = sizeof(void*) > 4 ? 16384 : 1024;
 //! min. -dbcache in (MiB)
 static const int64_t nMinDbCache = 4;
+//! Number of nullifiers the first layer of each nullifier filter is sized for
+static const unsigned int NULLIFIER_FILTER_INITIAL_ELEMENTS = 1 << 20;
+//! False-positive rate of the nullifier filters (at most twice this as they grow)
+static const double NULLIFIER_FILTER_FP_RATE = 0.001;
 
 /**
  * CCoinsView backed by the coin database (chainstate/)
@@ -63,6 +69,18 @@ class CCoinsViewDB : public CCoinsView
 protected:
     CDBWrapper db;
     CCoinsViewDB(std::string dbName, size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+
+    /**
+     * Almost every nullifier looked up is unspent, so each set of spent
+     * nullifiers is mirrored in a filter that answers most lookups without
+     * a LevelDB read. The filters are rebuilt from the database on startup;
+     * nullifiers erased on a reorg stay in them and just cost a read.
+     */
+    mutable CCriticalSection cs_nullifierFilters;
+    CScalableBloomFilter sproutNullifierFilter;
+    CScalableBloomFilter saplingNullifierFilter;
+
+    void LoadNullifierFilters();
 public:
     CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
 
@@ -100,6 +118,30 @@ public:
     bool GetStats(CCoinsStats &stats) const;
 };
 
+/**
+ * Running totals of komodo_newcoins for the active chain up to and including
+ * the block at a height, see komodo_coinsupply
+ */
+struct CCoinSupplyIndexValue
+{
+    uint256 hashBlock;
+    int64_t supply;
+    int64_t zfunds;
+    int64_t sproutfunds;
+
+    CCoinSupplyIndexValue() : supply(0), zfunds(0), sproutfunds(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(hashBlock);
+        READWRITE(supply);
+        READWRITE(zfunds);
+        READWRITE(sproutfunds);
+    }
+};
+
 /**
  * Access to the block database (blocks/index/)
  * This database consists of:
@@ -111,6 +153,7 @@ public:
  * - address / amount
  * - timestamp index
  * - block hash / timestamp index
+ * - height / cumulative coin supply
  */
 class CBlockTreeDB : public CDBWrapper
 {
@@ -272,6 +315,25 @@ public:
      * @returns true on success
      */
     bool ReadTimestampBlockIndex(const uint256 &hash, unsigned int &logicalTS) const;
+    /****
+     * Write cumulative coin supply records
+     * @param vect the height / totals records to write
+     * @returns true on success
+     */
+    bool WriteCoinSupply(const std::vector<std::pair<int, CCoinSupplyIndexValue> > &vect);
+    /****
+     * Read the cumulative coin supply at a height
+     * @param nHeight the height
+     * @param value the totals, check hashBlock against the active chain
+     * @returns true on success
+     */
+    bool ReadCoinSupply(int nHeight, CCoinSupplyIndexValue &value) const;
+    /****
+     * Remove the cumulative coin supply record at a height
+     * @param nHeight the height
+     * @returns true on success
+     */
+    bool EraseCoinSupply(int nHeight);
     /***
      * Store a flag value in the DB
      * @param name the key
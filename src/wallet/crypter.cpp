@@ -565,16 +565,23 @@ bool CCryptoKeyStore::DecryptSerializedSecret(
      const uint256 chash,
      CKeyingMaterial &vchSecret)
 {
-    LOCK(cs_KeyStore);
-    if (!IsCrypted()) {
-        return false;
-    }
+    //Copy the master key under the lock and decrypt outside of it, so
+    //wallet records can be decrypted from several threads on load
+    CKeyingMaterial vMasterKeyCopy;
+    {
+        LOCK(cs_KeyStore);
+        if (!IsCrypted()) {
+            return false;
+        }
 
-    if (IsLocked()) {
-        return false;
+        if (IsLocked()) {
+            return false;
+        }
+
+        vMasterKeyCopy = vMasterKey;
     }
 
-    return DecryptSecret(vMasterKey, vchCryptedSecret, chash, vchSecret);
+    return DecryptSecret(vMasterKeyCopy, vchCryptedSecret, chash, vchSecret);
 
 }
 
@@ -238,7 +238,8 @@ UniValue importprivkey(const UniValue& params, bool fHelp, const CPubKey& mypk)
         pwalletMain->nTimeFirstKey = 1; // 0 would be considered 'no value'
 
         if (fRescan) {
-            pwalletMain->ScanForWalletTransactions(chainActive[height], true, true, true, true);
+            if (pwalletMain->ScanForWalletTransactions(chainActive[height], true, true, true, true) < 0)
+                throw JSONRPCError(RPC_WALLET_ERROR, "Rescan failed, see debug.log for details");
         }
     }
 
@@ -347,7 +348,8 @@ UniValue importaddress(const UniValue& params, bool fHelp, const CPubKey& mypk)
 
         if (fRescan)
         {
-            pwalletMain->ScanForWalletTransactions(chainActive.Genesis(), true, true, true, true);
+            if (pwalletMain->ScanForWalletTransactions(chainActive.Genesis(), true, true, true, true) < 0)
+                throw JSONRPCError(RPC_WALLET_ERROR, "Rescan failed, see debug.log for details");
             pwalletMain->ReacceptWalletTransactions();
         }
     }
@@ -600,7 +602,8 @@ UniValue importwallet_impl(const UniValue& params, bool fHelp, bool fImportZKeys
         pwalletMain->nTimeFirstKey = nTimeBegin;
 
     LogPrintf("Rescanning last %i blocks\n", chainActive.Genesis() - pindex->nHeight + 1);
-    pwalletMain->ScanForWalletTransactions(chainActive.Genesis(), true, true, true, true);
+    if (pwalletMain->ScanForWalletTransactions(chainActive.Genesis(), true, true, true, true) < 0)
+        throw JSONRPCError(RPC_WALLET_ERROR, "Rescan failed, see debug.log for details");
     pwalletMain->MarkDirty();
 
     if (!fGood)
@@ -906,11 +909,18 @@ UniValue rescan(const UniValue& params, bool fHelp, const CPubKey& mypk)
             + HelpExampleRpc("rescan", "")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    CBlockIndex* pindexGenesis;
+    {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
 
-    EnsureWalletIsUnlockedForReporting();
+        EnsureWalletIsUnlockedForReporting();
+
+        pindexGenesis = chainActive[0];
+    }
 
-    pwalletMain->ScanForWalletTransactions(chainActive[0], true, true, true, true);
+    //Scan in the background so block processing is not stalled for the whole rescan
+    if (pwalletMain->ScanForWalletTransactions(pindexGenesis, true, true, true, true, true) < 0)
+        throw JSONRPCError(RPC_WALLET_ERROR, "Rescan failed, see debug.log for details");
 
     return NullUniValue;
 }
@@ -1010,7 +1020,8 @@ UniValue z_importkey(const UniValue& params, bool fHelp, const CPubKey& mypk)
 
     // We want to scan for transactions and notes
     if (fRescan) {
-        pwalletMain->ScanForWalletTransactions(chainActive[nRescanHeight], true, true, true, true);
+        if (pwalletMain->ScanForWalletTransactions(chainActive[nRescanHeight], true, true, true, true) < 0)
+            throw JSONRPCError(RPC_WALLET_ERROR, "Rescan failed, see debug.log for details");
     }
 
     return NullUniValue;
@@ -1115,7 +1126,8 @@ UniValue z_importviewingkey(const UniValue& params, bool fHelp, const CPubKey& m
 
   // We want to scan for transactions and notes
   if (fRescan) {
-      pwalletMain->ScanForWalletTransactions(chainActive[nRescanHeight], true, true, true, true);
+      if (pwalletMain->ScanForWalletTransactions(chainActive[nRescanHeight], true, true, true, true) < 0)
+          throw JSONRPCError(RPC_WALLET_ERROR, "Rescan failed, see debug.log for details");
   }
 
   return result;
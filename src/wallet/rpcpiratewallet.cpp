@@ -658,6 +658,78 @@ void getRpcArcTx(uint256 &txid, RpcArcTransaction &arcTx, bool fIncludeWatchonly
 
 }
 
+//Decrypted archived transactions, an archived transaction only changes when its
+//ArchiveTxPoint is rewritten, which drops the cached record. Records are kept in
+//least recently used order, most recent at the front
+typedef std::pair<uint256, bool> RpcArcTxCacheKey;
+typedef std::list<std::pair<RpcArcTxCacheKey, RpcArcTransaction>> RpcArcTxCacheList;
+static CCriticalSection cs_rpcArcTxCache;
+static RpcArcTxCacheList lruRpcArcTxCache;
+static std::map<RpcArcTxCacheKey, RpcArcTxCacheList::iterator> mapRpcArcTxCache;
+static const size_t MAX_RPC_ARCTX_CACHE_SIZE = 100000;
+
+void getCachedRpcArcTx(uint256 &txid, RpcArcTransaction &arcTx, bool fIncludeWatchonly) {
+
+    AssertLockHeld(cs_main);
+    AssertLockHeld(pwalletMain->cs_wallet);
+
+    std::map<uint256, ArchiveTxPoint>::iterator ait = pwalletMain->mapArcTxs.find(txid);
+    if (ait == pwalletMain->mapArcTxs.end()) {
+        getRpcArcTx(txid, arcTx, fIncludeWatchonly, false);
+        return;
+    }
+    uint256 hashBlock = ait->second.hashBlock;
+
+    {
+        LOCK(cs_rpcArcTxCache);
+        auto it = mapRpcArcTxCache.find(std::make_pair(txid, fIncludeWatchonly));
+        if (it != mapRpcArcTxCache.end() && it->second->second.blockHash == hashBlock) {
+            BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
+            if (mi != mapBlockIndex.end() && chainActive.Contains(mi->second)) {
+                lruRpcArcTxCache.splice(lruRpcArcTxCache.begin(), lruRpcArcTxCache, it->second);
+                arcTx = it->second->second;
+                //Confirmations are the only part of the record that move with the chain
+                int nHeight = chainActive.Tip()->nHeight;
+                arcTx.rawconfirmations = nHeight - arcTx.blockHeight + 1;
+                arcTx.confirmations = komodo_dpowconfs(arcTx.blockHeight, arcTx.rawconfirmations);
+                return;
+            }
+        }
+    }
+
+    getRpcArcTx(txid, arcTx, fIncludeWatchonly, false);
+
+    if (arcTx.blockHash.IsNull())
+        return;
+
+    LOCK(cs_rpcArcTxCache);
+    RpcArcTxCacheKey key = std::make_pair(txid, fIncludeWatchonly);
+    auto it = mapRpcArcTxCache.find(key);
+    if (it != mapRpcArcTxCache.end()) {
+        it->second->second = arcTx;
+        lruRpcArcTxCache.splice(lruRpcArcTxCache.begin(), lruRpcArcTxCache, it->second);
+        return;
+    }
+
+    while (mapRpcArcTxCache.size() >= MAX_RPC_ARCTX_CACHE_SIZE) {
+        mapRpcArcTxCache.erase(lruRpcArcTxCache.back().first);
+        lruRpcArcTxCache.pop_back();
+    }
+    lruRpcArcTxCache.push_front(std::make_pair(key, arcTx));
+    mapRpcArcTxCache[key] = lruRpcArcTxCache.begin();
+}
+
+void eraseCachedRpcArcTx(const uint256 &txid) {
+    LOCK(cs_rpcArcTxCache);
+    for (int i = 0; i < 2; i++) {
+        auto it = mapRpcArcTxCache.find(std::make_pair(txid, i == 1));
+        if (it != mapRpcArcTxCache.end()) {
+            lruRpcArcTxCache.erase(it->second);
+            mapRpcArcTxCache.erase(it);
+        }
+    }
+}
+
 void getRpcArcTx(CWalletTx &tx, RpcArcTransaction &arcTx, bool fIncludeWatchonly, bool rescan) {
 
     AssertLockHeld(cs_main);
@@ -1098,36 +1170,29 @@ UniValue zs_listtransactions(const UniValue& params, bool fHelp, const CPubKey&
     if (nFilter < 0)
         throw runtime_error("Filter must be equal or greater than 0.");
 
-    //get Sorted Archived Transactions
-    std::map<std::pair<int,int>, uint256> sortedArchive;
-    for (map<uint256, ArchiveTxPoint>::iterator it = pwalletMain->mapArcTxs.begin(); it != pwalletMain->mapArcTxs.end(); ++it)
-    {
-      uint256 txid = (*it).first;
-      ArchiveTxPoint arcTxPt = (*it).second;
-      std::pair<int,int> key;
-
-      if (!arcTxPt.hashBlock.IsNull() && mapBlockIndex.count(arcTxPt.hashBlock) > 0) {
-        key = make_pair(mapBlockIndex[arcTxPt.hashBlock]->nHeight, arcTxPt.nIndex);
-        sortedArchive[key] = txid;
-      }
-    }
+    pwalletMain->IndexPendingArcTxs();
 
-    //add any missing wallet transactions - unconfimred & conflicted
+    //Archived transactions are kept sorted by the wallet, only collect the
+    //wallet transactions missing from the archive - unconfimred & conflicted
+    std::map<std::pair<int,int>, uint256> sortedWallet;
     int nPosUnconfirmed = 0;
-    for (map<uint256,CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); ++it) {
-      CWalletTx wtx = (*it).second;
+    for (std::set<uint256>::iterator it = pwalletMain->setWalletTxsUnindexed.begin(); it != pwalletMain->setWalletTxsUnindexed.end(); ++it) {
+      std::map<uint256, CWalletTx>::iterator wit = pwalletMain->mapWallet.find(*it);
+      if (wit == pwalletMain->mapWallet.end())
+        continue;
+      const CWalletTx& wtx = wit->second;
       std::pair<int,int> key;
 
       if (wtx.GetDepthInMainChain() == 0) {
         key = make_pair(chainActive.Tip()->nHeight + 1,  nPosUnconfirmed);
-        sortedArchive[key] = wtx.GetHash();
+        sortedWallet[key] = wtx.GetHash();
         nPosUnconfirmed++;
       } else if (!wtx.hashBlock.IsNull() && mapBlockIndex.count(wtx.hashBlock) > 0) {
         key = make_pair(mapBlockIndex[wtx.hashBlock]->nHeight, wtx.nIndex);
-        sortedArchive[key] = wtx.GetHash();
+        sortedWallet[key] = wtx.GetHash();
       } else {
         key = make_pair(chainActive.Tip()->nHeight + 1,  nPosUnconfirmed);
-        sortedArchive[key] = wtx.GetHash();
+        sortedWallet[key] = wtx.GetHash();
         nPosUnconfirmed++;
       }
 
@@ -1135,15 +1200,38 @@ UniValue zs_listtransactions(const UniValue& params, bool fHelp, const CPubKey&
 
     uint64_t t = GetTime();
     int chainHeight = chainActive.Tip()->nHeight;
-    //Reverse Iterate thru transactions
-    for (map<std::pair<int,int>, uint256>::reverse_iterator it = sortedArchive.rbegin(); it != sortedArchive.rend(); ++it)
+
+    //Start the archive walk at the highest block that can meet the minimum confirmations
+    const std::map<std::pair<int,int>, uint256>& sortedArchive = pwalletMain->mapArcTxsByHeight;
+    std::map<std::pair<int,int>, uint256>::const_reverse_iterator arcIt = sortedArchive.rbegin();
+    if (nMinConfirms > 0)
+        arcIt = std::map<std::pair<int,int>, uint256>::const_reverse_iterator(sortedArchive.upper_bound(make_pair(chainHeight - nMinConfirms + 1, INT_MAX)));
+    std::map<std::pair<int,int>, uint256>::const_reverse_iterator walletIt = sortedWallet.rbegin();
+    //Reverse Iterate thru transactions, merging the archive and wallet orderings
+    while (arcIt != sortedArchive.rend() || walletIt != sortedWallet.rend())
     {
-        uint256 txid = (*it).second;
+        std::pair<int,int> key;
+        uint256 txid;
+        if (walletIt == sortedWallet.rend() || (arcIt != sortedArchive.rend() && walletIt->first < arcIt->first)) {
+            key = arcIt->first;
+            txid = arcIt->second;
+            ++arcIt;
+        } else {
+            //The wallet entry wins a tie, as it did in a single merged map
+            if (arcIt != sortedArchive.rend() && arcIt->first == walletIt->first)
+                ++arcIt;
+            key = walletIt->first;
+            txid = walletIt->second;
+            ++walletIt;
+        }
         RpcArcTransaction arcTx;
 
-        //Exclude transactions with block height lower the type 3 filter minimum
-        if (nFilterType == 3 && (*it).first.first < nFilter)
-            continue;
+        //Transactions are visited from the highest block down, nothing further can pass the type 2 or 3 filter
+        if (nFilterType == 2 && chainHeight - key.first + 1 > nFilter)
+            break;
+
+        if (nFilterType == 3 && key.first < nFilter)
+            break;
 
         if (pwalletMain->mapWallet.count(txid)) {
 
@@ -1177,7 +1265,7 @@ UniValue zs_listtransactions(const UniValue& params, bool fHelp, const CPubKey&
 
         } else {
 
-            int confirms = chainHeight - (*it).first.first + 1;
+            int confirms = chainHeight - key.first + 1;
 
             //Excude transactions with less confirmations than required
             if (confirms < nMinConfirms)
@@ -1188,7 +1276,7 @@ UniValue zs_listtransactions(const UniValue& params, bool fHelp, const CPubKey&
                 continue;
 
             //Archived Transactions
-            getRpcArcTx(txid, arcTx, fIncludeWatchonly, false);
+            getCachedRpcArcTx(txid, arcTx, fIncludeWatchonly);
 
             if (arcTx.blockHash.IsNull() || mapBlockIndex.count(arcTx.blockHash) == 0)
                 continue;
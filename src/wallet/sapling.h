@@ -6,6 +6,7 @@
 #define PIRATE_WALLET_SAPLING_H
 
 #include <array>
+#include <map>
 
 #include "primitives/block.h"
 #include "primitives/sapling.h"
@@ -22,20 +23,161 @@ class SaplingWallet;
 class SaplingWalletNoteCommitmentTreeWriter;
 class SaplingWalletNoteCommitmentTreeLoader;
 
+/** Number of incremental records persisted before the note commitment tree is compacted into a full snapshot */
+static const int SAPLING_WALLET_LOG_COMPACT_INTERVAL = 100;
+/** Maximum number of unpersisted tree operations kept in memory, beyond that the next write is a full snapshot */
+static const size_t SAPLING_WALLET_LOG_MAX_PENDING = 50000;
+
+enum SaplingWalletLogOp : uint8_t {
+    SAPLING_LOG_CHECKPOINT = 1,
+    SAPLING_LOG_REWIND = 2,
+    SAPLING_LOG_CLEAR_POSITIONS = 3,
+    SAPLING_LOG_CREATE_POSITIONS = 4,
+    SAPLING_LOG_APPEND_COMMITMENTS = 5,
+    SAPLING_LOG_APPEND_COMMITMENT = 6,
+    SAPLING_LOG_UNMARK = 7,
+    SAPLING_LOG_GARBAGE_COLLECT = 8,
+};
+
+/**
+ * A single mutation of the wallet note commitment tree. Between full snapshots the
+ * tree is persisted as an append-only log of these, replayed in order on load.
+ */
+class SaplingWalletLogEntry
+{
+public:
+    uint8_t nOp;
+    int32_t nHeight;
+    uint256 txid;
+    int32_t txidx;
+    int32_t outidx;
+    bool isMine;
+    std::vector<OutputDescription> vOutputs;
+
+    SaplingWalletLogEntry() : nOp(0), nHeight(0), txidx(0), outidx(0), isMine(false) {}
+    SaplingWalletLogEntry(uint8_t nOpIn, int32_t nHeightIn) : nOp(nOpIn), nHeight(nHeightIn), txidx(0), outidx(0), isMine(false) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(nOp);
+        READWRITE(nHeight);
+        READWRITE(txid);
+        READWRITE(txidx);
+        READWRITE(outidx);
+        READWRITE(isMine);
+        READWRITE(vOutputs);
+    }
+};
+
 class SaplingWallet
 {
 private:
     std::unique_ptr<SaplingWalletPtr, decltype(&sapling_wallet_free)> inner;
 
+    //Operations applied since the last persisted record
+    std::vector<SaplingWalletLogEntry> vPendingLog;
+    //Incremental records loaded from the wallet, keyed by sequence number
+    std::map<uint32_t, std::vector<SaplingWalletLogEntry>> mapLoadedLog;
+    //Set when the tree changed in a way the log does not capture
+    bool fSnapshotRequired = true;
+    //Incremental records persisted since the last snapshot
+    int nLogRecords = 0;
+
     friend class SaplingWalletNoteCommitmentTreeWriter;
     friend class SaplingWalletNoteCommitmentTreeLoader;
+
+    void Log(SaplingWalletLogEntry&& entry) {
+        if (fSnapshotRequired) {
+            return;
+        }
+        if (vPendingLog.size() >= SAPLING_WALLET_LOG_MAX_PENDING) {
+            vPendingLog.clear();
+            fSnapshotRequired = true;
+            return;
+        }
+        vPendingLog.emplace_back(std::move(entry));
+    }
+
+    bool AppendBundleCommitments(const int nBlockHeight, const CTransaction& tx, const int txidx) {
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << tx;
+        CRustTransaction rTx;
+        ss >> rTx;
+        SaplingBundle saplingBundle = rTx.GetSaplingBundle();
+
+        return sapling_wallet_append_bundle_commitments(
+                inner.get(),
+                (uint32_t) nBlockHeight,
+                txidx,
+                saplingBundle.GetDetails().as_ptr());
+    }
+
+    bool AppendSingleCommitment(const int nBlockHeight, const uint256& txid, int txidx, int outidx, const OutputDescription& output, bool isMine) {
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << output;
+
+        rust::box<sapling::Output> rustOutput = sapling::parse_v4_output({reinterpret_cast<uint8_t*>(ss.data()), ss.size()});
+        return sapling_wallet_append_single_commitment(
+                inner.get(),
+                (uint32_t) nBlockHeight,
+                txid.begin(),
+                txidx,
+                outidx,
+                (*rustOutput).as_ptr(),
+                isMine);
+    }
+
+    bool ApplyLogEntry(const SaplingWalletLogEntry& entry) {
+        switch (entry.nOp) {
+            case SAPLING_LOG_CHECKPOINT:
+                return sapling_wallet_checkpoint(inner.get(), (uint32_t) entry.nHeight);
+            case SAPLING_LOG_REWIND: {
+                uint32_t uResultHeight{0};
+                return sapling_wallet_rewind(inner.get(), (uint32_t) entry.nHeight, &uResultHeight);
+            }
+            case SAPLING_LOG_CLEAR_POSITIONS:
+                return clear_note_positions_for_txid(inner.get(), entry.txid.begin());
+            case SAPLING_LOG_CREATE_POSITIONS:
+                return create_single_txid_positions(inner.get(), (uint32_t) entry.nHeight, entry.txid.begin());
+            case SAPLING_LOG_APPEND_COMMITMENTS: {
+                //Only the outputs are needed to append the bundle commitments
+                CMutableTransaction mtx;
+                mtx.fOverwintered = true;
+                mtx.nVersion = SAPLING_TX_VERSION;
+                mtx.nVersionGroupId = SAPLING_VERSION_GROUP_ID;
+                mtx.vShieldedOutput = entry.vOutputs;
+                return AppendBundleCommitments(entry.nHeight, CTransaction(mtx), entry.txidx);
+            }
+            case SAPLING_LOG_APPEND_COMMITMENT:
+                return entry.vOutputs.size() == 1 &&
+                       AppendSingleCommitment(entry.nHeight, entry.txid, entry.txidx, entry.outidx, entry.vOutputs[0], entry.isMine);
+            case SAPLING_LOG_UNMARK:
+                return sapling_wallet_unmark_transaction_notes(inner.get(), entry.txid.begin());
+            case SAPLING_LOG_GARBAGE_COLLECT:
+                sapling_wallet_gc_note_commitment_tree(inner.get());
+                return true;
+        }
+        return false;
+    }
+
 public:
     SaplingWallet() : inner(sapling_wallet_new(), sapling_wallet_free) {}
-    SaplingWallet(SaplingWallet&& wallet_data) : inner(std::move(wallet_data.inner)) {}
+    SaplingWallet(SaplingWallet&& wallet_data) :
+        inner(std::move(wallet_data.inner)),
+        vPendingLog(std::move(wallet_data.vPendingLog)),
+        mapLoadedLog(std::move(wallet_data.mapLoadedLog)),
+        fSnapshotRequired(wallet_data.fSnapshotRequired),
+        nLogRecords(wallet_data.nLogRecords) {}
     SaplingWallet& operator=(SaplingWallet&& wallet)
     {
         if (this != &wallet) {
             inner = std::move(wallet.inner);
+            vPendingLog = std::move(wallet.vPendingLog);
+            mapLoadedLog = std::move(wallet.mapLoadedLog);
+            fSnapshotRequired = wallet.fSnapshotRequired;
+            nLogRecords = wallet.nLogRecords;
         }
         return *this;
     }
@@ -53,6 +195,8 @@ public:
      */
     void Reset() {
         sapling_wallet_reset(inner.get());
+        vPendingLog.clear();
+        fSnapshotRequired = true;
     }
 
     /**
@@ -65,6 +209,8 @@ public:
 
         assert(frontier.inner->init_wallet(
             reinterpret_cast<merkle_frontier::SaplingWallet*>(inner.get())));
+        vPendingLog.clear();
+        fSnapshotRequired = true;
 
         LogPrint("saplingwallet","Initialized Commitment Tree with LastCheckpointHeight %i\n", GetLastCheckpointHeight());
     }
@@ -76,7 +222,12 @@ public:
      */
     bool CheckpointNoteCommitmentTree(int nBlockHeight) {
         assert(nBlockHeight >= 0);
-        return sapling_wallet_checkpoint(inner.get(), (uint32_t) nBlockHeight);
+        if (!sapling_wallet_checkpoint(inner.get(), (uint32_t) nBlockHeight)) {
+            return false;
+        }
+
+        Log(SaplingWalletLogEntry(SAPLING_LOG_CHECKPOINT, nBlockHeight));
+        return true;
     }
 
     /**
@@ -98,7 +249,12 @@ public:
      */
     bool Rewind(int nBlockHeight, uint32_t& uResultHeight) {
         assert(nBlockHeight >= 0);
-        return sapling_wallet_rewind(inner.get(), (uint32_t) nBlockHeight, &uResultHeight);
+        if (!sapling_wallet_rewind(inner.get(), (uint32_t) nBlockHeight, &uResultHeight)) {
+            return false;
+        }
+
+        Log(SaplingWalletLogEntry(SAPLING_LOG_REWIND, nBlockHeight));
+        return true;
     }
 
 
@@ -110,6 +266,9 @@ public:
             return false;
         }
 
+        SaplingWalletLogEntry entry(SAPLING_LOG_CLEAR_POSITIONS, 0);
+        entry.txid = txid;
+        Log(std::move(entry));
         return true;
     }
     /**
@@ -122,21 +281,14 @@ public:
         assert(nBlockHeight >= 0);
 
         if(tx.vShieldedOutput.size()>0) {
-
-            CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-            ss << tx;
-            CRustTransaction rTx;
-            ss >> rTx;
-            SaplingBundle saplingBundle = rTx.GetSaplingBundle();
-
-            if (!sapling_wallet_append_bundle_commitments(
-                    inner.get(),
-                    (uint32_t) nBlockHeight,
-                    txidx,
-                    saplingBundle.GetDetails().as_ptr()
-                    )) {
+            if (!AppendBundleCommitments(nBlockHeight, tx, txidx)) {
                 return false;
             }
+
+            SaplingWalletLogEntry entry(SAPLING_LOG_APPEND_COMMITMENTS, nBlockHeight);
+            entry.txidx = txidx;
+            entry.vOutputs = tx.vShieldedOutput;
+            Log(std::move(entry));
         }
 
         return true;
@@ -150,6 +302,9 @@ public:
             return false;
         }
 
+        SaplingWalletLogEntry entry(SAPLING_LOG_CREATE_POSITIONS, nBlockHeight);
+        entry.txid = txid;
+        Log(std::move(entry));
         return true;
     }
     /**
@@ -163,21 +318,17 @@ public:
     bool AppendNoteCommitment(const int nBlockHeight, const uint256 txid, int txidx, int outidx, const OutputDescription output, bool isMine) {
         assert(nBlockHeight >= 0);
 
-        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-        ss << output;
-
-        rust::box<sapling::Output> rustOutput = sapling::parse_v4_output({reinterpret_cast<uint8_t*>(ss.data()), ss.size()});
-        if (!sapling_wallet_append_single_commitment(
-                inner.get(),
-                (uint32_t) nBlockHeight,
-                txid.begin(),
-                txidx,
-                outidx,
-                (*rustOutput).as_ptr(),
-                isMine)) {
+        if (!AppendSingleCommitment(nBlockHeight, txid, txidx, outidx, output, isMine)) {
             return false;
         }
 
+        SaplingWalletLogEntry entry(SAPLING_LOG_APPEND_COMMITMENT, nBlockHeight);
+        entry.txid = txid;
+        entry.txidx = txidx;
+        entry.outidx = outidx;
+        entry.isMine = isMine;
+        entry.vOutputs.push_back(output);
+        Log(std::move(entry));
         return true;
     }
 
@@ -191,7 +342,14 @@ public:
 
 
     bool UnMarkNoteForTransaction(const uint256 txid) {
-        return sapling_wallet_unmark_transaction_notes(inner.get(),txid.begin());
+        if (!sapling_wallet_unmark_transaction_notes(inner.get(),txid.begin())) {
+            return false;
+        }
+
+        SaplingWalletLogEntry entry(SAPLING_LOG_UNMARK, 0);
+        entry.txid = txid;
+        Log(std::move(entry));
+        return true;
     }
 
     bool IsNoteTracked(const uint256 txid, int outidx, uint64_t &position) {
@@ -265,6 +423,82 @@ public:
 
     void GarbageCollect() {
         sapling_wallet_gc_note_commitment_tree(inner.get());
+        Log(SaplingWalletLogEntry(SAPLING_LOG_GARBAGE_COLLECT, 0));
+    }
+
+    /**
+     * Whether the next write has to be a full snapshot of the tree, either because
+     * the log can not reproduce the current state or it is due for compaction.
+     */
+    bool SnapshotRequired() const {
+        return fSnapshotRequired || nLogRecords >= SAPLING_WALLET_LOG_COMPACT_INTERVAL;
+    }
+
+    /** Sequence number of the next incremental record, and the count to erase on compaction */
+    int GetLogRecordCount() const {
+        return nLogRecords;
+    }
+
+    const std::vector<SaplingWalletLogEntry>& GetPendingLog() const {
+        return vPendingLog;
+    }
+
+    /** Call once the write made by CWalletDB::WriteSaplingWitnesses has been committed */
+    void MarkPersisted(bool fSnapshot) {
+        if (fSnapshot) {
+            fSnapshotRequired = false;
+            nLogRecords = 0;
+        } else if (!vPendingLog.empty()) {
+            nLogRecords++;
+        }
+        vPendingLog.clear();
+    }
+
+    void AddLoadedLog(uint32_t nSeq, std::vector<SaplingWalletLogEntry>& vEntries) {
+        mapLoadedLog[nSeq].swap(vEntries);
+    }
+
+    /**
+     * Replay the incremental records read from the wallet on top of the loaded snapshot.
+     * If the log does not apply cleanly the tree is reset, so it is rebuilt from the chain.
+     */
+    bool ReplayLoadedLog() {
+        bool fReplayed = true;
+        if (!mapLoadedLog.empty()) {
+            if (fSnapshotRequired) {
+                LogPrintf("Sapling Wallet - Incremental tree records found without a snapshot, rebuilding\n");
+                fReplayed = false;
+            }
+            uint32_t nExpected = 0;
+            for (auto it = mapLoadedLog.begin(); fReplayed && it != mapLoadedLog.end(); ++it) {
+                if (it->first != nExpected++) {
+                    LogPrintf("Sapling Wallet - Incremental tree record %u missing, rebuilding\n", nExpected - 1);
+                    fReplayed = false;
+                    break;
+                }
+                for (const SaplingWalletLogEntry& entry : it->second) {
+                    bool fApplied = false;
+                    try {
+                        fApplied = ApplyLogEntry(entry);
+                    } catch (const std::exception& e) {
+                        LogPrintf("Sapling Wallet - %s\n", e.what());
+                    }
+                    if (!fApplied) {
+                        LogPrintf("Sapling Wallet - Failed to replay incremental tree record %u, rebuilding\n", it->first);
+                        fReplayed = false;
+                        break;
+                    }
+                }
+            }
+            nLogRecords = mapLoadedLog.rbegin()->first + 1;
+            mapLoadedLog.clear();
+            LogPrint("saplingwallet","Sapling Wallet - Replayed %i incremental tree records\n", nLogRecords);
+        }
+
+        if (!fReplayed) {
+            Reset();
+        }
+        return fReplayed;
     }
 
 };
@@ -314,6 +548,9 @@ public:
             throw std::ios_base::failure("Failed to load Sapling note commitment tree.");
             LogPrint("saplingwallet","Sapling Wallet - Wallet failed to load\n");
         } else {
+            wallet.vPendingLog.clear();
+            wallet.fSnapshotRequired = false;
+            wallet.nLogRecords = 0;
             LogPrint("saplingwallet","Sapling Wallet - Wallet loaded\n");
         }
     }
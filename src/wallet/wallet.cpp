@@ -22,6 +22,7 @@
 
 #include "asyncrpcqueue.h"
 #include "checkpoints.h"
+#include "checkqueue.h"
 #include "coincontrol.h"
 #include "consensus/upgrades.h"
 #include "consensus/validation.h"
@@ -52,6 +53,7 @@
 #include "komodo_defs.h"
 
 #include <assert.h>
+#include <future>
 #include <random>
 
 #include <boost/algorithm/string/replace.hpp>
@@ -89,6 +91,7 @@ int scanperc;
 bool fTxDeleteEnabled = false;
 bool fTxConflictDeleteEnabled = false;
 int fDeleteInterval = DEFAULT_TX_DELETE_INTERVAL;
+int nRescanBatchSize = DEFAULT_RESCAN_BATCH_SIZE;
 unsigned int fDeleteTransactionsAfterNBlocks = DEFAULT_TX_RETENTION_BLOCKS;
 unsigned int fKeepLastNTransactions = DEFAULT_TX_RETENTION_LASTTX;
 std::string recoverySeedPhrase = "";
@@ -593,6 +596,14 @@ SaplingWalletNoteCommitmentTreeLoader CWallet::GetSaplingNoteCommitmentTreeLoade
     return SaplingWalletNoteCommitmentTreeLoader(saplingWallet);
 }
 
+void CWallet::LoadSaplingWalletLog(uint32_t nSeq, std::vector<SaplingWalletLogEntry>& vEntries) {
+    saplingWallet.AddLoadedLog(nSeq, vEntries);
+}
+
+bool CWallet::ReplaySaplingWalletLog() {
+    return saplingWallet.ReplayLoadedLog();
+}
+
 // Add spending key to keystore and persist to disk
 bool CWallet::AddSproutZKey(const libzcash::SproutSpendingKey &key)
 {
@@ -1291,6 +1302,15 @@ void CWallet::ChainTip(const CBlockIndex *pindex,
 {
     LOCK2(cs_main, cs_wallet);
 
+    //A background rescan applies the new blocks to the Sapling wallet itself when it
+    //catches up with the tip, and rewinds them if they are disconnected. Consolidation,
+    //sweeps, deleting transactions and writing the locator need the wallet to be at the
+    //tip, so they are run by the rescan once it has finished.
+    if (fRescanInBackground) {
+        fChainTipDeferred = true;
+        return;
+    }
+
     if (added) {
         IncrementSaplingWallet(pindex);
         // Prevent witness cache building && consolidation transactions
@@ -1925,11 +1945,70 @@ void CWallet::RemoveFromSaplingSpends(const uint256& wtxid)
 void CWallet::LoadArcTxs(const uint256& wtxid, const ArchiveTxPoint& arcTxPt)
 {
     mapArcTxs[wtxid] = arcTxPt;
+    IndexArcTx(wtxid, arcTxPt);
+}
+
+/**
+ * Place an archived transaction in the height ordered history index, replacing
+ * any previous position, and drop its cached history record.
+ */
+void CWallet::IndexArcTx(const uint256& wtxid, const ArchiveTxPoint& arcTxPt)
+{
+    UnIndexArcTx(wtxid);
+
+    //The block may not be known yet when the wallet is loaded during a reindex
+    BlockMap::iterator mi = mapBlockIndex.find(arcTxPt.hashBlock);
+    if (arcTxPt.hashBlock.IsNull() || mi == mapBlockIndex.end() || mi->second == NULL) {
+        setArcTxsUnindexed.insert(wtxid);
+        return;
+    }
+
+    std::pair<int,int> key = make_pair(mi->second->nHeight, arcTxPt.nIndex);
+    mapArcTxsByHeight[key] = wtxid;
+    mapArcTxsHeightKey[wtxid] = key;
+    setWalletTxsUnindexed.erase(wtxid);
+}
+
+/**
+ * Retry archived transactions whose block was not in the block index when they were added.
+ */
+void CWallet::IndexPendingArcTxs()
+{
+    std::set<uint256> setPending;
+    setPending.swap(setArcTxsUnindexed);
+
+    for (std::set<uint256>::iterator it = setPending.begin(); it != setPending.end(); ++it) {
+        std::map<uint256, ArchiveTxPoint>::iterator ait = mapArcTxs.find(*it);
+        if (ait != mapArcTxs.end()) {
+            IndexArcTx(ait->first, ait->second);
+        }
+    }
+}
+
+void CWallet::UnIndexArcTx(const uint256& wtxid)
+{
+    eraseCachedRpcArcTx(wtxid);
+    setArcTxsUnindexed.erase(wtxid);
+    if (mapWallet.count(wtxid)) {
+        setWalletTxsUnindexed.insert(wtxid);
+    }
+
+    std::map<uint256, std::pair<int,int>>::iterator it = mapArcTxsHeightKey.find(wtxid);
+    if (it == mapArcTxsHeightKey.end()) {
+        return;
+    }
+
+    std::map<std::pair<int,int>, uint256>::iterator hit = mapArcTxsByHeight.find(it->second);
+    if (hit != mapArcTxsByHeight.end() && hit->second == wtxid) {
+        mapArcTxsByHeight.erase(hit);
+    }
+    mapArcTxsHeightKey.erase(it);
 }
 
 void CWallet::AddToArcTxs(const uint256& wtxid, ArchiveTxPoint& arcTxPt)
 {
     mapArcTxs[wtxid] = arcTxPt;
+    IndexArcTx(wtxid, arcTxPt);
 
     uint256 txid = wtxid;
     RpcArcTransaction arcTx;
@@ -1963,6 +2042,7 @@ void CWallet::AddToArcTxs(const uint256& wtxid, ArchiveTxPoint& arcTxPt)
 void CWallet::AddToArcTxs(const CWalletTx& wtx, int txHeight, ArchiveTxPoint& arcTxPt)
 {
     mapArcTxs[wtx.GetHash()] = arcTxPt;
+    IndexArcTx(wtx.GetHash(), arcTxPt);
 
     CWalletTx tx = wtx;
     RpcArcTransaction arcTx;
@@ -3310,6 +3390,8 @@ void CWallet::UpdateNullifierNoteMapWithTx(const CWalletTx& wtx)
             }
         }
     }
+
+    UpdateSaplingNoteIndexWithTx(wtx);
 }
 
 /**
@@ -3411,6 +3493,69 @@ void CWallet::UpdateSaplingNullifierNoteMapWithTx(CWalletTx* wtx) {
             }
         }
     }
+
+    UpdateSaplingNoteIndexWithTx(*wtx);
+}
+
+/**
+ * Add the notes of a wallet transaction to the decrypted note index, and drop
+ * index entries for notes the transaction no longer holds. Notes already in the
+ * index are not decrypted again.
+ */
+void CWallet::UpdateSaplingNoteIndexWithTx(const CWalletTx& wtx) {
+    LOCK(cs_wallet);
+
+    uint256 hash = wtx.GetHash();
+
+    //Remove notes that are no longer part of the transaction
+    auto it = mapSaplingNoteIndex.lower_bound(SaplingOutPoint(hash, 0));
+    while (it != mapSaplingNoteIndex.end() && it->first.hash == hash) {
+        if (wtx.mapSaplingNoteData.count(it->first) == 0) {
+            mapSaplingAddressNotes[it->second.address].erase(it->first);
+            it = mapSaplingNoteIndex.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    for (const mapSaplingNoteData_t::value_type& item : wtx.mapSaplingNoteData) {
+        SaplingOutPoint op = item.first;
+        const SaplingNoteData& nd = item.second;
+
+        if (mapSaplingNoteIndex.count(op) != 0 || op.n >= wtx.vShieldedOutput.size()) {
+            continue;
+        }
+
+        auto optDeserialized = SaplingNotePlaintext::attempt_sapling_enc_decryption_deserialization(wtx.vShieldedOutput[op.n].encCiphertext, nd.ivk, wtx.vShieldedOutput[op.n].ephemeralKey);
+        if (optDeserialized == boost::none) {
+            LogPrintf("%s: unable to decrypt note %s\n", __func__, op.ToString());
+            continue;
+        }
+
+        auto notePt = optDeserialized.get();
+        auto maybe_pa = nd.ivk.address(notePt.d);
+        auto maybe_note = notePt.note(nd.ivk);
+        if (!maybe_pa || !maybe_note) {
+            continue;
+        }
+
+        SaplingNoteIndexEntry entry {maybe_pa.get(), maybe_note.get(), notePt.memo()};
+        mapSaplingAddressNotes[entry.address].insert(op);
+        mapSaplingNoteIndex.emplace(op, entry);
+    }
+}
+
+/**
+ * Remove all notes of a transaction from the decrypted note index.
+ */
+void CWallet::EraseSaplingNoteIndexForTx(const uint256& hash) {
+    LOCK(cs_wallet);
+
+    auto it = mapSaplingNoteIndex.lower_bound(SaplingOutPoint(hash, 0));
+    while (it != mapSaplingNoteIndex.end() && it->first.hash == hash) {
+        mapSaplingAddressNotes[it->second.address].erase(it->first);
+        it = mapSaplingNoteIndex.erase(it);
+    }
 }
 
 /**
@@ -3440,6 +3585,9 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
         mapWallet[hash].BindWallet(this);
         UpdateNullifierNoteMapWithTx(mapWallet[hash]);
         AddToSpends(hash);
+        if (!mapArcTxsHeightKey.count(hash)) {
+            setWalletTxsUnindexed.insert(hash);
+        }
     }
     else
     {
@@ -3448,11 +3596,13 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
         pair<map<uint256, CWalletTx>::iterator, bool> ret = mapWallet.insert(make_pair(hash, wtxIn));
         CWalletTx& wtx = (*ret.first).second;
         wtx.BindWallet(this);
-        UpdateNullifierNoteMapWithTx(wtx);
         bool fInsertedNew = ret.second;
         if (fInsertedNew) {
             AddToSpends(hash);
             wtx.nOrderPos = IncOrderPosNext(pwalletdb);
+            if (!mapArcTxsHeightKey.count(hash)) {
+                setWalletTxsUnindexed.insert(hash);
+            }
         }
 
         //Set Transaction Time
@@ -3494,6 +3644,9 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
             }
         }
 
+        //Index the notes after the merge, so notes merged into an existing tx are included
+        UpdateNullifierNoteMapWithTx(wtx);
+
         //// debug print
         LogPrintf("AddToWallet %s  %s%s\n", wtxIn.GetHash().ToString(), (fInsertedNew ? "new" : ""), (fUpdated ? "update" : ""));
 
@@ -3533,14 +3686,25 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
  * If fUpdate is true, existing transactions will be updated.
  */
 void CWallet::AddToWalletIfInvolvingMe(const std::vector<CTransaction> &vtx, std::vector<CTransaction> &vAddedTxes, const CBlock* pblock, const int nHeight, bool fUpdate, std::set<SaplingPaymentAddress>& addressesFound, bool fRescan)
+{
+    AssertLockHeld(cs_wallet);
+
+    //Step 1 -- decrypt transactions
+    auto saplingNoteDataAndAddressesToAdd = FindMySaplingNotes(vtx, nHeight);
+    AddToWalletIfInvolvingMe(vtx, saplingNoteDataAndAddressesToAdd, vAddedTxes, pblock, nHeight, fUpdate, addressesFound, fRescan);
+}
+
+/**
+ * Add a transaction to the wallet, or update it, using the result of a
+ * FindMySaplingNotes call that already covered these transactions.
+ */
+void CWallet::AddToWalletIfInvolvingMe(const std::vector<CTransaction> &vtx, const std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap> &saplingNoteDataAndAddressesToAdd, std::vector<CTransaction> &vAddedTxes, const CBlock* pblock, const int nHeight, bool fUpdate, std::set<SaplingPaymentAddress>& addressesFound, bool fRescan)
 {
     {
         AssertLockHeld(cs_wallet);
 
-        //Step 1 -- decrypt transactions
-        auto saplingNoteDataAndAddressesToAdd = FindMySaplingNotes(vtx, nHeight);
-        auto saplingNoteData = saplingNoteDataAndAddressesToAdd.first;
-        auto addressesToAdd = saplingNoteDataAndAddressesToAdd.second;
+        const auto &saplingNoteData = saplingNoteDataAndAddressesToAdd.first;
+        const auto &addressesToAdd = saplingNoteDataAndAddressesToAdd.second;
 
         //Step 2 -- add addresses
         for (const auto &addressToAdd : addressesToAdd) {
@@ -3557,12 +3721,9 @@ void CWallet::AddToWalletIfInvolvingMe(const std::vector<CTransaction> &vtx, std
             uint256 hash = vtx[i].GetHash();
             mapSaplingNoteData_t noteData;
 
-            for (mapSaplingNoteData_t::iterator it = saplingNoteData.begin(); it != saplingNoteData.end(); it++) {
-                SaplingOutPoint op = (*it).first;
-                SaplingNoteData nd = (*it).second;
-                if (op.hash == hash) {
-                      noteData.insert(std::make_pair(op, nd));
-                }
+            //Notes are ordered by txid, collect the ones belonging to this transaction
+            for (mapSaplingNoteData_t::const_iterator it = saplingNoteData.lower_bound(SaplingOutPoint(hash, 0)); it != saplingNoteData.end() && (*it).first.hash == hash; it++) {
+                noteData.insert(*it);
             }
 
             bool fExisted = mapWallet.count(vtx[i].GetHash()) != 0;
@@ -3692,12 +3853,16 @@ bool CWallet::EraseFromWallet(const uint256 &hash)
     if (IsCrypted()) {
         if (!IsLocked()) {
           if (mapWallet.erase(hash)) {
+              EraseSaplingNoteIndexForTx(hash);
+              setWalletTxsUnindexed.erase(hash);
               uint256 chash = HashWithFP(hash);
               return CWalletDB(strWalletFile).EraseCryptedTx(chash);
           }
         }
     } else {
         if (mapWallet.erase(hash)) {
+            EraseSaplingNoteIndexForTx(hash);
+            setWalletTxsUnindexed.erase(hash);
             return CWalletDB(strWalletFile).EraseTx(hash);
         }
     }
@@ -3800,28 +3965,66 @@ mapSproutNoteData_t CWallet::FindMySproutNotes(const CTransaction &tx) const
 
 
 /**
- * Finds all output notes in the given transaction that have been sent to
- * SaplingPaymentAddresses in this wallet.
- *
- * It should never be necessary to call this method with a CWalletTx, because
- * the result of FindMySaplingNotes (for the addresses available at the time) will
- * already have been cached in CWalletTx.mapSaplingNoteData.
+ * A batch of trial decryptions for the Sapling decryption worker pool. Each
+ * batch collects its results in its own buffers, which are merged by the
+ * caller once the whole queue has been processed, so the workers never
+ * contend on a lock.
  */
-static void DecryptSaplingNoteWorker(const CWallet *wallet, std::vector<const SaplingIncomingViewingKey*> vIvk, std::vector<const OutputDescription*> vOutput, std::vector<uint32_t> vPosition, const std::vector<uint256> vHash, const int &height, mapSaplingNoteData_t *noteData, SaplingIncomingViewingKeyMap *viewingKeysToAdd, int threadNumber)
+class CSaplingNoteDecryptionCheck
+{
+private:
+    std::vector<const SaplingIncomingViewingKey*> vIvk;
+    std::vector<const OutputDescription*> vOutput;
+    std::vector<uint32_t> vPosition;
+    std::vector<uint256> vHash;
+    std::vector<int> vHeight;
+    mapSaplingNoteData_t *noteData;
+    SaplingIncomingViewingKeyMap *viewingKeysToAdd;
+
+public:
+    CSaplingNoteDecryptionCheck(): noteData(NULL), viewingKeysToAdd(NULL) {}
+    CSaplingNoteDecryptionCheck(mapSaplingNoteData_t *noteDataIn, SaplingIncomingViewingKeyMap *viewingKeysToAddIn) :
+        noteData(noteDataIn), viewingKeysToAdd(viewingKeysToAddIn) {}
+
+    void Add(const SaplingIncomingViewingKey *ivk, const OutputDescription *output, uint32_t position, const uint256 &hash, int height) {
+        vIvk.emplace_back(ivk);
+        vOutput.emplace_back(output);
+        vPosition.emplace_back(position);
+        vHash.emplace_back(hash);
+        vHeight.emplace_back(height);
+    }
+
+    bool IsEmpty() const {
+        return vIvk.empty();
+    }
+
+    bool operator()();
+
+    void swap(CSaplingNoteDecryptionCheck &check) {
+        vIvk.swap(check.vIvk);
+        vOutput.swap(check.vOutput);
+        vPosition.swap(check.vPosition);
+        vHash.swap(check.vHash);
+        vHeight.swap(check.vHeight);
+        std::swap(noteData, check.noteData);
+        std::swap(viewingKeysToAdd, check.viewingKeysToAdd);
+    }
+};
+
+bool CSaplingNoteDecryptionCheck::operator()()
 {
     for (int i = 0; i < vIvk.size(); i++) {
-        const SaplingIncomingViewingKey ivk = *vIvk[i];
-        const OutputDescription output = *vOutput[i];
-        const uint256 hash = vHash[i];
+        const SaplingIncomingViewingKey &ivk = *vIvk[i];
+        const OutputDescription &output = *vOutput[i];
 
-        auto result = SaplingNotePlaintext::decrypt(Params().GetConsensus(), height, output.encCiphertext, ivk, output.ephemeralKey, output.cmu);
+        auto result = SaplingNotePlaintext::decrypt(Params().GetConsensus(), vHeight[i], output.encCiphertext, ivk, output.ephemeralKey, output.cmu);
         if (result) {
 
             auto address = ivk.address(result.get().d);
 
             // We don't cache the nullifier here as computing it requires knowledge of the note position
             // in the commitment tree, which can only be determined when the transaction has been mined.
-            SaplingOutPoint op {hash, vPosition[i]};
+            SaplingOutPoint op {vHash[i], vPosition[i]};
             SaplingNoteData nd;
             nd.ivk = ivk;
 
@@ -3833,17 +4036,44 @@ static void DecryptSaplingNoteWorker(const CWallet *wallet, std::vector<const Sa
             if (nd.value >= minTxValue) {
                 //Only add notes greater then this value
                 //dust filter
-                {
-                    LOCK(wallet->cs_wallet_threadedfunction);
-                    viewingKeysToAdd->insert(make_pair(address.get(),ivk));
-                    noteData->insert(std::make_pair(op, nd));
-                }
+                viewingKeysToAdd->insert(make_pair(address.get(),ivk));
+                noteData->insert(std::make_pair(op, nd));
             }
         }
     }
+    //Decryption failures are expected, always continue with the queue
+    return true;
+}
+
+static CCheckQueue<CSaplingNoteDecryptionCheck> saplingdecryptionqueue(1);
+
+void ThreadSaplingDecryption() {
+    RenameThread("pirate-decrypt");
+    saplingdecryptionqueue.Thread();
 }
 
+/**
+ * Finds all output notes in the given transaction that have been sent to
+ * SaplingPaymentAddresses in this wallet.
+ *
+ * It should never be necessary to call this method with a CWalletTx, because
+ * the result of FindMySaplingNotes (for the addresses available at the time) will
+ * already have been cached in CWalletTx.mapSaplingNoteData.
+ */
 std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap> CWallet::FindMySaplingNotes(const std::vector<CTransaction> &vtx, int height) const
+{
+    std::vector<const std::vector<CTransaction>*> vvtx(1, &vtx);
+    std::vector<int> vHeight(1, height);
+    return FindMySaplingNotes(vvtx, vHeight);
+}
+
+/**
+ * Finds all output notes in a window of blocks that have been sent to
+ * SaplingPaymentAddresses in this wallet. vvtx holds the transactions of
+ * each block and vHeight the matching block heights, the trial decryptions
+ * of the whole window are spread over the decryption worker pool at once.
+ */
+std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap> CWallet::FindMySaplingNotes(const std::vector<const std::vector<CTransaction>*> &vvtx, const std::vector<int> &vHeight) const
 {
     LOCK(cs_wallet);
 
@@ -3851,81 +4081,54 @@ std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap> CWallet::FindMySap
     mapSaplingNoteData_t noteData;
     SaplingIncomingViewingKeyMap viewingKeysToAdd;
 
-    //Create key thread buckets
-    std::vector<const SaplingIncomingViewingKey*> vIvk;
-    std::vector<std::vector<const SaplingIncomingViewingKey*>> vvIvk;
-
-    //Create OutputDescription thread buckets
-    std::vector<const OutputDescription*> vOutputDescrition;
-    std::vector<std::vector<const OutputDescription*>> vvOutputDescrition;
-
-    //Create transaction position thread buckets
-    std::vector<uint32_t> vPosition;
-    std::vector<std::vector<uint32_t>> vvPosition;
-
-    //Create transaction hash thread buckets
-    std::vector<uint256> vHash;
-    std::vector<std::vector<uint256>> vvHash;
+    //Per batch result buffers, merged once all batches are done
+    std::vector<mapSaplingNoteData_t> vNoteData(maxProcessingThreads);
+    std::vector<SaplingIncomingViewingKeyMap> vViewingKeysToAdd(maxProcessingThreads);
 
+    //Create one batch per processing thread
+    std::vector<CSaplingNoteDecryptionCheck> vChecks;
     for (uint32_t i = 0; i < maxProcessingThreads; i++) {
-        vvIvk.emplace_back(vIvk);
-        vvOutputDescrition.emplace_back(vOutputDescrition);
-        vvPosition.emplace_back(vPosition);
-        vvHash.emplace_back(vHash);
+        vChecks.emplace_back(&vNoteData[i], &vViewingKeysToAdd[i]);
     }
 
     // Protocol Spec: 4.19 Block Chain Scanning (Sapling)
     uint32_t t = 0;
-    for (uint32_t j = 0; j < vtx.size(); j++) {
-        //Transaction being processed
-        uint256 hash = vtx[j].GetHash();
-        for (uint32_t i = 0; i < vtx[j].vShieldedOutput.size(); i++) {
-            for (auto it = setSaplingIncomingViewingKeys.begin(); it != setSaplingIncomingViewingKeys.end(); it++) {
-                vvIvk[t].emplace_back(&(*it));
-                vvOutputDescrition[t].emplace_back(&vtx[j].vShieldedOutput[i]);
-                vvPosition[t].emplace_back(i);
-                vvHash[t].emplace_back(hash);
-                //Increment ivk vector
-                t++;
-                //reset if ivk vector is greater qty of threads being used
-                if (t >= vvIvk.size()) {
-                    t = 0;
+    for (uint32_t b = 0; b < vvtx.size(); b++) {
+        const std::vector<CTransaction> &vtx = *vvtx[b];
+        for (uint32_t j = 0; j < vtx.size(); j++) {
+            //Transaction being processed
+            uint256 hash = vtx[j].GetHash();
+            for (uint32_t i = 0; i < vtx[j].vShieldedOutput.size(); i++) {
+                for (auto it = setSaplingIncomingViewingKeys.begin(); it != setSaplingIncomingViewingKeys.end(); it++) {
+                    vChecks[t].Add(&(*it), &vtx[j].vShieldedOutput[i], i, hash, vHeight[b]);
+                    //Increment batch
+                    t++;
+                    //reset if batch is greater qty of threads being used
+                    if (t >= vChecks.size()) {
+                        t = 0;
+                    }
                 }
             }
         }
     }
 
+    //Drop empty batches
+    vChecks.erase(std::remove_if(vChecks.begin(), vChecks.end(),
+        [](const CSaplingNoteDecryptionCheck &check) { return check.IsEmpty(); }), vChecks.end());
 
-    std::vector<boost::thread*> decryptionThreads;
-    for (uint32_t i = 0; i < vvIvk.size(); ++i) {
-        if(!vvIvk[i].empty()) {
-            decryptionThreads.emplace_back(new boost::thread(DecryptSaplingNoteWorker, this, vvIvk[i], vvOutputDescrition[i], vvPosition[i], vvHash[i], height, &noteData, &viewingKeysToAdd, i));
-        }
+    //Hand the batches to the persistent worker pool, this thread joins in until the queue is drained
+    if (!vChecks.empty()) {
+        CCheckQueueControl<CSaplingNoteDecryptionCheck> control(&saplingdecryptionqueue);
+        control.Add(vChecks);
+        control.Wait();
     }
 
-    // Cleanup
-    for (auto dthread : decryptionThreads) {
-        dthread->join();
-        delete dthread;
+    //Merge the per batch results
+    for (uint32_t i = 0; i < vNoteData.size(); i++) {
+        noteData.insert(vNoteData[i].begin(), vNoteData[i].end());
+        viewingKeysToAdd.insert(vViewingKeysToAdd[i].begin(), vViewingKeysToAdd[i].end());
     }
 
-    //clean up pointers
-    for (uint32_t i = 0; i < vvOutputDescrition.size(); i++) {
-        for (auto pOutputDescrition : vOutputDescrition) {
-            delete pOutputDescrition;
-        }
-        vvOutputDescrition[i].resize(0);
-    }
-    vvOutputDescrition.resize(0);
-
-    for (uint32_t i = 0; i < vvIvk.size(); i++) {
-        for (auto pIvk : vIvk) {
-            delete pIvk;
-        }
-        vvIvk[i].resize(0);
-    }
-    vvIvk.resize(0);
-
     return std::make_pair(noteData, viewingKeysToAdd);
 }
 
@@ -4991,6 +5194,7 @@ bool CWallet::DeleteTransactions(std::vector<uint256> &removeTxs, std::vector<ui
     //Remove Conflicted ArcTx transactions from the wallet database
     for (int i = 0; i < removeArcTxs.size(); i++) {
         if (mapArcTxs.erase(removeArcTxs[i])) {
+            UnIndexArcTx(removeArcTxs[i]);
             walletdb.EraseArcTx(removeArcTxs[i]);
             //remove conflicted transactions from GUI
             if (!fRescan) {
@@ -5289,42 +5493,100 @@ bool CWallet::initalizeArcTx() {
 
 }
 
+/**
+ * Collect up to nSize blocks of the active chain starting at pindex.
+ */
+static std::vector<CBlockIndex*> GetRescanWindow(CBlockIndex* pindex, int nSize)
+{
+    AssertLockHeld(cs_main);
+    std::vector<CBlockIndex*> vWindow;
+    while (pindex && vWindow.size() < nSize) {
+        vWindow.emplace_back(pindex);
+        pindex = chainActive.Next(pindex);
+    }
+    return vWindow;
+}
+
+/**
+ * Read and deserialize a window of blocks, run ahead of the rescan so the
+ * disk stays busy while the previous window is being decrypted. Stops at the
+ * first block that cannot be read, so fewer blocks than requested are returned.
+ */
+static std::vector<CBlock> ReadRescanBlocks(const std::vector<CBlockIndex*> vWindow)
+{
+    std::vector<CBlock> vBlocks(vWindow.size());
+    for (int i = 0; i < vWindow.size(); i++) {
+        if (!ReadBlockFromDisk(vBlocks[i], vWindow[i], 1)) {
+            LogPrintf("%s: failed to read block %s at height %d\n", __func__, vWindow[i]->GetBlockHash().ToString(), vWindow[i]->nHeight);
+            vBlocks.resize(i);
+            break;
+        }
+    }
+    return vBlocks;
+}
+
 /**
  * Scan the block chain (starting in pindexStart) for transactions
  * from or to us. If fUpdate is true, found transactions that already
- * exist in the wallet will be updated.
+ * exist in the wallet will be updated. Returns -1 if a block could not be
+ * read, in which case the wallet is left at the last block scanned.
  */
-int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate, bool fIgnoreBirthday, bool LockOnFinish, bool resetSaplingWallet)
+int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate, bool fIgnoreBirthday, bool LockOnFinish, bool resetSaplingWallet, bool fBackground)
 {
     if (nMaxConnections == 0) {
         //Ignore function for cold storage offline mode
         return false;
     }
+
+    //A background rescan reads and decrypts blocks without cs_main and only takes the
+    //locks in short windows to commit each batch of blocks
+    if (fBackground) {
+        return ScanForWalletTransactionsInternal(pindexStart, fUpdate, fIgnoreBirthday, LockOnFinish, resetSaplingWallet, true);
+    }
+
+    //Hold cs_main and cs_wallet for the whole rescan
     LOCK2(cs_main, cs_wallet);
-    //Notify GUI of rescan
-    NotifyRescanStarted();
+    //Lock cs_keystore to prevent wallet from locking during rescan
+    LOCK(cs_KeyStore);
+    return ScanForWalletTransactionsInternal(pindexStart, fUpdate, fIgnoreBirthday, LockOnFinish, resetSaplingWallet, false);
+}
 
+int CWallet::ScanForWalletTransactionsInternal(CBlockIndex* pindexStart, bool fUpdate, bool fIgnoreBirthday, bool LockOnFinish, bool resetSaplingWallet, bool fBackground)
+{
     int ret = 0;
     int64_t nNow = GetTime();
     const CChainParams& chainParams = Params();
 
     CBlockIndex* pindex = pindexStart;
 
-    //Reset the wallet location to the rescan start. This will force the rescan to start over
-    //if the wallet is killed part way through
-    currentBlock = chainActive.GetLocator(pindex);
-    chainHeight = pindex->nHeight;
-    SetBestChain(currentBlock, chainHeight);
-
     std::set<uint256> txList;
     std::set<uint256> txListOriginal;
 
     //Collect Sapling Addresses to notify GUI after rescan
     std::set<SaplingPaymentAddress> addressesFound;
 
+    double dProgressStart;
+    double dProgressTip;
+
     {
-        //Lock cs_keystore to prevent wallet from locking during rescan
-        LOCK(cs_KeyStore);
+        LOCK2(cs_main, cs_wallet);
+
+        //The background rescan cannot make progress while a foreground rescan holds
+        //cs_main, so the caller is told to try again once it has finished
+        if (fRescanInBackground) {
+            LogPrintf("%s: a background rescan is already running, rescan again once it has finished\n", __func__);
+            return -1;
+        }
+        fRescanInBackground = fBackground;
+
+        //Notify GUI of rescan
+        NotifyRescanStarted();
+
+        //Reset the wallet location to the rescan start. This will force the rescan to start over
+        //if the wallet is killed part way through
+        currentBlock = chainActive.GetLocator(pindex);
+        chainHeight = pindex->nHeight;
+        SetBestChain(currentBlock, chainHeight);
 
         //Get List of current list of txids
         for (map<uint256, ArchiveTxPoint>::iterator it = pwalletMain->mapArcTxs.begin(); it != pwalletMain->mapArcTxs.end(); ++it)
@@ -5342,74 +5604,193 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate, b
             pindex = chainActive.Next(pindex);
 
         uiInterface.ShowProgress(_("Rescanning..."), 0, false); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
-        double dProgressStart = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false);
-        double dProgressTip = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), chainActive.Tip(), false);
+        dProgressStart = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false);
+        dProgressTip = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), chainActive.Tip(), false);
 
         // //Reset the sapling Wallet
         if (resetSaplingWallet) {
           SaplingWalletReset();
         }
+    }
+
+    //Last block applied to the wallet, the next window always continues from here
+    CBlockIndex* pindexLast = pindex ? pindex->pprev : NULL;
+    //Set if a block could not be read from disk
+    bool fAborted = false;
+
+    //Prefetch stage -- read and deserialize the first window of blocks
+    std::vector<CBlockIndex*> vWindow;
+    {
+        LOCK(cs_main);
+        vWindow = GetRescanWindow(pindex, nRescanBatchSize);
+    }
+    std::future<std::vector<CBlock>> fBlocks;
+    if (!vWindow.empty()) {
+        fBlocks = std::async(std::launch::async, ReadRescanBlocks, vWindow);
+    }
+
+    while (!vWindow.empty())
+    {
+        //exit loop if trying to shutdown
+        if (ShutdownRequested()) {
+            break;
+        }
 
-        while (pindex)
+        //Collect the prefetched window and start reading the next one from disk
+        std::vector<CBlock> vBlocks = fBlocks.get();
+        if (vBlocks.size() != vWindow.size()) {
+            fAborted = true;
+            break;
+        }
+        std::vector<CBlockIndex*> vNextWindow;
         {
-            //exit loop if trying to shutdown
-            if (ShutdownRequested()) {
-                break;
+            LOCK(cs_main);
+            vNextWindow = GetRescanWindow(chainActive.Next(vWindow.back()), nRescanBatchSize);
+        }
+        if (!vNextWindow.empty()) {
+            fBlocks = std::async(std::launch::async, ReadRescanBlocks, vNextWindow);
+        }
+
+        //Decryption stage -- trial decrypt the outputs of the whole window across all ivks
+        std::vector<const std::vector<CTransaction>*> vvtx;
+        std::vector<int> vHeight;
+        for (int i = 0; i < vWindow.size(); i++) {
+            vvtx.emplace_back(&vBlocks[i].vtx);
+            vHeight.emplace_back(vWindow[i]->nHeight);
+        }
+        auto saplingNoteDataAndAddressesToAdd = FindMySaplingNotes(vvtx, vHeight);
+
+        //Commit stage -- apply the results block by block in chain order
+        bool fReorganized = false;
+        {
+            LOCK2(cs_main, cs_wallet);
+            //Lock cs_keystore to prevent wallet from locking during the commit
+            LOCK(cs_KeyStore);
+
+            //The chain can only have moved if cs_main was released since the window was read
+            if (fBackground && (!chainActive.Contains(vWindow.back()) || vWindow.front()->pprev != pindexLast)) {
+                //Rewind the blocks applied from a branch that is no longer active
+                const CBlockIndex* pindexFork = chainActive.FindFork(vWindow.front());
+                while (pindexLast && pindexLast != pindexFork && !chainActive.Contains(pindexLast)) {
+                    CBlock block;
+                    if (!ReadBlockFromDisk(block, pindexLast, 1)) {
+                        LogPrintf("%s: failed to read block %s while rewinding the rescan\n", __func__, pindexLast->GetBlockHash().ToString());
+                        fAborted = true;
+                        break;
+                    }
+                    DecrementSaplingWallet(pindexLast);
+                    UpdateNullifierNoteMapForBlock(&block);
+                    pindexLast = pindexLast->pprev;
+                }
+                LogPrintf("Rescan interrupted by a chain reorganization, continuing from block %d\n", pindexLast ? pindexLast->nHeight : -1);
+                fReorganized = true;
             }
 
-            if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
+            for (int w = 0; w < vWindow.size() && !fReorganized && !fAborted; w++)
             {
-                scanperc = (int)((Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100);
-                uiInterface.ShowProgress(_(("Rescanning - Currently on block " + std::to_string(pindex->nHeight) + "...").c_str()), std::max(1, std::min(99, scanperc)), false);
-            }
+                pindex = vWindow[w];
 
-            bool blockInvolvesMe = false;
-            CBlock block;
-            ReadBlockFromDisk(block, pindex,1);
+                if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
+                {
+                    scanperc = (int)((Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100);
+                    uiInterface.ShowProgress(_(("Rescanning - Currently on block " + std::to_string(pindex->nHeight) + "...").c_str()), std::max(1, std::min(99, scanperc)), false);
+                }
 
-            std::vector<CTransaction> vOurs;
-            AddToWalletIfInvolvingMe(block.vtx, vOurs, &block, pindex->nHeight, fUpdate, addressesFound, true);
+                std::vector<CTransaction> vOurs;
+                AddToWalletIfInvolvingMe(vBlocks[w].vtx, saplingNoteDataAndAddressesToAdd, vOurs, &vBlocks[w], pindex->nHeight, fUpdate, addressesFound, true);
+                //Addresses found in the window only need to be added once
+                saplingNoteDataAndAddressesToAdd.second.clear();
 
-            for (int i = 0; i < vOurs.size(); i++) {
-                blockInvolvesMe = true;
-                txList.insert(vOurs[i].GetHash());
-                ret++;
-            }
+                for (int i = 0; i < vOurs.size(); i++) {
+                    txList.insert(vOurs[i].GetHash());
+                    ret++;
+                }
 
-            IncrementSaplingWallet(pindex);
+                IncrementSaplingWallet(pindex);
+                pindexLast = pindex;
+
+                SproutMerkleTree sproutTree;
+                SaplingMerkleTree saplingTree;
+                SaplingMerkleFrontier saplingFrontierTree;
+                // This should never fail: we should always be able to get the tree
+                // state on the path to the tip of our chain
+                assert(pcoinsTip->GetSproutAnchorAt(pindex->hashSproutAnchor, sproutTree));
+                if (pindex->pprev) {
+                    if (NetworkUpgradeActive(pindex->pprev->nHeight, Params().GetConsensus(), Consensus::UPGRADE_SAPLING)) {
+                        assert(pcoinsTip->GetSaplingAnchorAt(pindex->pprev->hashFinalSaplingRoot, saplingTree));
+                        assert(pcoinsTip->GetSaplingFrontierAnchorAt(pindex->pprev->hashFinalSaplingRoot, saplingFrontierTree));
+                    }
+                }
 
-            SproutMerkleTree sproutTree;
-            SaplingMerkleTree saplingTree;
-            SaplingMerkleFrontier saplingFrontierTree;
-            // This should never fail: we should always be able to get the tree
-            // state on the path to the tip of our chain
-            assert(pcoinsTip->GetSproutAnchorAt(pindex->hashSproutAnchor, sproutTree));
-            if (pindex->pprev) {
-                if (NetworkUpgradeActive(pindex->pprev->nHeight, Params().GetConsensus(), Consensus::UPGRADE_SAPLING)) {
-                    assert(pcoinsTip->GetSaplingAnchorAt(pindex->pprev->hashFinalSaplingRoot, saplingTree));
-                    assert(pcoinsTip->GetSaplingFrontierAnchorAt(pindex->pprev->hashFinalSaplingRoot, saplingFrontierTree));
+                //Delete Transactions
+                if (pindex->nHeight % fDeleteInterval == 0)
+                    while(DeleteWalletTransactions(pindex, true)) {}
+
+                if (GetTime() >= nNow + 60) {
+                    nNow = GetTime();
+                    LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex));
+                }
+            }
+
+            //Catch up to the live tip, the last window is looked up while still holding cs_main
+            //so no block can be connected between the final commit and the end of the rescan
+            if (!fReorganized && !fAborted && vNextWindow.empty()) {
+                vNextWindow = GetRescanWindow(chainActive.Next(pindexLast), nRescanBatchSize);
+                if (!vNextWindow.empty()) {
+                    fBlocks = std::async(std::launch::async, ReadRescanBlocks, vNextWindow);
+                } else {
+                    //Caught up, ChainTip applies any block connected from here on
+                    fRescanInBackground = false;
                 }
             }
+        }
 
-            //Delete Transactions
-            if (pindex->nHeight % fDeleteInterval == 0)
-                while(DeleteWalletTransactions(pindex, true)) {}
+        if (fAborted) {
+            break;
+        }
 
-            if (GetTime() >= nNow + 60) {
-                nNow = GetTime();
-                LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex));
+        if (fReorganized) {
+            //Drop the prefetched window and restart from the fork point
+            if (!vNextWindow.empty()) {
+                fBlocks.get();
+            }
+            LOCK(cs_main);
+            vNextWindow = GetRescanWindow(pindexLast ? chainActive.Next(pindexLast) : chainActive.Genesis(), nRescanBatchSize);
+            if (!vNextWindow.empty()) {
+                fBlocks = std::async(std::launch::async, ReadRescanBlocks, vNextWindow);
             }
-            pindex = chainActive.Next(pindex);
         }
 
+        vWindow = vNextWindow;
+    }
+
+    //Wait for an outstanding prefetch if the rescan was interrupted
+    if (fBlocks.valid()) {
+        fBlocks.wait();
+    }
+
+    {
+        LOCK2(cs_main, cs_wallet);
+        LOCK(cs_KeyStore);
+
+        fRescanInBackground = false;
+
         uiInterface.ShowProgress(_("Rescanning..."), 100, false); // hide progress dialog in GUI
 
         // // Update the Sapling Wallet Merkle tree
         //IncrementSaplingWallet(chainActive.Tip());
 
         //Write all transactions ant block loacator to the wallet
-        currentBlock = chainActive.GetLocator();
-        chainHeight = chainActive.Tip()->nHeight;
+        if (fAborted) {
+            //Leave the locator at the last block scanned so the rescan resumes from there
+            LogPrintf("%s: rescan aborted after block %d, restart the node to resume it\n", __func__, pindexLast ? pindexLast->nHeight : -1);
+            currentBlock = pindexLast ? chainActive.GetLocator(pindexLast) : CBlockLocator();
+            chainHeight = pindexLast ? pindexLast->nHeight : 0;
+            ret = -1;
+        } else {
+            currentBlock = chainActive.GetLocator();
+            chainHeight = chainActive.Tip()->nHeight;
+        }
         SetBestChain(currentBlock, chainHeight);
 
         //Delete transactions
@@ -5418,14 +5799,23 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate, b
         //Write everything to the wallet
         SetBestChain(currentBlock, chainHeight);
 
+        //Run the tip work ChainTip deferred while the rescan was running
+        if (fChainTipDeferred) {
+            fChainTipDeferred = false;
+            if (!fAborted && !IsInitialBlockDownload() && chainActive.Tip()->GetBlockTime() > GetTime() - 8640) {
+                RunSaplingConsolidation(chainActive.Tip()->nHeight);
+                RunSaplingSweep(chainActive.Tip()->nHeight);
+            }
+        }
+
         if (LockOnFinish && IsCrypted()) {
             Lock();
         }
-    }
 
-    //Notfiy GUI of all new addresses found
-    for (std::set<SaplingPaymentAddress>::iterator it = addressesFound.begin(); it != addressesFound.end(); it++) {
-        SetZAddressBook(*it, "z-sapling", "", true);
+        //Notfiy GUI of all new addresses found
+        for (std::set<SaplingPaymentAddress>::iterator it = addressesFound.begin(); it != addressesFound.end(); it++) {
+            SetZAddressBook(*it, "z-sapling", "", true);
+        }
     }
 
     //Notify GUI of all new transactions found
@@ -7954,7 +8344,9 @@ bool CWallet::SaplingWalletGetPathRootWithCMU(libzcash::MerklePath &merklePath,
 
 void CWallet::SaplingWalletReset() {
    saplingWallet.Reset();
-   CWalletDB(strWalletFile).WriteSaplingWitnesses(saplingWallet);
+   if (CWalletDB(strWalletFile).WriteSaplingWitnesses(saplingWallet)) {
+       saplingWallet.MarkPersisted(true);
+   }
 }
 
 /**
@@ -7995,126 +8387,85 @@ void CWallet::GetFilteredNotes(
 {
     LOCK2(cs_main, cs_wallet);
 
-    for (auto & p : mapWallet) {
-        CWalletTx wtx = p.second;
+    //Collect the candidate notes from the index, only visiting the requested addresses
+    std::vector<std::map<SaplingOutPoint, SaplingNoteIndexEntry>::const_iterator> vCandidates;
+    if (filterAddresses.empty()) {
+        for (auto it = mapSaplingNoteIndex.begin(); it != mapSaplingNoteIndex.end(); ++it) {
+            vCandidates.emplace_back(it);
+        }
+    } else {
+        for (const auto& addr : filterAddresses) {
+            auto saplingAddr = boost::get<libzcash::SaplingPaymentAddress>(&addr);
+            if (saplingAddr == nullptr) {
+                continue;
+            }
+            auto ait = mapSaplingAddressNotes.find(*saplingAddr);
+            if (ait == mapSaplingAddressNotes.end()) {
+                continue;
+            }
+            for (const auto& op : ait->second) {
+                auto it = mapSaplingNoteIndex.find(op);
+                if (it != mapSaplingNoteIndex.end()) {
+                    vCandidates.emplace_back(it);
+                }
+            }
+        }
+    }
+
+    for (const auto& it : vCandidates) {
+        const SaplingOutPoint& op = it->first;
+        const SaplingNoteIndexEntry& entry = it->second;
+
+        auto wit = mapWallet.find(op.hash);
+        if (wit == mapWallet.end()) {
+            continue;
+        }
+        const CWalletTx& wtx = wit->second;
+
+        auto ndit = wtx.mapSaplingNoteData.find(op);
+        if (ndit == wtx.mapSaplingNoteData.end()) {
+            continue;
+        }
+        const SaplingNoteData& nd = ndit->second;
 
         // Filter the transactions before checking for notes
         if (!CheckFinalTx(wtx) || wtx.GetBlocksToMaturity() > 0)
             continue;
 
+        int nDepth = wtx.GetDepthInMainChain();
         if (minDepth > 1) {
-            int nHeight    = tx_height(wtx.GetHash());
-            int nDepth     = wtx.GetDepthInMainChain();
+            //The height of a confirmed transaction follows from its depth, no need to look it up on disk
+            int nHeight    = nDepth > 0 ? chainActive.Height() - nDepth + 1 : 0;
             int dpowconfs  = komodo_dpowconfs(nHeight,nDepth);
             if ( dpowconfs < minDepth || dpowconfs > maxDepth) {
                 continue;
             }
         } else {
-            if ( wtx.GetDepthInMainChain() < minDepth ||
-                wtx.GetDepthInMainChain() > maxDepth) {
+            if ( nDepth < minDepth || nDepth > maxDepth) {
                 continue;
             }
         }
 
-        // for (auto & pair : wtx.mapSproutNoteData) {
-        //     JSOutPoint jsop = pair.first;
-        //     SproutNoteData nd = pair.second;
-        //     SproutPaymentAddress pa = nd.address;
-        //
-        //     // skip notes which belong to a different payment address in the wallet
-        //     if (!(filterAddresses.empty() || filterAddresses.count(pa))) {
-        //         continue;
-        //     }
-        //
-        //     // skip note which has been spent
-        //     if (ignoreSpent && nd.nullifier && IsSproutSpent(*nd.nullifier)) {
-        //         continue;
-        //     }
-        //
-        //     // skip notes which cannot be spent
-        //     if (requireSpendingKey && !HaveSproutSpendingKey(pa)) {
-        //         continue;
-        //     }
-        //
-        //     // skip locked notes
-        //     if (ignoreLocked && IsLockedNote(jsop)) {
-        //         continue;
-        //     }
-        //
-        //     int i = jsop.js; // Index into CTransaction.vjoinsplit
-        //     int j = jsop.n; // Index into JSDescription.ciphertexts
-        //
-        //     // Get cached decryptor
-        //     ZCNoteDecryption decryptor;
-        //     if (!GetNoteDecryptor(pa, decryptor)) {
-        //         // Note decryptors are created when the wallet is loaded, so it should always exist
-        //         throw std::runtime_error(strprintf("Could not find note decryptor for payment address %s", EncodePaymentAddress(pa)));
-        //     }
-        //
-        //     // determine amount of funds in the note
-        //     auto hSig = wtx.vjoinsplit[i].h_sig(*pzcashParams, wtx.joinSplitPubKey);
-        //     try {
-        //         SproutNotePlaintext plaintext = SproutNotePlaintext::decrypt(
-        //                 decryptor,
-        //                 wtx.vjoinsplit[i].ciphertexts[j],
-        //                 wtx.vjoinsplit[i].ephemeralKey,
-        //                 hSig,
-        //                 (unsigned char) j);
-        //
-        //         sproutEntries.push_back(CSproutNotePlaintextEntry{jsop, pa, plaintext, wtx.GetDepthInMainChain()});
-        //
-        //     } catch (const note_decryption_failed &err) {
-        //         // Couldn't decrypt with this spending key
-        //         throw std::runtime_error(strprintf("Could not decrypt note for payment address %s", EncodePaymentAddress(pa)));
-        //     } catch (const std::exception &exc) {
-        //         // Unexpected failure
-        //         throw std::runtime_error(strprintf("Error while decrypting note for payment address %s: %s", EncodePaymentAddress(pa), exc.what()));
-        //     }
-        // }
-
-        for (auto & pair : wtx.mapSaplingNoteData) {
-            SaplingOutPoint op = pair.first;
-            SaplingNoteData nd = pair.second;
-
-            auto optDeserialized = SaplingNotePlaintext::attempt_sapling_enc_decryption_deserialization(wtx.vShieldedOutput[op.n].encCiphertext, nd.ivk, wtx.vShieldedOutput[op.n].ephemeralKey);
-
-            // The transaction would not have entered the wallet unless
-            // its plaintext had been successfully decrypted previously.
-            assert(optDeserialized != boost::none);
-
-            auto notePt = optDeserialized.get();
-            auto maybe_pa = nd.ivk.address(notePt.d);
-            assert(static_cast<bool>(maybe_pa));
-            auto pa = maybe_pa.get();
-
-            // skip notes which belong to a different payment address in the wallet
-            if (!(filterAddresses.empty() || filterAddresses.count(pa))) {
-                continue;
-            }
+        if (ignoreSpent && nd.nullifier && IsSaplingSpent(*nd.nullifier)) {
+            continue;
+        }
 
-            if (ignoreSpent && nd.nullifier && IsSaplingSpent(*nd.nullifier)) {
+        // skip notes which cannot be spent
+        if (requireSpendingKey) {
+            libzcash::SaplingExtendedFullViewingKey extfvk;
+            if (!(GetSaplingFullViewingKey(nd.ivk, extfvk) &&
+                HaveSaplingSpendingKey(extfvk))) {
                 continue;
             }
+        }
 
-            // skip notes which cannot be spent
-            if (requireSpendingKey) {
-                libzcash::SaplingExtendedFullViewingKey extfvk;
-                if (!(GetSaplingFullViewingKey(nd.ivk, extfvk) &&
-                    HaveSaplingSpendingKey(extfvk))) {
-                    continue;
-                }
-            }
-
-            // skip locked notes
-            // TODO: Add locking for Sapling notes -> done
-             if (ignoreLocked && IsLockedNote(op)) {
-                 continue;
-             }
-
-            auto note = notePt.note(nd.ivk).get();
-            saplingEntries.push_back(SaplingNoteEntry {
-                op, pa, note, notePt.memo(), wtx.GetDepthInMainChain() });
+        // skip locked notes
+        if (ignoreLocked && IsLockedNote(op)) {
+            continue;
         }
+
+        saplingEntries.push_back(SaplingNoteEntry {
+            op, entry.address, entry.note, entry.memo, nDepth });
     }
 }
 
@@ -70,6 +70,7 @@ extern bool fWalletRbf;
 extern bool fTxDeleteEnabled;
 extern bool fTxConflictDeleteEnabled;
 extern int fDeleteInterval;
+extern int nRescanBatchSize;
 extern unsigned int fDeleteTransactionsAfterNBlocks;
 extern unsigned int fKeepLastNTransactions;
 extern std::string recoverySeedPhrase;
@@ -79,6 +80,9 @@ extern int maxProcessingThreads;
 
 extern SecureString *strOpeningWalletPassphrase;
 
+/** Worker thread for the persistent Sapling note decryption pool */
+void ThreadSaplingDecryption();
+
 //! -paytxfee default
 static const CAmount DEFAULT_TRANSACTION_FEE = 0;
 //! -fallbackfee default
@@ -112,6 +116,9 @@ static const size_t HD_WALLET_SEED_LENGTH = 32;
 //Default Transaction Rentention N-BLOCKS
 static const int DEFAULT_TX_DELETE_INTERVAL = 10000;
 
+//Default number of blocks read and trial decrypted together during a rescan
+static const int DEFAULT_RESCAN_BATCH_SIZE = 100;
+
 //Default Transaction Rentention N-BLOCKS
 static const unsigned int DEFAULT_TX_RETENTION_BLOCKS = 10000;
 
@@ -418,6 +425,14 @@ struct SaplingNoteEntry
     int confirmations;
 };
 
+/** Decrypted contents of a wallet note, cached so note selection does not decrypt again. */
+struct SaplingNoteIndexEntry
+{
+    libzcash::SaplingPaymentAddress address;
+    libzcash::SaplingNote note;
+    std::array<unsigned char, ZC_MEMO_SIZE> memo;
+};
+
 /** A transaction with a merkle branch linking it to the block chain. */
 class CMerkleTx : public CTransaction
 {
@@ -884,12 +899,18 @@ private:
     void RemoveFromSaplingSpends(const uint256& wtxid);
     void RemoveFromSpends(const uint256& wtxid);
 
+    int ScanForWalletTransactionsInternal(CBlockIndex* pindexStart, bool fUpdate, bool fIgnoreBirthday, bool LockOnFinish, bool resetSaplingWallet, bool fBackground);
+
 public:
     //Height for Lockmessage in GUI
     int chainHeight = 0;
     int walletHeight = 0;
 
     bool needsRescan = false;
+    //True while a rescan runs without holding cs_main, protected by cs_main and cs_wallet
+    bool fRescanInBackground = false;
+    //Set when ChainTip skipped blocks during a background rescan, the rescan runs the deferred tip work when it ends
+    bool fChainTipDeferred = false;
     bool fSaplingConsolidationEnabled = false;
     bool fConsolidationRunning = false;
     int initializeConsolidationInterval = (Params().GetConsensus().nPowTargetSpacing/60) * 60 * 24 * 7; //Intialize 1 per week
@@ -930,6 +951,17 @@ public:
     void AddToArcTxs(const uint256& wtxid, ArchiveTxPoint& arcTxPt);
     void AddToArcTxs(const CWalletTx& wtx, int txHeight, ArchiveTxPoint& arcTxPt);
 
+    //Archived transactions ordered by block height and position in the block,
+    //kept in step with mapArcTxs so history paging does not need to sort
+    std::map<std::pair<int,int>, uint256> mapArcTxsByHeight;
+    std::map<uint256, std::pair<int,int>> mapArcTxsHeightKey;
+    std::set<uint256> setArcTxsUnindexed;
+    //Wallet transactions with no position in mapArcTxsByHeight - unconfirmed & conflicted
+    std::set<uint256> setWalletTxsUnindexed;
+    void IndexArcTx(const uint256& wtxid, const ArchiveTxPoint& arcTxPt);
+    void UnIndexArcTx(const uint256& wtxid);
+    void IndexPendingArcTxs();
+
     std::map<uint256, JSOutPoint> mapArcJSOutPoints;
     void AddToArcJSOutPoints(const uint256& nullifier, const JSOutPoint& op);
 
@@ -1171,8 +1203,10 @@ protected:
             return;
         }
 
-        // Add persistence of Sapling incremental witness tree
+        // Add persistence of Sapling incremental witness tree, only the operations since
+        // the last write are appended until the tree is due for a compacting snapshot
         saplingWallet.GarbageCollect();
+        bool fSaplingSnapshot = saplingWallet.SnapshotRequired();
         if (!walletdb.WriteSaplingWitnesses(saplingWallet)) {
             LogPrintf("SetBestChain(): Failed to write Sapling witnesses, aborting atomic write\n");
             walletdb.TxnAbort();
@@ -1184,6 +1218,7 @@ protected:
             LogPrintf("SetBestChain(): Couldn't commit atomic write\n");
             return;
         }
+        saplingWallet.MarkPersisted(fSaplingSnapshot);
 
         //Clear Unsaved Sapling Addresses after successful TxnCommit
         mapUnsavedSaplingIncomingViewingKeys.clear();
@@ -1338,6 +1373,16 @@ public:
 
     std::map<uint256, SaplingOutPoint> mapSaplingNullifiersToNotes;
 
+    /**
+     * Index of the decrypted Sapling notes held in mapWallet, and of the notes
+     * received by each payment address. Kept in step with mapSaplingNoteData
+     * when transactions are added, updated by a block or erased, so that
+     * GetFilteredNotes only visits the notes of the requested addresses and
+     * never decrypts. Spent, locked and depth state are checked on lookup.
+     */
+    std::map<SaplingOutPoint, SaplingNoteIndexEntry> mapSaplingNoteIndex;
+    std::map<libzcash::SaplingPaymentAddress, std::set<SaplingOutPoint>> mapSaplingAddressNotes;
+
     std::map<uint256, CWalletTx> mapWallet;
     bool fRunSetBestChain = false;
 
@@ -1585,6 +1630,8 @@ public:
      * tree from a stream into the Orchard wallet.
      */
     SaplingWalletNoteCommitmentTreeLoader GetSaplingNoteCommitmentTreeLoader();
+    void LoadSaplingWalletLog(uint32_t nSeq, std::vector<SaplingWalletLogEntry>& vEntries);
+    bool ReplaySaplingWalletLog();
 
 
 
@@ -1610,6 +1657,8 @@ public:
     void UpdateNullifierNoteMapWithTx(const CWalletTx& wtx);
     void UpdateSproutNullifierNoteMapWithTx(CWalletTx& wtx);
     void UpdateSaplingNullifierNoteMapWithTx(CWalletTx* wtx);
+    void UpdateSaplingNoteIndexWithTx(const CWalletTx& wtx);
+    void EraseSaplingNoteIndexForTx(const uint256& hash);
     void UpdateNullifierNoteMapForBlock(const CBlock* pblock);
     bool AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletDB* pwalletdb, int nHeight, bool fRescan = false);
     bool EraseFromWallet(const uint256 &hash);
@@ -1617,6 +1666,7 @@ public:
     void ForceRescanWallet();
     void RescanWallet();
     void AddToWalletIfInvolvingMe(const std::vector<CTransaction> &vtx, std::vector<CTransaction> &vAddedTxes, const CBlock* pblock, const int nHeight, bool fUpdate, std::set<libzcash::SaplingPaymentAddress>& addressesFound, bool fRescan = false);
+    void AddToWalletIfInvolvingMe(const std::vector<CTransaction> &vtx, const std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap> &saplingNoteDataAndAddressesToAdd, std::vector<CTransaction> &vAddedTxes, const CBlock* pblock, const int nHeight, bool fUpdate, std::set<libzcash::SaplingPaymentAddress>& addressesFound, bool fRescan = false);
     void WitnessNoteCommitment(
          std::vector<uint256> commitments,
          std::vector<boost::optional<SproutWitness>>& witnesses,
@@ -1626,7 +1676,7 @@ public:
     bool DeleteTransactions(std::vector<uint256> &removeTxs, std::vector<uint256> &removeArcTxs, bool fRescan = false);
     bool DeleteWalletTransactions(const CBlockIndex* pindex, bool fRescan = false);
     bool initalizeArcTx();
-    int ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate = false, bool fIgnoreBirthday = false, bool LockOnFinish = false, bool resetSaplingWallet = false);
+    int ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate = false, bool fIgnoreBirthday = false, bool LockOnFinish = false, bool resetSaplingWallet = false, bool fBackground = false);
     void ReacceptWalletTransactions();
     void ResendWalletTransactions(int64_t nBestBlockTime);
     std::vector<uint256> ResendWalletTransactionsBefore(int64_t nTime);
@@ -1668,6 +1718,7 @@ public:
         uint8_t n) const;
     mapSproutNoteData_t FindMySproutNotes(const CTransaction& tx) const;
     std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap> FindMySaplingNotes(const std::vector<CTransaction> &vtx, int height) const;
+    std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap> FindMySaplingNotes(const std::vector<const std::vector<CTransaction>*> &vvtx, const std::vector<int> &vHeight) const;
     bool IsSproutNullifierFromMe(const uint256& nullifier) const;
     bool IsSaplingNullifierFromMe(const uint256& nullifier) const;
 
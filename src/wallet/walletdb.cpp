@@ -34,6 +34,8 @@
 #include "komodo_defs.h"
 #include "komodo_bitcoind.h"
 
+#include <future>
+
 #include <boost/filesystem.hpp>
 #include <boost/foreach.hpp>
 #include <boost/scoped_ptr.hpp>
@@ -567,6 +569,23 @@ bool CWalletDB::EraseSaplingExtendedFullViewingKey(
 
 bool CWalletDB::WriteSaplingWitnesses(const SaplingWallet& wallet) {
     nWalletDBUpdated++;
+
+    //Append only the operations since the last write until compaction is due
+    if (!wallet.SnapshotRequired()) {
+        if (wallet.GetPendingLog().empty())
+            return true;
+
+        return Write(
+                std::make_pair(std::string("sapling_tree_log"), (uint32_t)wallet.GetLogRecordCount()),
+                wallet.GetPendingLog());
+    }
+
+    //Compact, the snapshot supersedes every incremental record
+    for (int i = 0; i < wallet.GetLogRecordCount(); i++) {
+        if (!Erase(std::make_pair(std::string("sapling_tree_log"), (uint32_t)i)))
+            return false;
+    }
+
     return Write(
             std::string("sapling_note_commitment_tree"),
             SaplingWalletNoteCommitmentTreeWriter(wallet));
@@ -791,6 +810,54 @@ public:
     }
 };
 
+/**
+ * Check a wallet transaction read from the database and add it to the wallet.
+ * ssValue holds any trailing data left after the transaction was read.
+ */
+static bool LoadWalletTx(CWallet* pwallet, const uint256& hash, CWalletTx& wtx,
+                         CDataStream& ssValue, CWalletScanState &wss, string& strErr)
+{
+    CValidationState state;
+    auto verifier = ProofVerifier::Strict();
+    // ac_public chains set at height like KMD and ZEX, will force a rescan if we dont ignore this error: bad-txns-acpublic-chain
+    // there cannot be any ztx in the wallet on ac_public chains that started from block 1, so this wont affect those.
+    // PIRATE fails this check for notary nodes, need exception. Triggers full rescan without it.
+    if ( !(CheckTransaction(0,wtx, state, verifier, 0, 0) && (wtx.GetHash() == hash) && state.IsValid()) && (state.GetRejectReason() != "bad-txns-acpublic-chain" && state.GetRejectReason() != "bad-txns-acprivacy-chain" && state.GetRejectReason() != "bad-txns-stakingtx") )
+    {
+        //fprintf(stderr, "tx failed: %s rejectreason.%s\n", wtx.GetHash().GetHex().c_str(), state.GetRejectReason().c_str());
+        // vin-empty on staking chains is error relating to a failed staking tx, that for some unknown reason did not fully erase. save them here to erase and re-add later on.
+        if ( ASSETCHAINS_STAKED != 0 && state.GetRejectReason() == "bad-txns-vin-empty" )
+            deadTxns.push_back(hash);
+        return false;
+    }
+    // Undo serialize changes in 31600
+    if (31404 <= wtx.fTimeReceivedIsTxTime && wtx.fTimeReceivedIsTxTime <= 31703)
+    {
+        if (!ssValue.empty())
+        {
+            char fTmp;
+            char fUnused;
+            ssValue >> fTmp >> fUnused >> wtx.strFromAccount;
+            strErr = strprintf("LoadWallet() upgrading tx ver=%d %d '%s' %s",
+                               wtx.fTimeReceivedIsTxTime, fTmp, wtx.strFromAccount, hash.ToString());
+            wtx.fTimeReceivedIsTxTime = fTmp;
+        }
+        else
+        {
+            strErr = strprintf("LoadWallet() repairing tx ver=%d %s", wtx.fTimeReceivedIsTxTime, hash.ToString());
+            wtx.fTimeReceivedIsTxTime = 0;
+        }
+        wss.vWalletUpgrade.push_back(hash);
+    }
+
+    if (wtx.nOrderPos == -1)
+        wss.fAnyUnordered = true;
+
+    wss.nWalletTx++;
+    pwallet->AddToWallet(wtx, true, NULL, 0);
+    return true;
+}
+
 bool
 ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
              CWalletScanState &wss, string& strType, string& strErr)
@@ -865,44 +932,8 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
                     }
                 }
 
-                CValidationState state;
-                auto verifier = ProofVerifier::Strict();
-                // ac_public chains set at height like KMD and ZEX, will force a rescan if we dont ignore this error: bad-txns-acpublic-chain
-                // there cannot be any ztx in the wallet on ac_public chains that started from block 1, so this wont affect those.
-                // PIRATE fails this check for notary nodes, need exception. Triggers full rescan without it.
-                if ( !(CheckTransaction(0,wtx, state, verifier, 0, 0) && (wtx.GetHash() == hash) && state.IsValid()) && (state.GetRejectReason() != "bad-txns-acpublic-chain" && state.GetRejectReason() != "bad-txns-acprivacy-chain" && state.GetRejectReason() != "bad-txns-stakingtx") )
-                {
-                    //fprintf(stderr, "tx failed: %s rejectreason.%s\n", wtx.GetHash().GetHex().c_str(), state.GetRejectReason().c_str());
-                    // vin-empty on staking chains is error relating to a failed staking tx, that for some unknown reason did not fully erase. save them here to erase and re-add later on.
-                    if ( ASSETCHAINS_STAKED != 0 && state.GetRejectReason() == "bad-txns-vin-empty" )
-                        deadTxns.push_back(hash);
+                if (!LoadWalletTx(pwallet, hash, wtx, ssValue, wss, strErr))
                     return false;
-                }
-                // Undo serialize changes in 31600
-                if (31404 <= wtx.fTimeReceivedIsTxTime && wtx.fTimeReceivedIsTxTime <= 31703)
-                {
-                    if (!ssValue.empty())
-                    {
-                        char fTmp;
-                        char fUnused;
-                        ssValue >> fTmp >> fUnused >> wtx.strFromAccount;
-                        strErr = strprintf("LoadWallet() upgrading tx ver=%d %d '%s' %s",
-                                           wtx.fTimeReceivedIsTxTime, fTmp, wtx.strFromAccount, hash.ToString());
-                        wtx.fTimeReceivedIsTxTime = fTmp;
-                    }
-                    else
-                    {
-                        strErr = strprintf("LoadWallet() repairing tx ver=%d %s", wtx.fTimeReceivedIsTxTime, hash.ToString());
-                        wtx.fTimeReceivedIsTxTime = 0;
-                    }
-                    wss.vWalletUpgrade.push_back(hash);
-                }
-
-                if (wtx.nOrderPos == -1)
-                    wss.fAnyUnordered = true;
-
-                wss.nWalletTx++;
-                pwallet->AddToWallet(wtx, true, NULL, 0);
             }
         }
         else if (strType == "arctx" || strType == "carctx") //carctx is encrypted arctx
@@ -1503,6 +1534,14 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
             auto loader = pwallet->GetSaplingNoteCommitmentTreeLoader();
             ssValue >> loader;
         }
+        else if (strType == "sapling_tree_log")
+        {
+            uint32_t nSeq;
+            ssKey >> nSeq;
+            std::vector<SaplingWalletLogEntry> vEntries;
+            ssValue >> vEntries;
+            pwallet->LoadSaplingWalletLog(nSeq, vEntries);
+        }
 
     } catch (...)
     {
@@ -1511,6 +1550,89 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
     return true;
 }
 
+/**
+ * Encrypted transaction data record held back from the cursor loop so it can be
+ * decrypted and deserialized in parallel, then merged into the wallet in order.
+ */
+class CDeferredWalletRecord {
+public:
+    std::string strType;
+    uint256 chash;
+    std::vector<unsigned char> vchCryptedSecret;
+
+    bool fDecrypted;
+    bool fException;
+    uint256 hash; //txid for ctx and carctx, nullifier for carczsop
+    CWalletTx wtx;
+    ArchiveTxPoint arcTxPt;
+    SaplingOutPoint op;
+
+    CDeferredWalletRecord() : fDecrypted(false), fException(false) {}
+};
+
+static bool IsDeferredType(const string& strType)
+{
+    return (strType == "ctx" || strType == "carctx" || strType == "carczsop");
+}
+
+static void DecryptDeferredRecords(CWallet* pwallet, std::vector<CDeferredWalletRecord>* pvRecords, size_t nStart, size_t nEnd)
+{
+    for (size_t i = nStart; i < nEnd; i++) {
+        CDeferredWalletRecord& rec = (*pvRecords)[i];
+        try {
+            if (rec.strType == "ctx") {
+                rec.fDecrypted = pwallet->DecryptWalletTransaction(rec.chash, rec.vchCryptedSecret, rec.hash, rec.wtx);
+            } else if (rec.strType == "carctx") {
+                rec.fDecrypted = pwallet->DecryptWalletArchiveTransaction(rec.chash, rec.vchCryptedSecret, rec.hash, rec.arcTxPt);
+            } else {
+                rec.fDecrypted = pwallet->DecryptArchivedSaplingOutpoint(rec.chash, rec.vchCryptedSecret, rec.hash, rec.op);
+            }
+        } catch (...) {
+            rec.fException = true;
+        }
+        //Release the ciphertext once it is no longer needed
+        std::vector<unsigned char>().swap(rec.vchCryptedSecret);
+    }
+}
+
+/**
+ * Add a decrypted record to the wallet, matching the handling of the same record
+ * type in ReadKeyValue. Must be called in cursor order from a single thread.
+ */
+static bool MergeDeferredRecord(CWallet* pwallet, CDeferredWalletRecord& rec, CWalletScanState &wss, string& strErr)
+{
+    if (rec.strType == "ctx") {
+        if (rec.fException)
+            return false;
+        if (!rec.fDecrypted) {
+            strErr = "Error reading wallet database: DecryptWalletTransaction failed";
+            return false;
+        }
+        //The encrypted value holds no trailing data after the transaction
+        CDataStream ssEmpty(SER_DISK, CLIENT_VERSION);
+        return LoadWalletTx(pwallet, rec.hash, rec.wtx, ssEmpty, wss, strErr);
+    } else if (rec.strType == "carctx") {
+        //An older ArchiveTxPoint fails to deserialize and is skipped, see ReadKeyValue
+        if (rec.fException)
+            return true;
+        if (!rec.fDecrypted) {
+            strErr = "Error reading wallet database: DecryptWalletArchiveTransaction failed";
+            return false;
+        }
+        wss.nArcTx++;
+        pwallet->LoadArcTxs(rec.hash, rec.arcTxPt);
+    } else {
+        if (rec.fException)
+            return false;
+        if (!rec.fDecrypted) {
+            strErr = "Error reading wallet database: DecryptArchivedSaplingOutpoint failed";
+            return false;
+        }
+        pwallet->AddToArcSaplingOutPoints(rec.hash, rec.op);
+    }
+    return true;
+}
+
 static bool IsKeyType(string strType)
 {
     return (strType == "key" || strType == "wkey" ||
@@ -1641,6 +1763,7 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
     CWalletScanState wss;
     bool fNoncriticalErrors = false;
     DBErrors result = DB_LOAD_OK;
+    std::vector<CDeferredWalletRecord> vDeferred;
 
     try {
         int nMinVersion = 0;
@@ -1673,6 +1796,26 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
                 return DB_CORRUPT;
             }
 
+            // Encrypted transaction data is decrypted in parallel once the
+            // cursor has been read to the end
+            if (nMaxConnections > 0) {
+                CDataStream ssType(ssKey);
+                string strPeekType;
+                ssType >> strPeekType;
+                if (IsDeferredType(strPeekType)) {
+                    CDeferredWalletRecord rec;
+                    rec.strType = strPeekType;
+                    try {
+                        ssType >> rec.chash;
+                        ssValue >> rec.vchCryptedSecret;
+                    } catch (...) {
+                        rec.fException = true;
+                    }
+                    vDeferred.push_back(rec);
+                    continue;
+                }
+            }
+
             // Try to be tolerant of single corrupt records:
             string strType, strErr;
             if (!ReadKeyValue(pwallet, ssKey, ssValue, wss, strType, strErr))
@@ -1694,6 +1837,37 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
                 LogPrintf("%s\n", strErr);
         }
         pcursor->close();
+
+        if (!vDeferred.empty()) {
+            int64_t nStart = GetTimeMillis();
+
+            //Decrypt and deserialize across the processing threads
+            size_t nThreads = std::max(1, maxProcessingThreads);
+            size_t nChunk = (vDeferred.size() + nThreads - 1) / nThreads;
+            std::vector<std::future<void>> vDecrypt;
+            for (size_t i = 0; i < vDeferred.size(); i += nChunk) {
+                vDecrypt.emplace_back(std::async(std::launch::async, DecryptDeferredRecords, pwallet, &vDeferred,
+                                                 i, std::min(i + nChunk, vDeferred.size())));
+            }
+            for (auto &f : vDecrypt) {
+                f.get();
+            }
+
+            //Merge into the wallet in cursor order
+            for (auto &rec : vDeferred) {
+                string strErr;
+                if (!MergeDeferredRecord(pwallet, rec, wss, strErr)) {
+                    // Leave other errors alone, if we try to fix them we might make things worse.
+                    fNoncriticalErrors = true; // ... but do warn the user there is something wrong.
+                }
+                if (!strErr.empty())
+                    LogPrintf("%s\n", strErr);
+            }
+
+            LogPrintf("Decrypted %u wallet records on %u threads in %dms\n",
+                      vDeferred.size(), vDecrypt.size(), GetTimeMillis() - nStart);
+            std::vector<CDeferredWalletRecord>().swap(vDeferred);
+        }
     }
     catch (const boost::thread_interrupted&) {
         throw;
@@ -1706,6 +1880,11 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
         LogPrintf("Loading Temp Held crypted data failed!!!\n");
     }
 
+    //Bring the Sapling note commitment tree up to date with its incremental records
+    if (result == DB_LOAD_OK) {
+        pwallet->ReplaySaplingWalletLog();
+    }
+
     if ( !deadTxns.empty() )
     {
         // staking chains with vin-empty error is a failed staking tx.
@@ -349,7 +349,8 @@ UniValue getsaplingblocks(const UniValue& params, bool fHelp,  const CPubKey& my
             + HelpExampleRpc("getsaplingblocks", "12800 1")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    //No wallet state is read here, light clients should prefer /rest/saplingblocks with -lightblockindex
+    LOCK(cs_main);
 
    int64_t nHeight = params[0].get_int64();
    int64_t nBlocks = params[1].get_int64();